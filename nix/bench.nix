@@ -0,0 +1,67 @@
+{ writeShellScriptBin, writers, python3Packages, git } :
+
+let
+  # appends the run to the history and compares it against the last run of another commit
+  compareRuns =
+    writers.writePython3 "bench-compare"
+      {
+        libraries = [ python3Packages.pandas python3Packages.tabulate ];
+      }
+      ''
+        import os
+        import sys
+        import pandas as pd
+
+        history_csv, run_csv, commit, max_regression = sys.argv[1:5]
+
+        run = pd.read_csv(run_csv)
+        run.insert(0, "commit", commit)
+
+        if os.path.exists(history_csv):
+            history = pd.read_csv(history_csv)
+        else:
+            history = run.iloc[0:0]
+
+        previous = history[history["commit"] != commit] \
+            .groupby("function").last()
+
+        run["previous_commit"] = run["function"].map(previous["commit"])
+        run["previous_ns_per_op"] = run["function"].map(previous["ns_per_op"])
+        run["change_pct"] = \
+            (run["ns_per_op"] / run["previous_ns_per_op"] - 1) * 100
+
+        pd.concat([history, run[history.columns]]) \
+            .to_csv(history_csv, index=False)
+
+        run.fillna("").to_markdown(sys.stdout, index=False, floatfmt=".1f")
+        print()
+
+        regressed = run[run["change_pct"] > float(max_regression)]
+        if not regressed.empty:
+            functions = ", ".join(regressed["function"])
+            sys.exit(f"\nSlower by more than {max_regression}%: {functions}")
+      '';
+
+in
+
+writeShellScriptBin "net-bench" ''
+  set -euo pipefail
+
+  iterations="''${1:-100000}"
+  url="''${2:-http://localhost:8080/post}"
+  max_regression="''${NET_BENCH_MAX_REGRESSION:-25}"
+
+  bench_dir=test/bench
+  mkdir -p $bench_dir
+  echo "*" > $bench_dir/.gitignore
+
+  run_csv=$bench_dir/run.csv
+  history_csv=$bench_dir/history.csv
+
+  net-with-nginx xpg --options "-c log_min_messages=WARNING" \
+    psql -v ON_ERROR_STOP=1 -f test/utils/bench.sql -c "call bench_hot_path($iterations, '$url')" \
+    -c "\pset format csv" -c "\o $run_csv" -c "select * from bench_run" > /dev/null
+
+  echo -e "## Benchmark results\n"
+  ${compareRuns} $history_csv $run_csv "$(${git}/bin/git rev-parse --short HEAD)" "$max_regression"
+''
@@ -58,6 +58,7 @@ writeShellScriptBin "net-loadtest" ''
 
   reqs=""
   batch_size_opt=""
+  event_backend_opt=""
 
   load_dir=test/load
   mkdir -p $load_dir
@@ -77,7 +78,15 @@ writeShellScriptBin "net-loadtest" ''
     batch_size_opt="-c pg_net.batch_size=$2"
   fi
 
-  net-with-nginx xpg --options "-c log_min_messages=WARNING $batch_size_opt" \
+  if [ -n "''${3:-}" ]; then
+    reqs="$reqs, '$3'"
+  fi
+
+  if [ -n "''${4:-}" ]; then
+    event_backend_opt="-c pg_net.event_backend=$4"
+  fi
+
+  net-with-nginx xpg --options "-c log_min_messages=WARNING $batch_size_opt $event_backend_opt" \
     psql -c "call wait_for_many_gets($reqs)" -c "\pset format csv" -c "\o $query_csv" -c "select * from run" > /dev/null &
 
   # wait for process to start so we can capture it with psrecord
@@ -0,0 +1,50 @@
+{ writeShellScriptBin, writers, python3Packages } :
+
+let
+  jsonToMd =
+    writers.writePython3 "json-to-md"
+      {
+        libraries = [ python3Packages.pandas python3Packages.tabulate ];
+      }
+      ''
+        import sys
+        import pandas as pd
+
+        pd.read_json(sys.stdin) \
+          .fillna("") \
+          .to_markdown(sys.stdout, index=False, floatfmt=".1f")
+      '';
+
+in
+
+writeShellScriptBin "net-loadtest-matrix" ''
+  set -euo pipefail
+
+  reqs="''${1:-1000}"
+  batch_size_opt=""
+  scenarios="null"
+
+  if [ -n "''${2:-}" ]; then
+    batch_size_opt="-c pg_net.batch_size=$2"
+  fi
+
+  # a comma separated list of scenarios, all of them by default
+  if [ -n "''${3:-}" ]; then
+    scenarios="string_to_array('$3', ',')"
+  fi
+
+  load_dir=test/load
+  mkdir -p $load_dir
+  echo "*" > $load_dir/.gitignore
+
+  matrix_json=$load_dir/matrix.json
+
+  net-with-nginx xpg --options "-c log_min_messages=WARNING $batch_size_opt" \
+    psql -v ON_ERROR_STOP=1 -c "call loadtest_matrix($reqs, $scenarios)" \
+    -c "\pset tuples_only on" -c "\pset format unaligned" -c "\o $matrix_json" \
+    -c "select coalesce(json_agg(r), '[]') from scenario_run r" > /dev/null
+
+  echo -e "## Loadtest scenario results\n"
+  cat $matrix_json | ${jsonToMd}
+  echo -e "\n\nThe results are in $matrix_json"
+''
@@ -20,6 +20,8 @@ in
 let
   nginxCustom = pkgs.callPackage ./nix/nginxCustom.nix {};
   loadtest = pkgs.callPackage ./nix/loadtest.nix {};
+  loadtestMatrix = pkgs.callPackage ./nix/loadtestMatrix.nix {};
+  bench = pkgs.callPackage ./nix/bench.nix {};
   pythonDeps = with pkgs.python3Packages; [
     pytest
     psycopg2
@@ -42,7 +44,10 @@ pkgs.mkShell {
       pythonDeps
       nginxCustom.nginxScript
       pkgs.curlWithGnuTls
+      pkgs.zlib
       loadtest
+      loadtestMatrix
+      bench
       style
       styleCheck
     ];
@@ -0,0 +1,522 @@
+create domain net.response_storage as text
+check (
+  value in ('always', 'on_error', 'never', 'chunked')
+);
+
+alter table net.http_request_queue add column store_response net.response_storage not null default 'always';
+
+create type net.http_completion as (
+    id bigint,
+    status_code integer,
+    content text,
+    headers jsonb,
+    content_type text,
+    timed_out bool,
+    error_msg text
+);
+
+alter table net.http_request_queue
+  add column callback regprocedure,
+  add column enqueued_by regrole not null default current_user::regrole,
+  add column compress_body bool not null default false;
+
+drop function net.http_get(text, jsonb, jsonb, int);
+drop function net.http_post(text, jsonb, jsonb, jsonb, int);
+drop function net.http_delete(text, jsonb, jsonb, int, jsonb);
+
+create function net.http_get(
+    -- url for the request
+    url text,
+    -- key/value pairs to be url encoded and appended to the `url`
+    params jsonb default '{}'::jsonb,
+    -- key/values to be included in request headers
+    headers jsonb default '{}'::jsonb,
+    -- the maximum number of milliseconds the request may take before being cancelled
+    timeout_milliseconds int default 5000,
+    -- which responses are stored in net._http_response
+    store_response net.response_storage default 'always',
+    -- function taking a net.http_completion[], called by the worker with the completed requests
+    callback regprocedure default null,
+    -- the request isn't sent once this time passes in the queue, it gets an error response instead
+    expires_at timestamptz default null
+)
+    -- request_id reference
+    returns bigint
+    language 'c'
+as 'MODULE_PATHNAME';
+
+create function net.http_post(
+    -- url for the request
+    url text,
+    -- body of the POST request
+    body jsonb default '{}'::jsonb,
+    -- key/value pairs to be url encoded and appended to the `url`
+    params jsonb default '{}'::jsonb,
+    -- key/values to be included in request headers
+    headers jsonb default '{"Content-Type": "application/json"}'::jsonb,
+    -- the maximum number of milliseconds the request may take before being cancelled
+    timeout_milliseconds int DEFAULT 5000,
+    -- which responses are stored in net._http_response
+    store_response net.response_storage default 'always',
+    -- function taking a net.http_completion[], called by the worker with the completed requests
+    callback regprocedure default null,
+    -- gzip the body before sending it, when that makes it smaller
+    compress_body bool default false,
+    -- the request isn't sent once this time passes in the queue, it gets an error response instead
+    expires_at timestamptz default null
+)
+    -- request_id reference
+    returns bigint
+    language 'c'
+as 'MODULE_PATHNAME';
+
+create function net.http_delete(
+    -- url for the request
+    url text,
+    -- key/value pairs to be url encoded and appended to the `url`
+    params jsonb default '{}'::jsonb,
+    -- key/values to be included in request headers
+    headers jsonb default '{}'::jsonb,
+    -- the maximum number of milliseconds the request may take before being cancelled
+    timeout_milliseconds int default 5000,
+    -- optional body of the request
+    body jsonb default NULL,
+    -- which responses are stored in net._http_response
+    store_response net.response_storage default 'always',
+    -- function taking a net.http_completion[], called by the worker with the completed requests
+    callback regprocedure default null,
+    -- gzip the body before sending it, when that makes it smaller
+    compress_body bool default false,
+    -- the request isn't sent once this time passes in the queue, it gets an error response instead
+    expires_at timestamptz default null
+)
+    -- request_id reference
+    returns bigint
+    language 'c'
+as 'MODULE_PATHNAME';
+
+create or replace function net.worker_stats(
+  out requests_succeeded bigint,
+  out requests_http_error bigint,
+  out requests_failed bigint,
+  out responses_skipped bigint,
+  out bodies_compressed bigint,
+  out body_bytes_saved bigint,
+  out event_syscalls bigint,
+  out event_wakeups bigint,
+  out batch_size int,
+  out requests_coalesced bigint,
+  out cache_hits bigint,
+  out requests_expired bigint,
+  out requests_cancelled bigint,
+  out requests_hedged bigint,
+  out hedges_won bigint,
+  out requests_failed_over bigint,
+  out config_loads bigint
+)
+  language 'c'
+as 'MODULE_PATHNAME';
+comment on function net.worker_stats() is 'counts the requests completed by the worker since the server started, by their outcome, and shows the batch size in use and the times the worker loaded its config';
+
+create or replace function net._circuit_breakers(
+  out host text,
+  out state text,
+  out consecutive_failures int,
+  out opened_at timestamptz,
+  out retry_at timestamptz
+)
+  returns setof record
+  language 'c'
+as 'MODULE_PATHNAME', 'circuit_breakers';
+
+create or replace view net.circuit_breakers as
+select * from net._circuit_breakers();
+comment on view net.circuit_breakers is 'the hosts with recent connection failures or timeouts and the state of their circuit breaker, see pg_net.circuit_breaker_failures';
+
+grant select on net.circuit_breakers to PUBLIC;
+
+create or replace function net._response_bucket(ts timestamptz)
+  returns smallint
+  language sql
+  stable
+as $$
+  select (
+    floor(
+      extract(epoch from ts) /
+      greatest(extract(epoch from coalesce(current_setting('pg_net.ttl', true), '6 hours')::interval) / 6, 1)
+    )::bigint % 8
+  )::smallint
+$$;
+
+alter table net._http_response rename to _http_response_old;
+alter index net._http_response_created_idx rename to _http_response_old_created_idx;
+
+create table net._http_response(
+    id bigint,
+    status_code integer,
+    content_type text,
+    headers jsonb,
+    content text,
+    timed_out bool,
+    error_msg text,
+    created timestamptz not null default now(),
+    -- the order in which responses were stored, used as a cursor by net.completed_since
+    seq bigserial,
+    bucket smallint not null default net._response_bucket(now())
+) partition by list (bucket);
+
+create unlogged table net._http_response_0 partition of net._http_response for values in (0);
+create unlogged table net._http_response_1 partition of net._http_response for values in (1);
+create unlogged table net._http_response_2 partition of net._http_response for values in (2);
+create unlogged table net._http_response_3 partition of net._http_response for values in (3);
+create unlogged table net._http_response_4 partition of net._http_response for values in (4);
+create unlogged table net._http_response_5 partition of net._http_response for values in (5);
+create unlogged table net._http_response_6 partition of net._http_response for values in (6);
+create unlogged table net._http_response_7 partition of net._http_response for values in (7);
+
+create index on net._http_response (created);
+create index on net._http_response (seq);
+
+insert into net._http_response(id, status_code, content_type, headers, content, timed_out, error_msg, created, bucket)
+select id, status_code, content_type, headers, content, timed_out, error_msg, created, net._response_bucket(created)
+from net._http_response_old
+order by created;
+
+drop table net._http_response_old;
+
+grant all on net._http_response to PUBLIC;
+grant all on net._http_response_0, net._http_response_1, net._http_response_2, net._http_response_3,
+             net._http_response_4, net._http_response_5, net._http_response_6, net._http_response_7 to PUBLIC;
+grant all on sequence net._http_response_seq_seq to PUBLIC;
+
+-- The responses stored after the one with seq `last_seq`, in the order they were stored.
+-- Passing the greatest seq returned, or the payload of a pg_net.notify_channel notification, on the next call reads only the new responses.
+-- API: Public
+create or replace function net.completed_since(
+    -- seq of the last response already read, 0 to start from the oldest
+    last_seq bigint default 0,
+    -- the maximum number of responses returned
+    max_rows int default 1000
+)
+    returns table (
+        seq bigint,
+        id bigint,
+        status_code integer,
+        content_type text,
+        headers jsonb,
+        content text,
+        timed_out bool,
+        error_msg text,
+        created timestamptz
+    )
+    language sql
+    stable
+as $$
+    select r.seq, r.id, r.status_code, r.content_type, r.headers, r.content, r.timed_out, r.error_msg, r.created
+    from net._http_response r
+    where r.seq > last_seq
+    order by r.seq
+    limit max_rows
+$$;
+
+-- The services requests are sent to by id, see net.http_get_endpoint. The worker caches
+-- their url and headers, so the queue rows only carry the path.
+-- API: Public
+create table net.endpoints(
+    id serial primary key,
+    name text not null unique,
+    -- scheme, host and optional port and path prefix, the request path is appended to it
+    base_url text not null check (base_url ~* '^https?://'),
+    -- sent with every request, a header of the request replaces the one with the same name
+    headers jsonb not null default '{}' check (jsonb_typeof(headers) = 'object'),
+    -- the roles that can send requests to it, besides the owner of this table
+    allowed_roles regrole[] not null default '{}',
+    -- used when the request doesn't set its own
+    timeout_milliseconds int not null default 5000,
+    -- a local server is reached through it instead of TCP, the base url still gives the Host header
+    unix_socket_path text,
+    -- more base urls of the same service, each request goes to one of them or to base_url and to another one when it
+    -- can't connect, see net.endpoint_members
+    member_urls text[] not null default '{}'
+      check (cardinality(member_urls) < 64 and array_to_string(member_urls, ' ', '-') ~* '^(https?://\S*( |$))*$'),
+    -- how the member a request goes to is picked: 'least_outstanding' (the fewest requests in flight) or
+    -- 'latency_weighted' (in turn, faster members more often)
+    balance text not null default 'least_outstanding' check (balance in ('least_outstanding', 'latency_weighted')),
+    check (unix_socket_path is null or cardinality(member_urls) = 0)
+);
+
+alter table net.http_request_queue
+  add column endpoint_id int references net.endpoints(id),
+  alter column timeout_milliseconds drop not null,
+  add check (timeout_milliseconds is not null or endpoint_id is not null);
+
+-- Interface to make an async request to a registered endpoint
+-- API: Public
+create or replace function net.http_get_endpoint(
+    -- id of the net.endpoints row
+    endpoint_id int,
+    -- appended to the base url of the endpoint, empty or starting with '/' or '?'
+    path text,
+    -- key/value pairs to be url encoded and appended to the `path`
+    params jsonb default '{}'::jsonb,
+    -- key/values to be included in request headers, on top of the ones of the endpoint
+    headers jsonb default '{}'::jsonb,
+    -- the maximum number of milliseconds the request may take, the one of the endpoint when null
+    timeout_milliseconds int default null,
+    -- which responses are stored in net._http_response
+    store_response net.response_storage default 'always',
+    -- function taking a net.http_completion[], called by the worker with the completed requests
+    callback regprocedure default null,
+    -- the request isn't sent once this time passes in the queue, it gets an error response instead
+    expires_at timestamptz default null
+)
+    -- request_id reference
+    returns bigint
+    language 'c'
+as 'MODULE_PATHNAME';
+
+-- Interface to make an async request to a registered endpoint
+-- API: Public
+create or replace function net.http_post_endpoint(
+    -- id of the net.endpoints row
+    endpoint_id int,
+    -- appended to the base url of the endpoint, empty or starting with '/' or '?'
+    path text,
+    -- body of the POST request
+    body jsonb default '{}'::jsonb,
+    -- key/value pairs to be url encoded and appended to the `path`
+    params jsonb default '{}'::jsonb,
+    -- key/values to be included in request headers, on top of the ones of the endpoint
+    headers jsonb default '{"Content-Type": "application/json"}'::jsonb,
+    -- the maximum number of milliseconds the request may take, the one of the endpoint when null
+    timeout_milliseconds int default null,
+    -- which responses are stored in net._http_response
+    store_response net.response_storage default 'always',
+    -- function taking a net.http_completion[], called by the worker with the completed requests
+    callback regprocedure default null,
+    -- gzip the body before sending it, when that makes it smaller
+    compress_body bool default false,
+    -- the request isn't sent once this time passes in the queue, it gets an error response instead
+    expires_at timestamptz default null
+)
+    -- request_id reference
+    returns bigint
+    language 'c'
+as 'MODULE_PATHNAME';
+
+-- Interface to make an async request to a registered endpoint
+-- API: Public
+create or replace function net.http_delete_endpoint(
+    -- id of the net.endpoints row
+    endpoint_id int,
+    -- appended to the base url of the endpoint, empty or starting with '/' or '?'
+    path text,
+    -- key/value pairs to be url encoded and appended to the `path`
+    params jsonb default '{}'::jsonb,
+    -- key/values to be included in request headers, on top of the ones of the endpoint
+    headers jsonb default '{}'::jsonb,
+    -- the maximum number of milliseconds the request may take, the one of the endpoint when null
+    timeout_milliseconds int default null,
+    -- optional body of the request
+    body jsonb default NULL,
+    -- which responses are stored in net._http_response
+    store_response net.response_storage default 'always',
+    -- function taking a net.http_completion[], called by the worker with the completed requests
+    callback regprocedure default null,
+    -- gzip the body before sending it, when that makes it smaller
+    compress_body bool default false,
+    -- the request isn't sent once this time passes in the queue, it gets an error response instead
+    expires_at timestamptz default null
+)
+    -- request_id reference
+    returns bigint
+    language 'c'
+as 'MODULE_PATHNAME';
+
+-- the headers of an endpoint usually have credentials, only its owner reads them
+revoke all on net.endpoints from PUBLIC;
+grant select (id, name, base_url, allowed_roles, timeout_milliseconds, unix_socket_path, member_urls, balance) on net.endpoints to PUBLIC;
+
+-- dequeues the requests of each role in turn, so a role with a large backlog doesn't hold back the others
+create index on net.http_request_queue (enqueued_by, id);
+
+-- The share of each batch of the worker a role gets, roles without a row have a weight of 1 and no cap.
+-- API: Public
+create table net.role_quotas(
+    enqueued_by regrole primary key,
+    -- a role with a weight of 2 gets twice the requests of a role with a weight of 1 when both have a backlog
+    weight int not null default 1 check (weight > 0),
+    -- the maximum number of its requests the worker sends at once, no cap when null
+    max_in_flight int check (max_in_flight > 0)
+);
+
+-- The requests waiting in the queue by the role that enqueued them, with its quota. The requests of the batch
+-- being sent are only removed from the queue once it completes.
+-- API: Public
+create or replace view net.role_queue as
+select
+  q.enqueued_by,
+  count(*) as pending,
+  min(q.id) as oldest_id,
+  coalesce(r.weight, 1) as weight,
+  r.max_in_flight
+from net.http_request_queue q
+left join net.role_quotas r on r.enqueued_by = q.enqueued_by
+group by q.enqueued_by, r.weight, r.max_in_flight;
+comment on view net.role_queue is 'the requests waiting in the queue by the role that enqueued them, with the weight and in flight cap of its net.role_quotas row';
+
+-- a role could give itself a larger share of the worker otherwise
+revoke all on net.role_quotas from PUBLIC;
+grant select on net.role_quotas to PUBLIC;
+grant select on net.role_queue to PUBLIC;
+
+alter table net.http_request_queue
+  add column enqueued_at timestamptz not null default now(),
+  add column expires_at timestamptz;
+
+create or replace function net.cancel(
+    -- request_id reference
+    request_id bigint
+)
+    returns bool
+    strict
+    volatile
+    language 'c'
+as 'MODULE_PATHNAME';
+comment on function net.cancel(bigint) is 'cancels a request that is waiting in the queue or being sent by the worker, it gets a ''Request cancelled'' error response. Only roles with the privileges of the role that enqueued it can cancel it. Returns false when the request isn''t waiting or being sent anymore';
+
+create or replace function net.clear_queue()
+    returns bigint
+    volatile
+    language 'c'
+as 'MODULE_PATHNAME';
+comment on function net.clear_queue() is 'cancels every request waiting in the queue that the calling role can cancel with net.cancel, they get a ''Request cancelled'' error response. The requests being sent by the worker are left to net.cancel. Returns the number of cancelled requests';
+
+create or replace function net._endpoint_members(
+  out endpoint_id int,
+  out member int,
+  out outstanding int,
+  out requests bigint,
+  out failures bigint,
+  out consecutive_failures int,
+  out latency_ms float8,
+  out down_until timestamptz
+)
+  returns setof record
+  language 'c'
+as 'MODULE_PATHNAME', 'endpoint_members';
+
+-- The load and health of the members of the endpoints with member_urls, as the worker keeps them. Member 0 is
+-- the base_url of the endpoint, member i is member_urls[i].
+-- API: Public
+create or replace view net.endpoint_members as
+select
+  m.endpoint_id,
+  m.member,
+  (array[e.base_url] || e.member_urls)[m.member + 1] as base_url,
+  m.outstanding,
+  m.requests,
+  m.failures,
+  m.consecutive_failures,
+  m.latency_ms,
+  m.down_until is null as healthy,
+  m.down_until
+from net._endpoint_members() m
+join net.endpoints e on e.id = m.endpoint_id;
+comment on view net.endpoint_members is 'the requests in flight, average latency and health of each member of the endpoints with member_urls. A member that failed to connect or timed out is only sent requests when the others are down, until down_until';
+grant select on net.endpoint_members to PUBLIC;
+
+-- The bodies of the responses of the requests with store_response 'chunked', written as they arrive so the worker
+-- doesn't hold a whole body in memory. The chunks of a response are in the bucket of its net._http_response row and
+-- expire with it.
+-- API: Private
+create table net._http_response_chunks(
+    id bigint not null,
+    -- the position of the chunk in the body, from 0
+    seq int not null,
+    chunk bytea not null,
+    created timestamptz not null default now(),
+    bucket smallint not null default net._response_bucket(now())
+) partition by list (bucket);
+
+create unlogged table net._http_response_chunks_0 partition of net._http_response_chunks for values in (0);
+create unlogged table net._http_response_chunks_1 partition of net._http_response_chunks for values in (1);
+create unlogged table net._http_response_chunks_2 partition of net._http_response_chunks for values in (2);
+create unlogged table net._http_response_chunks_3 partition of net._http_response_chunks for values in (3);
+create unlogged table net._http_response_chunks_4 partition of net._http_response_chunks for values in (4);
+create unlogged table net._http_response_chunks_5 partition of net._http_response_chunks for values in (5);
+create unlogged table net._http_response_chunks_6 partition of net._http_response_chunks for values in (6);
+create unlogged table net._http_response_chunks_7 partition of net._http_response_chunks for values in (7);
+
+create index on net._http_response_chunks (id, seq);
+
+-- The body of a response stored with store_response 'chunked', null when it has none. Large bodies are better
+-- read a range of chunks at a time from net._http_response_chunks.
+-- API: Public
+create or replace function net.chunked_response_body(
+    -- request_id reference
+    request_id bigint
+)
+    returns bytea
+    strict
+    language sql
+    stable
+as $$
+    select string_agg(c.chunk, ''::bytea order by c.seq)
+    from net._http_response_chunks c
+    where c.id = request_id
+$$;
+
+grant all on net._http_response_chunks to PUBLIC;
+grant all on net._http_response_chunks_0, net._http_response_chunks_1, net._http_response_chunks_2,
+             net._http_response_chunks_3, net._http_response_chunks_4, net._http_response_chunks_5,
+             net._http_response_chunks_6, net._http_response_chunks_7 to PUBLIC;
+
+-- The request functions insert into the queue as its owner, a role writing the rows itself could make the callbacks,
+-- which run as their enqueued_by, run as another role. The roles that could insert into the queue keep the insert
+-- privilege on the other columns, which says which roles can enqueue requests, the request functions check it.
+do $$
+declare
+  grantee text;
+  could_insert bool;
+begin
+  for grantee, could_insert in
+    select
+      case a.grantee when 0 then 'PUBLIC' else a.grantee::regrole::text end,
+      bool_or(a.privilege_type = 'INSERT')
+    from pg_class c, aclexplode(c.relacl) a
+    where c.oid = 'net.http_request_queue'::regclass
+      and a.grantee <> c.relowner
+      and a.privilege_type in ('INSERT', 'UPDATE')
+    group by a.grantee
+  loop
+    execute format('revoke insert, update on net.http_request_queue from %s', grantee);
+
+    if could_insert then
+      execute format('grant insert (method, url, headers, body, timeout_milliseconds, store_response, callback, compress_body, expires_at) on net.http_request_queue to %s', grantee);
+    end if;
+  end loop;
+end
+$$;
+
+-- a request dropped from a full queue is left for the worker to store its response, the responses stored by other
+-- backends could get a seq below one the worker already committed
+alter table net.http_request_queue add column error_msg text;
+
+create or replace view net.role_queue as
+select
+  q.enqueued_by,
+  count(*) as pending,
+  min(q.id) as oldest_id,
+  coalesce(r.weight, 1) as weight,
+  r.max_in_flight
+from net.http_request_queue q
+left join net.role_quotas r on r.enqueued_by = q.enqueued_by
+where q.error_msg is null
+group by q.enqueued_by, r.weight, r.max_in_flight;
+
+-- net.cancel and net.clear_queue check that the requests are the role's, deleting the rows directly doesn't
+revoke delete, truncate on net.http_request_queue from PUBLIC;
+
+-- only the owner of net.endpoints inserts into it, same as on a fresh install
+revoke all on sequence net.endpoints_id_seq from PUBLIC;
@@ -0,0 +1,393 @@
+#include "pg_prelude.h"
+
+#include "curl_prelude.h"
+
+#include "core.h"
+#include "errors.h"
+#include "queue_depth.h"
+#include "shared_queue.h"
+#include "util.h"
+#include "worker.h"
+
+PG_FUNCTION_INFO_V1(http_get);
+PG_FUNCTION_INFO_V1(http_post);
+PG_FUNCTION_INFO_V1(http_delete);
+PG_FUNCTION_INFO_V1(http_get_endpoint);
+PG_FUNCTION_INFO_V1(http_post_endpoint);
+PG_FUNCTION_INFO_V1(http_delete_endpoint);
+
+#define PG_GETARG_NULLABLE_DATUM(n)                                                                \
+  ((NullableDatum){.value = PG_GETARG_DATUM(n), .isnull = PG_ARGISNULL(n)})
+#define PG_GETARG_JSONB_P_OR_NULL(n) (PG_ARGISNULL(n) ? NULL : PG_GETARG_JSONB_P(n))
+#define PG_GETARG_TEXT_PP_OR_NULL(n) (PG_ARGISNULL(n) ? NULL : PG_GETARG_TEXT_PP(n))
+
+static SPIPlanPtr ins_request_plan     = NULL;
+static SPIPlanPtr endpoint_roles_plan = NULL;
+
+static const char *json_content_type = "application/json";
+
+// The arguments of the request, nulls are passed as is to the queue so its constraints are the ones
+// that report them (e.g. `null value in column "url"`)
+typedef struct {
+  const char   *method;
+  bool          to_endpoint; // `url` is then the path of the request on `endpoint_id`
+  NullableDatum endpoint_id;
+  text         *url;
+  Jsonb        *params;
+  Jsonb        *headers;
+  Jsonb        *body;
+  NullableDatum timeout_milliseconds;
+  text         *store_response;
+  NullableDatum callback;
+  NullableDatum compress_body;
+  NullableDatum expires_at;
+} EnqueueArgs;
+
+// same as `convert_to(body::text, 'UTF8')`
+static bytea *jsonb_to_utf8_bytea(Jsonb *body) {
+  char *str     = JsonbToCString(NULL, &body->root, VARSIZE(body));
+  int   len     = strlen(str);
+  char *utf8str = pg_server_to_any(str, len, PG_UTF8);
+
+  if (utf8str != str) len = strlen(utf8str);
+
+  bytea *result = palloc(VARHDRSZ + len);
+  SET_VARSIZE(result, VARHDRSZ + len);
+  memcpy(VARDATA(result), utf8str, len);
+
+  return result;
+}
+
+// Errors unless the current user has the privileges of one of the allowed_roles of the endpoint, or
+// of the owner of net.endpoints. The requests get the headers of the endpoint, which the role can't
+// read, and their responses are the role's. An unknown endpoint is left to the foreign key of the
+// queue. It must be called inside an SPI connection.
+static void check_endpoint_usage(Datum endpoint_id) {
+  if (endpoint_roles_plan == NULL) {
+    SPIPlanPtr tmp = SPI_prepare("select allowed_roles from net.endpoints where id = $1", 1,
+                                 (Oid[]){INT4OID});
+
+    if (tmp == NULL)
+      ereport(ERROR, errmsg("SPI_prepare failed: %s", SPI_result_code_string(SPI_result)));
+
+    endpoint_roles_plan = SPI_saveplan(tmp);
+    if (endpoint_roles_plan == NULL) ereport(ERROR, errmsg("SPI_saveplan failed"));
+
+    SPI_freeplan(tmp);
+  }
+
+  int ret_code = SPI_execute_plan(endpoint_roles_plan, (Datum[]){endpoint_id}, NULL, true, 1);
+
+  if (ret_code != SPI_OK_SELECT)
+    ereport(ERROR,
+            errmsg("Error checking the endpoint roles: %s", SPI_result_code_string(ret_code)));
+
+  if (SPI_processed == 0) return;
+
+  Oid endpoints_relid = RangeVarGetRelid(makeRangeVar("net", "endpoints", -1), NoLock, false);
+  Oid userid          = GetUserId();
+
+  bool   allowed = has_privs_of_role(userid, get_rel_owner(endpoints_relid));
+  bool   isnull;
+  Datum *roles;
+  int    nroles;
+
+  deconstruct_array(
+      DatumGetArrayTypeP(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull)),
+      REGROLEOID, sizeof(Oid), true, 'i', &roles, NULL, &nroles);
+
+  for (int i = 0; i < nroles && !allowed; i++)
+    allowed = has_privs_of_role(userid, DatumGetObjectId(roles[i]));
+
+  SPI_freetuptable(SPI_tuptable);
+
+  if (!allowed)
+    ereport(ERROR, errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+            errmsg("permission denied for endpoint %d", DatumGetInt32(endpoint_id)),
+            errdetail("Only the roles in its allowed_roles can send requests to it."));
+}
+
+// Puts the request in the shared queue, it's written there when the transaction commits. Returns
+// false when the request has to go through the table instead, the entries don't expire.
+static bool enqueue_shared(EnqueueArgs args, const char *url, bytea *body, int64 *id) {
+  // endpoint requests get their url and headers from net.endpoints, which the entries don't carry
+  if (guc_shared_queue_size == 0 || args.to_endpoint || url == NULL ||
+      args.timeout_milliseconds.isnull || args.store_response == NULL || args.compress_body.isnull ||
+      !args.expires_at.isnull)
+    return false;
+
+  // the entries aren't counted towards the queue limits and don't expire, the table enforces them
+  if (guc_max_queued_requests > 0 || guc_max_queued_requests_per_role > 0 || guc_max_queue_age > 0)
+    return false;
+
+  Oid net_oid     = get_namespace_oid("net", false);
+  Oid queue_relid = get_relname_relid("http_request_queue", net_oid);
+  Oid seq_relid   = get_relname_relid("http_request_queue_id_seq", net_oid);
+
+  if (!OidIsValid(queue_relid) || !OidIsValid(seq_relid)) return false;
+
+  List *header_lines = args.headers ? jsonb_headers_to_lines(args.headers) : NIL;
+
+  SharedQueueEntry *entry =
+      shared_queue_make_entry(args.method, url, header_lines, body,
+                              DatumGetInt32(args.timeout_milliseconds.value),
+                              parse_store_response(text_to_cstring(args.store_response)));
+
+  if (!shared_queue_reserve(entry)) {
+    pfree(entry);
+    return false;
+  }
+
+  // ids come from the same sequence so they don't collide with the ones of the table
+  entry->id            = nextval_internal(seq_relid, true);
+  entry->queue_relid   = queue_relid;
+  entry->callback      = args.callback.isnull ? InvalidOid : DatumGetObjectId(args.callback.value);
+  entry->enqueued_by   = GetUserId();
+  entry->compress_body = DatumGetBool(args.compress_body.value);
+
+  *id = entry->id;
+
+  return true;
+}
+
+static int64 enqueue_request(EnqueueArgs args) {
+  enum { nparams = 11 };
+  Datum vals[nparams];
+  char  nulls[nparams];
+  MemSet(nulls, ' ', nparams);
+
+  if (args.headers) validate_headers(args.headers);
+
+  if (!args.callback.isnull) validate_completion_callback(DatumGetObjectId(args.callback.value));
+
+  char  *url  = NULL;
+  bytea *body = args.body ? jsonb_to_utf8_bytea(args.body) : NULL;
+  int64  id;
+
+  if (args.to_endpoint && args.endpoint_id.isnull)
+    ereport(ERROR, errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED), errmsg("endpoint_id cannot be null"));
+
+  if (args.url) {
+    char *raw_url = text_to_cstring(args.url);
+    url           = args.to_endpoint ? encode_path_with_params(raw_url, args.params)
+                                     : encode_url_with_params(raw_url, args.params);
+    pfree(raw_url);
+  }
+
+  // The request is written to the queue as its owner, the insert privilege on the queue, which
+  // roles get on every column but enqueued_by, still says who can enqueue requests
+  Oid queue_relid = RangeVarGetRelid(makeRangeVar("net", "http_request_queue", -1), NoLock, false);
+
+  if (pg_class_aclcheck(queue_relid, GetUserId(), ACL_INSERT) != ACLCHECK_OK &&
+      pg_attribute_aclcheck_all(queue_relid, GetUserId(), ACL_INSERT, ACLMASK_ANY) != ACLCHECK_OK)
+    aclcheck_error(ACLCHECK_NO_PRIV, OBJECT_TABLE, get_rel_name(queue_relid));
+
+  if (enqueue_shared(args, url, body, &id)) {
+    wake_worker_at_commit();
+    return id;
+  }
+
+  vals[0] = CStringGetTextDatum(args.method);
+
+  if (url)
+    vals[1] = CStringGetTextDatum(url);
+  else
+    nulls[1] = 'n';
+
+  if (args.headers)
+    vals[2] = JsonbPGetDatum(args.headers);
+  else
+    nulls[2] = 'n';
+
+  if (body)
+    vals[3] = PointerGetDatum(body);
+  else
+    nulls[3] = 'n';
+
+  if (!args.timeout_milliseconds.isnull)
+    vals[4] = args.timeout_milliseconds.value;
+  else
+    nulls[4] = 'n';
+
+  if (args.store_response)
+    vals[5] = PointerGetDatum(args.store_response);
+  else
+    nulls[5] = 'n';
+
+  vals[6]  = args.callback.value;
+  nulls[6] = args.callback.isnull ? 'n' : ' ';
+
+  vals[7]  = args.compress_body.value;
+  nulls[7] = args.compress_body.isnull ? 'n' : ' ';
+
+  vals[8]  = args.endpoint_id.value;
+  nulls[8] = args.to_endpoint ? ' ' : 'n';
+
+  vals[9]  = args.expires_at.value;
+  nulls[9] = args.expires_at.isnull ? 'n' : ' ';
+
+  vals[10] = ObjectIdGetDatum(GetUserId());
+
+  SPI_connect();
+
+  if (args.to_endpoint) check_endpoint_usage(args.endpoint_id.value);
+
+  // Only the owner of the queue can write to it, otherwise a role could set the enqueued_by of its
+  // rows, which the callbacks run as, to another role. The request is inserted as the owner with
+  // the current user as its enqueued_by, the user id is restored by an error too.
+  Oid save_userid;
+  int save_sec_context;
+
+  GetUserIdAndSecContext(&save_userid, &save_sec_context);
+  SetUserIdAndSecContext(get_rel_owner(queue_relid),
+                         save_sec_context | SECURITY_LOCAL_USERID_CHANGE);
+
+  // the request counts towards the limits of the role it's enqueued by
+  queue_depth_reserve(save_userid);
+
+  if (ins_request_plan == NULL) {
+    SPIPlanPtr tmp = SPI_prepare("\
+        insert into net.http_request_queue(method, url, headers, body, timeout_milliseconds, store_response, callback, compress_body, endpoint_id, expires_at, enqueued_by)\
+        values ($1, $2, $3, $4, $5, $6, $7, $8, $9, $10, $11)\
+        returning id",
+                                 nparams,
+                                 (Oid[nparams]){TEXTOID, TEXTOID, JSONBOID, BYTEAOID, INT4OID,
+                                                TEXTOID, REGPROCEDUREOID, BOOLOID, INT4OID,
+                                                TIMESTAMPTZOID, REGROLEOID});
+
+    if (tmp == NULL)
+      ereport(ERROR, errmsg("SPI_prepare failed: %s", SPI_result_code_string(SPI_result)));
+
+    ins_request_plan = SPI_saveplan(tmp);
+    if (ins_request_plan == NULL) ereport(ERROR, errmsg("SPI_saveplan failed"));
+
+    SPI_freeplan(tmp);
+  }
+
+  int ret_code = SPI_execute_plan(ins_request_plan, vals, nulls, false, 1);
+
+  if (ret_code != SPI_OK_INSERT_RETURNING)
+    ereport(ERROR, errmsg("Error when enqueuing request: %s", SPI_result_code_string(ret_code)));
+
+  bool isnull;
+  id = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+
+  SetUserIdAndSecContext(save_userid, save_sec_context);
+
+  SPI_finish();
+
+  wake_worker_at_commit();
+
+  return id;
+}
+
+Datum http_get(PG_FUNCTION_ARGS) {
+  PG_RETURN_INT64(enqueue_request((EnqueueArgs){
+    .method               = "GET",
+    .url                  = PG_GETARG_TEXT_PP_OR_NULL(0),
+    .params               = PG_GETARG_JSONB_P_OR_NULL(1),
+    .headers              = PG_GETARG_JSONB_P_OR_NULL(2),
+    .timeout_milliseconds = PG_GETARG_NULLABLE_DATUM(3),
+    .store_response       = PG_GETARG_TEXT_PP_OR_NULL(4),
+    .callback             = PG_GETARG_NULLABLE_DATUM(5),
+    .compress_body        = (NullableDatum){.value = BoolGetDatum(false)},
+    .expires_at           = PG_GETARG_NULLABLE_DATUM(6),
+  }));
+}
+
+// The headers of a POST, they must have the json Content-Type, which is added when missing
+static Jsonb *post_headers(Jsonb *headers) {
+  if (headers == NULL) return NULL;
+
+  char *content_type = jsonb_object_get_text_ci(headers, "content-type");
+
+  // If the user provided new headers and omitted the content type add it back in automatically
+  if (content_type == NULL) {
+    Datum json_header = DirectFunctionCall1(
+        jsonb_in, CStringGetDatum(psprintf("{\"Content-Type\": \"%s\"}", json_content_type)));
+    return DatumGetJsonbP(DirectFunctionCall2(jsonb_concat, JsonbPGetDatum(headers), json_header));
+  } else if (strcmp(content_type, json_content_type) != 0)
+    ereport(ERROR, errmsg("Content-Type header must be \"%s\"", json_content_type));
+
+  return headers;
+}
+
+Datum http_post(PG_FUNCTION_ARGS) {
+  PG_RETURN_INT64(enqueue_request((EnqueueArgs){
+    .method               = "POST",
+    .url                  = PG_GETARG_TEXT_PP_OR_NULL(0),
+    .body                 = PG_GETARG_JSONB_P_OR_NULL(1),
+    .params               = PG_GETARG_JSONB_P_OR_NULL(2),
+    .headers              = post_headers(PG_GETARG_JSONB_P_OR_NULL(3)),
+    .timeout_milliseconds = PG_GETARG_NULLABLE_DATUM(4),
+    .store_response       = PG_GETARG_TEXT_PP_OR_NULL(5),
+    .callback             = PG_GETARG_NULLABLE_DATUM(6),
+    .compress_body        = PG_GETARG_NULLABLE_DATUM(7),
+    .expires_at           = PG_GETARG_NULLABLE_DATUM(8),
+  }));
+}
+
+Datum http_delete(PG_FUNCTION_ARGS) {
+  PG_RETURN_INT64(enqueue_request((EnqueueArgs){
+    .method               = "DELETE",
+    .url                  = PG_GETARG_TEXT_PP_OR_NULL(0),
+    .params               = PG_GETARG_JSONB_P_OR_NULL(1),
+    .headers              = PG_GETARG_JSONB_P_OR_NULL(2),
+    .timeout_milliseconds = PG_GETARG_NULLABLE_DATUM(3),
+    .body                 = PG_GETARG_JSONB_P_OR_NULL(4),
+    .store_response       = PG_GETARG_TEXT_PP_OR_NULL(5),
+    .callback             = PG_GETARG_NULLABLE_DATUM(6),
+    .compress_body        = PG_GETARG_NULLABLE_DATUM(7),
+    .expires_at           = PG_GETARG_NULLABLE_DATUM(8),
+  }));
+}
+
+Datum http_get_endpoint(PG_FUNCTION_ARGS) {
+  PG_RETURN_INT64(enqueue_request((EnqueueArgs){
+    .method               = "GET",
+    .to_endpoint          = true,
+    .endpoint_id          = PG_GETARG_NULLABLE_DATUM(0),
+    .url                  = PG_GETARG_TEXT_PP_OR_NULL(1),
+    .params               = PG_GETARG_JSONB_P_OR_NULL(2),
+    .headers              = PG_GETARG_JSONB_P_OR_NULL(3),
+    .timeout_milliseconds = PG_GETARG_NULLABLE_DATUM(4),
+    .store_response       = PG_GETARG_TEXT_PP_OR_NULL(5),
+    .callback             = PG_GETARG_NULLABLE_DATUM(6),
+    .compress_body        = (NullableDatum){.value = BoolGetDatum(false)},
+    .expires_at           = PG_GETARG_NULLABLE_DATUM(7),
+  }));
+}
+
+Datum http_post_endpoint(PG_FUNCTION_ARGS) {
+  PG_RETURN_INT64(enqueue_request((EnqueueArgs){
+    .method               = "POST",
+    .to_endpoint          = true,
+    .endpoint_id          = PG_GETARG_NULLABLE_DATUM(0),
+    .url                  = PG_GETARG_TEXT_PP_OR_NULL(1),
+    .body                 = PG_GETARG_JSONB_P_OR_NULL(2),
+    .params               = PG_GETARG_JSONB_P_OR_NULL(3),
+    .headers              = post_headers(PG_GETARG_JSONB_P_OR_NULL(4)),
+    .timeout_milliseconds = PG_GETARG_NULLABLE_DATUM(5),
+    .store_response       = PG_GETARG_TEXT_PP_OR_NULL(6),
+    .callback             = PG_GETARG_NULLABLE_DATUM(7),
+    .compress_body        = PG_GETARG_NULLABLE_DATUM(8),
+    .expires_at           = PG_GETARG_NULLABLE_DATUM(9),
+  }));
+}
+
+Datum http_delete_endpoint(PG_FUNCTION_ARGS) {
+  PG_RETURN_INT64(enqueue_request((EnqueueArgs){
+    .method               = "DELETE",
+    .to_endpoint          = true,
+    .endpoint_id          = PG_GETARG_NULLABLE_DATUM(0),
+    .url                  = PG_GETARG_TEXT_PP_OR_NULL(1),
+    .params               = PG_GETARG_JSONB_P_OR_NULL(2),
+    .headers              = PG_GETARG_JSONB_P_OR_NULL(3),
+    .timeout_milliseconds = PG_GETARG_NULLABLE_DATUM(4),
+    .body                 = PG_GETARG_JSONB_P_OR_NULL(5),
+    .store_response       = PG_GETARG_TEXT_PP_OR_NULL(6),
+    .callback             = PG_GETARG_NULLABLE_DATUM(7),
+    .compress_body        = PG_GETARG_NULLABLE_DATUM(8),
+    .expires_at           = PG_GETARG_NULLABLE_DATUM(9),
+  }));
+}
@@ -0,0 +1,73 @@
+#include "pg_prelude.h"
+
+#include "batch_size.h"
+
+// requests that can fail in a batch before it's considered congested
+static const double max_failure_ratio = 0.1;
+// share of the batch wall time the worker can spend on the CPU
+static const double max_cpu_ratio = 0.9;
+// baseline latency divided by the batch latency, below this the upstreams are considered saturated
+static const double min_latency_gradient    = 0.5;
+static const double baseline_weight         = 0.1; // of a batch in the baseline latency
+static const int    additive_increase       = 16;
+static const double multiplicative_decrease = 0.75;
+
+void batch_size_reset(BatchSizeController *ctl, int size) {
+  ctl->size                = size;
+  ctl->baseline_latency_ms = 0;
+}
+
+void batch_size_clamp(BatchSizeController *ctl, int min_size, int max_size) {
+  ctl->size = Max(Min(min_size, max_size), Min(ctl->size, max_size));
+}
+
+static double timeval_diff_ms(struct timeval end, struct timeval start) {
+  return (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_usec - start.tv_usec) / 1000.0;
+}
+
+void batch_observe_usage(BatchObservation *obs, const PGRUsage *start) {
+  PGRUsage end;
+  pg_rusage_init(&end);
+
+  obs->elapsed_ms = timeval_diff_ms(end.tv, start->tv);
+  obs->cpu_ms     = timeval_diff_ms(end.ru.ru_utime, start->ru.ru_utime) +
+                    timeval_diff_ms(end.ru.ru_stime, start->ru.ru_stime);
+}
+
+void batch_size_adapt(BatchSizeController *ctl, const BatchObservation *obs, int min_size,
+                      int max_size) {
+  min_size = Min(min_size, max_size);
+
+  batch_size_clamp(ctl, min_size, max_size);
+
+  if (obs->requests == 0) return;
+
+  double failure_ratio = (double)obs->failures / obs->requests;
+  double cpu_ratio     = obs->elapsed_ms > 0 ? obs->cpu_ms / obs->elapsed_ms : 0;
+  double gradient      = 1;
+
+  // failed requests are already a signal, their latency is mostly their timeout. The requests that
+  // weren't sent (expired, cached, coalesced or rejected by a circuit breaker) have no latency.
+  if (obs->responses > 0) {
+    double latency_ms = obs->latency_ms / obs->responses;
+
+    if (ctl->baseline_latency_ms == 0) ctl->baseline_latency_ms = latency_ms;
+
+    if (latency_ms > 0) gradient = ctl->baseline_latency_ms / latency_ms;
+
+    ctl->baseline_latency_ms =
+        (1 - baseline_weight) * ctl->baseline_latency_ms + baseline_weight * latency_ms;
+  }
+
+  if (failure_ratio > max_failure_ratio || cpu_ratio > max_cpu_ratio ||
+      gradient < min_latency_gradient) {
+    ctl->size = Max(min_size, Min((int)(ctl->size * multiplicative_decrease), ctl->size - 1));
+  } else if (obs->requests >= (uint64)ctl->size) { // a full batch means more requests are waiting
+    ctl->size = Min(max_size, ctl->size + additive_increase);
+  }
+
+  elog(DEBUG1,
+       "pg_net batch size is %d after a batch with %.2f failure ratio, %.2f cpu ratio and %.2f "
+       "latency gradient",
+       ctl->size, failure_ratio, cpu_ratio, gradient);
+}
@@ -0,0 +1,34 @@
+#ifndef BATCH_SIZE_H
+#define BATCH_SIZE_H
+
+// What the worker observed while running a batch
+typedef struct {
+  uint64 requests;   // consumed by the batch
+  uint64 failures;   // requests that didn't get a response, e.g. timeouts and connection errors
+  uint64 responses;  // transfers that got a response, the ones in latency_ms
+  double latency_ms; // sum of the total times of the transfers that got a response
+  double elapsed_ms; // wall time of the batch
+  double cpu_ms;     // user and system time the worker used during the batch
+} BatchObservation;
+
+// An AIMD controller of the batch size, with a latency gradient as an additional congestion signal
+typedef struct {
+  int    size;
+  double baseline_latency_ms; // slow moving average of the mean request latency, 0 when unknown
+} BatchSizeController;
+
+void batch_size_reset(BatchSizeController *ctl, int size);
+
+// Keeps the batch size within the bounds, they might have changed with a reload
+void batch_size_clamp(BatchSizeController *ctl, int min_size, int max_size);
+
+// Sets the wall and cpu time of the batch from the resource usage at its start
+void batch_observe_usage(BatchObservation *obs, const PGRUsage *start);
+
+// Adjusts the batch size after a batch, keeping it within [min_size, max_size]. It's decreased
+// multiplicatively when requests fail, the worker is short on CPU or the latency grows compared to
+// the baseline, otherwise it's increased additively when the batch was full.
+void batch_size_adapt(BatchSizeController *ctl, const BatchObservation *obs, int min_size,
+                      int max_size);
+
+#endif
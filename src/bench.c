@@ -0,0 +1,182 @@
+// Micro-benchmarks of the functions the worker runs for every request. They're only built with
+// `make BENCH=1` and are called from test/utils/bench.sql.
+#ifdef PG_NET_BENCH
+
+#  include "pg_prelude.h"
+
+#  include "curl_prelude.h"
+
+#  include "core.h"
+#  include "errors.h"
+#  include "util.h"
+
+// the memory used is added up and the bench context reset after this many iterations
+static const int iterations_per_reset = 1000;
+
+typedef struct {
+  MemoryContext context;
+  MemoryContext prev_context;
+  Size          empty_bytes; // of the context right after a reset
+  Size          bytes;
+  instr_time    start;
+  double        ns_per_op;
+  double        bytes_per_op;
+} Bench;
+
+static Size bench_allocated(MemoryContext context) {
+#  if PG_VERSION_NUM >= 130000
+  return MemoryContextMemAllocated(context, true);
+#  else
+  (void)context;
+  return 0;
+#  endif
+}
+
+static void bench_start(Bench *bench) {
+  bench->context =
+      AllocSetContextCreate(CurrentMemoryContext, "pg_net bench", ALLOCSET_DEFAULT_SIZES);
+  bench->prev_context = MemoryContextSwitchTo(bench->context);
+  bench->empty_bytes  = bench_allocated(bench->context);
+  bench->bytes        = 0;
+  INSTR_TIME_SET_CURRENT(bench->start);
+}
+
+static void bench_reset(Bench *bench) {
+  bench->bytes += bench_allocated(bench->context) - bench->empty_bytes;
+  MemoryContextReset(bench->context);
+}
+
+static void bench_stop(Bench *bench, int iterations) {
+  bench_reset(bench);
+
+  instr_time elapsed;
+  INSTR_TIME_SET_CURRENT(elapsed);
+  INSTR_TIME_SUBTRACT(elapsed, bench->start);
+
+  MemoryContextSwitchTo(bench->prev_context);
+  MemoryContextDelete(bench->context);
+
+  bench->ns_per_op    = INSTR_TIME_GET_DOUBLE(elapsed) * 1e9 / iterations;
+  bench->bytes_per_op = (double)bench->bytes / iterations;
+}
+
+// Runs the statements the given iterations, allocating in the bench context. The time includes
+// the context resets, the worker also frees its memory per batch.
+#  define BENCH_RUN(bench, iterations, ...)                                                        \
+    do {                                                                                           \
+      bench_start(&(bench));                                                                       \
+      for (int i_ = 1; i_ <= (iterations); i_++) {                                                 \
+        __VA_ARGS__;                                                                               \
+        if (i_ % iterations_per_reset == 0) bench_reset(&(bench));                                 \
+      }                                                                                            \
+      bench_stop(&(bench), (iterations));                                                          \
+    } while (0)
+
+// A row shaped like the ones consume_request_queue() returns, negative ids don't clash with the
+// real requests
+static HeapTuple bench_queue_tuple(text *url, TupleDesc *tupdesc) {
+  int ret_code = SPI_execute_with_args(
+      "\
+      select -1::bigint, 'POST'::text, $1, 5000, '{\"Content-Type\": \"application/json\", \"X-Request-Id\": \"42\", \"Authorization\": \"Bearer token\"}'::jsonb, '{\"hello\": \"world\"}'::text, 'always'::text, null::oid, current_user::regrole::oid, false, null::int, null::xid, false",
+      1, (Oid[]){TEXTOID}, (Datum[]){PointerGetDatum(url)}, NULL, true, 1);
+
+  if (ret_code != SPI_OK_SELECT)
+    ereport(ERROR, errmsg("Error getting the bench row: %s", SPI_result_code_string(ret_code)));
+
+  *tupdesc = SPI_tuptable->tupdesc;
+  return SPI_tuptable->vals[0];
+}
+
+// A handle that got a response from the url, to read its headers
+static void bench_performed_handle(CurlHandle *handle, RequestQueueRow row) {
+  init_curl_handle(handle, row);
+
+  CURLcode curl_return_code = curl_easy_perform(handle->ez_handle);
+  if (curl_return_code != CURLE_OK)
+    ereport(ERROR, errmsg("Couldn't get a response from %s: %s", handle->url,
+                          curl_easy_strerror(curl_return_code)));
+}
+
+static void bench_insert_response(Bench *bench, int iterations, Response *response) {
+  MemoryContext old_context = CurrentMemoryContext;
+  ResourceOwner old_owner   = CurrentResourceOwner;
+
+  // the inserted rows are rolled back
+  BeginInternalSubTransaction(NULL);
+  MemoryContextSwitchTo(old_context);
+
+  BENCH_RUN(*bench, iterations, insert_response(response); SPI_freetuptable(SPI_tuptable));
+
+  RollbackAndReleaseCurrentSubTransaction();
+  MemoryContextSwitchTo(old_context);
+  CurrentResourceOwner = old_owner;
+}
+
+PG_FUNCTION_INFO_V1(bench_hot_path);
+Datum bench_hot_path(PG_FUNCTION_ARGS) {
+  char     *function   = text_to_cstring(PG_GETARG_TEXT_PP(0));
+  int32     iterations = PG_GETARG_INT32(1);
+  text     *url        = PG_GETARG_TEXT_PP(2);
+  TupleDesc tupdesc;
+
+  if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+    ereport(ERROR, errmsg("return type must be a row type"));
+
+  if (iterations < 1) ereport(ERROR, errmsg("iterations must be at least 1"));
+
+  SPI_connect();
+
+  TupleDesc       queue_tupdesc;
+  HeapTuple       queue_tuple = bench_queue_tuple(url, &queue_tupdesc);
+  RequestQueueRow row         = get_request_queue_row(queue_tuple, queue_tupdesc);
+  Bench           bench       = {0};
+
+  if (strcmp(function, "get_request_queue_row") == 0) {
+    BENCH_RUN(bench, iterations, (void)get_request_queue_row(queue_tuple, queue_tupdesc));
+  } else if (strcmp(function, "jsonb_headers_to_slist") == 0) {
+    Jsonb *headers = DatumGetJsonbP(row.headersBin.value);
+
+    BENCH_RUN(bench, iterations, curl_slist_free_all(jsonb_headers_to_slist(headers, NULL)));
+  } else if (strcmp(function, "init_curl_handle") == 0) {
+    CurlHandle handle;
+
+    BENCH_RUN(bench, iterations, init_curl_handle(&handle, row);
+              if (!handle.shared_headers) curl_slist_free_all(handle.request_headers);
+              free_shared_header_lists(); curl_easy_cleanup(handle.ez_handle));
+  } else if (strcmp(function, "jsonb_headers_from_curl_handle") == 0) {
+    CurlHandle handle;
+    bench_performed_handle(&handle, row);
+
+    BENCH_RUN(bench, iterations, (void)jsonb_headers_from_curl_handle(handle.ez_handle));
+
+    curl_easy_cleanup(handle.ez_handle);
+  } else if (strcmp(function, "insert_response") == 0) {
+    CurlHandle handle;
+    bench_performed_handle(&handle, row);
+
+    Response response = build_response(&handle, CURLE_OK);
+    bench_insert_response(&bench, iterations, &response);
+
+    curl_easy_cleanup(handle.ez_handle);
+  } else {
+    ereport(ERROR, errmsg("unknown bench function \"%s\"", function),
+            errhint("Valid values are \"get_request_queue_row\", \"jsonb_headers_to_slist\", "
+                    "\"init_curl_handle\", \"jsonb_headers_from_curl_handle\" and "
+                    "\"insert_response\"."));
+  }
+
+  // init_curl_handle() allocated them in the SPI context
+  free_shared_header_lists();
+
+  SPI_finish();
+
+  Datum values[] = {
+    Float8GetDatum(bench.ns_per_op),
+    Float8GetDatum(bench.bytes_per_op),
+  };
+  bool nulls[lengthof(values)] = {false, PG_VERSION_NUM < 130000};
+
+  PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(BlessTupleDesc(tupdesc), values, nulls)));
+}
+
+#endif
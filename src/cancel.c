@@ -0,0 +1,377 @@
+#include <signal.h>
+
+#include "pg_prelude.h"
+
+#include "cancel.h"
+#include "queue_depth.h"
+#include "util.h"
+#include "worker.h"
+
+// A cancellation asked by a backend, the worker answers it once it looked the request up in its
+// batch
+typedef enum {
+  CANCEL_FREE,     // the slot can be used
+  CANCEL_PENDING,  // waits for the worker to take it
+  CANCEL_TAKEN,    // the worker looks up the request
+  CANCEL_ANSWERED, // `cancelled` is the answer of the worker
+} CancelSlotState;
+
+typedef struct {
+  CancelSlotState state;
+  int64           id;
+  Latch          *latch;     // of the backend waiting for the answer
+  bool            cancelled; // the request was in the batch and wasn't finished yet
+} CancelSlot;
+
+// The cancellations of the requests the worker is sending
+typedef struct {
+  LWLock    *lock;
+  pid_t      worker_pid; // InvalidPid when the worker isn't sending a batch
+  CancelSlot slots[max_pending_cancels];
+} CancelState;
+
+static const char *cancel_tranche = "pg_net cancel";
+// how often a full list of pending cancellations is checked for room, and an answer is waited for
+static const long cancel_poll_ms = 10;
+
+static CancelState *state = NULL;
+
+static SPIPlanPtr queued_plan = NULL;
+static SPIPlanPtr cancel_plan = NULL;
+static SPIPlanPtr clear_plan  = NULL;
+
+Size cancel_shmem_size(void) {
+  return MAXALIGN(sizeof(CancelState));
+}
+
+void cancel_shmem_request(void) {
+  RequestAddinShmemSpace(cancel_shmem_size());
+  RequestNamedLWLockTranche(cancel_tranche, 1);
+}
+
+// must be called while holding the AddinShmemInitLock
+void cancel_shmem_startup(void) {
+  bool found;
+
+  state = ShmemInitStruct("pg_net cancel state", sizeof(CancelState), &found);
+
+  if (!found) {
+    state->lock       = &(GetNamedLWLockTranche(cancel_tranche))->lock;
+    state->worker_pid = InvalidPid;
+
+    for (int i = 0; i < max_pending_cancels; i++)
+      state->slots[i].state = CANCEL_FREE;
+  }
+}
+
+// must be called while holding the lock
+static void answer(CancelSlot *slot, bool cancelled) {
+  slot->state     = CANCEL_ANSWERED;
+  slot->cancelled = cancelled;
+  SetLatch(slot->latch);
+}
+
+void cancel_batch_started(void) {
+  LWLockAcquire(state->lock, LW_EXCLUSIVE);
+  state->worker_pid = MyProcPid;
+  LWLockRelease(state->lock);
+}
+
+void cancel_batch_finished(void) {
+  LWLockAcquire(state->lock, LW_EXCLUSIVE);
+
+  state->worker_pid = InvalidPid;
+
+  // the requests asked for are done, or weren't in the batch
+  for (int i = 0; i < max_pending_cancels; i++) {
+    CancelSlot *slot = &state->slots[i];
+    if (slot->state == CANCEL_PENDING || slot->state == CANCEL_TAKEN) answer(slot, false);
+  }
+
+  LWLockRelease(state->lock);
+}
+
+int cancel_take_pending(PendingCancel *pending) {
+  int count = 0;
+
+  LWLockAcquire(state->lock, LW_EXCLUSIVE);
+
+  for (int i = 0; i < max_pending_cancels; i++) {
+    CancelSlot *slot = &state->slots[i];
+
+    if (slot->state != CANCEL_PENDING) continue;
+
+    slot->state      = CANCEL_TAKEN;
+    pending[count++] = (PendingCancel){.slot = i, .id = slot->id};
+  }
+
+  LWLockRelease(state->lock);
+
+  return count;
+}
+
+void cancel_answer(PendingCancel pending, bool cancelled) {
+  LWLockAcquire(state->lock, LW_EXCLUSIVE);
+
+  CancelSlot *slot = &state->slots[pending.slot];
+
+  // the backend stopped waiting when it errored, e.g. on a statement timeout
+  if (slot->state == CANCEL_TAKEN && slot->id == pending.id) answer(slot, cancelled);
+
+  LWLockRelease(state->lock);
+}
+
+static void free_slot(int slot) {
+  LWLockAcquire(state->lock, LW_EXCLUSIVE);
+  state->slots[slot].state = CANCEL_FREE;
+  LWLockRelease(state->lock);
+}
+
+// Waits for the worker to answer the cancellation, the slot is freed by an error too
+static bool wait_for_answer(int slot) {
+  bool cancelled = false;
+
+  PG_TRY();
+  {
+    for (;;) {
+      LWLockAcquire(state->lock, LW_SHARED);
+      bool answered = state->slots[slot].state == CANCEL_ANSWERED;
+      cancelled     = state->slots[slot].cancelled;
+      LWLockRelease(state->lock);
+
+      if (answered) break;
+
+      (void)WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH, cancel_poll_ms,
+                      PG_WAIT_EXTENSION);
+      ResetLatch(MyLatch);
+      CHECK_FOR_INTERRUPTS();
+    }
+  }
+  PG_CATCH();
+  {
+    free_slot(slot);
+    PG_RE_THROW();
+  }
+  PG_END_TRY();
+
+  free_slot(slot);
+
+  return cancelled;
+}
+
+// Asks the worker to stop sending the request and waits for its answer. False when it isn't sending
+// a batch anymore, or the request isn't in it or is already done.
+static bool cancel_in_flight(int64 id) {
+  int slot = -1;
+
+  for (;;) {
+    LWLockAcquire(state->lock, LW_EXCLUSIVE);
+
+    pid_t worker_pid = state->worker_pid;
+
+    for (int i = 0; worker_pid != InvalidPid && i < max_pending_cancels; i++) {
+      if (state->slots[i].state != CANCEL_FREE) continue;
+
+      state->slots[i] = (CancelSlot){.state = CANCEL_PENDING, .id = id, .latch = MyLatch};
+      slot            = i;
+      break;
+    }
+
+    LWLockRelease(state->lock);
+
+    if (worker_pid == InvalidPid) return false;
+
+    if (slot >= 0) {
+      // the worker waits on its sockets, not on its latch, while it sends the batch
+      if (kill(worker_pid, SIGUSR2) != 0)
+        elog(DEBUG1, "pg_net could not signal the worker: %m");
+
+      break;
+    }
+
+    (void)WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH, cancel_poll_ms,
+                    PG_WAIT_EXTENSION);
+    ResetLatch(MyLatch);
+    CHECK_FOR_INTERRUPTS();
+  }
+
+  return wait_for_answer(slot);
+}
+
+// Leaves the request for the worker with a "Request cancelled" error, unless the worker is sending
+// it and its row is locked. It must be called as the owner of the queue.
+static bool cancel_queued(int64 id, Oid role) {
+  if (cancel_plan == NULL) {
+    SPIPlanPtr tmp = SPI_prepare("\
+        WITH\
+        target AS (\
+          SELECT id, xmin FROM net.http_request_queue\
+          WHERE id = $1 AND error_msg IS NULL\
+          FOR UPDATE SKIP LOCKED\
+        )\
+        UPDATE net.http_request_queue q\
+        SET error_msg = 'Request cancelled'\
+        FROM target\
+        WHERE q.id = target.id\
+        RETURNING target.xmin",
+                                 1, (Oid[]){INT8OID});
+
+    if (tmp == NULL)
+      ereport(ERROR, errmsg("SPI_prepare failed: %s", SPI_result_code_string(SPI_result)));
+
+    cancel_plan = SPI_saveplan(tmp);
+    if (cancel_plan == NULL) ereport(ERROR, errmsg("SPI_saveplan failed"));
+
+    SPI_freeplan(tmp);
+  }
+
+  int ret_code = SPI_execute_plan(cancel_plan, (Datum[]){Int64GetDatum(id)}, NULL, false, 0);
+
+  if (ret_code != SPI_OK_UPDATE_RETURNING)
+    ereport(ERROR, errmsg("Error cancelling the request: %s", SPI_result_code_string(ret_code)));
+
+  if (SPI_processed == 0) return false;
+
+  bool          isnull;
+  TransactionId xmin = DatumGetTransactionId(
+      SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+
+  SPI_freetuptable(SPI_tuptable);
+
+  queue_depth_removed(role, xmin);
+
+  // the worker stores its response, so that they're only written by it
+  wake_worker_at_commit();
+
+  return true;
+}
+
+PG_FUNCTION_INFO_V1(cancel);
+Datum cancel(PG_FUNCTION_ARGS) {
+  int64 id        = PG_GETARG_INT64(0);
+  bool  cancelled = false;
+
+  SPI_connect();
+
+  // The queue is read and written as its owner, the role asking must have the privileges of the one
+  // that enqueued the request. The user id is restored by an error too.
+  Oid queue_relid = RangeVarGetRelid(makeRangeVar("net", "http_request_queue", -1), NoLock, false);
+  Oid save_userid;
+  int save_sec_context;
+
+  GetUserIdAndSecContext(&save_userid, &save_sec_context);
+  SetUserIdAndSecContext(get_rel_owner(queue_relid),
+                         save_sec_context | SECURITY_LOCAL_USERID_CHANGE);
+
+  if (queued_plan == NULL) {
+    SPIPlanPtr tmp = SPI_prepare("\
+        SELECT enqueued_by, error_msg IS NOT NULL FROM net.http_request_queue WHERE id = $1",
+                                 1, (Oid[]){INT8OID});
+
+    if (tmp == NULL)
+      ereport(ERROR, errmsg("SPI_prepare failed: %s", SPI_result_code_string(SPI_result)));
+
+    queued_plan = SPI_saveplan(tmp);
+    if (queued_plan == NULL) ereport(ERROR, errmsg("SPI_saveplan failed"));
+
+    SPI_freeplan(tmp);
+  }
+
+  int ret_code = SPI_execute_plan(queued_plan, (Datum[]){Int64GetDatum(id)}, NULL, false, 0);
+
+  if (ret_code != SPI_OK_SELECT)
+    ereport(ERROR, errmsg("Error cancelling the request: %s", SPI_result_code_string(ret_code)));
+
+  // a completed or unknown request has no row, the row of a request the worker is sending stays
+  // until its batch commits
+  if (SPI_processed > 0) {
+    bool isnull;
+    Oid  role =
+        DatumGetObjectId(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+    bool has_error_msg =
+        DatumGetBool(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2, &isnull));
+
+    SPI_freetuptable(SPI_tuptable);
+
+    if (!has_privs_of_role(save_userid, role))
+      ereport(ERROR, errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+              errmsg("permission denied to cancel request " INT64_FORMAT, id),
+              errdetail("Only roles with the privileges of role \"%s\" can cancel it.",
+                        GetUserNameFromId(role, false)));
+
+    // an already cancelled or dropped request isn't cancelled again
+    if (!has_error_msg) cancelled = cancel_queued(id, role) || cancel_in_flight(id);
+  }
+
+  SetUserIdAndSecContext(save_userid, save_sec_context);
+
+  SPI_finish();
+
+  PG_RETURN_BOOL(cancelled);
+}
+
+// Cancels the requests waiting in the queue that the role asking can cancel, the ones the worker is
+// sending are left to net.cancel(). Deleting them directly would skip the worker, which completes
+// them with a "Request cancelled" error like the ones cancelled one at a time.
+PG_FUNCTION_INFO_V1(clear_queue);
+Datum clear_queue(__attribute__((unused)) PG_FUNCTION_ARGS) {
+  SPI_connect();
+
+  Oid queue_relid = RangeVarGetRelid(makeRangeVar("net", "http_request_queue", -1), NoLock, false);
+  Oid save_userid;
+  int save_sec_context;
+
+  GetUserIdAndSecContext(&save_userid, &save_sec_context);
+  SetUserIdAndSecContext(get_rel_owner(queue_relid),
+                         save_sec_context | SECURITY_LOCAL_USERID_CHANGE);
+
+  if (clear_plan == NULL) {
+    SPIPlanPtr tmp = SPI_prepare("\
+        WITH\
+        target AS (\
+          SELECT id, xmin FROM net.http_request_queue\
+          WHERE error_msg IS NULL AND pg_has_role($1, enqueued_by, 'USAGE')\
+          FOR UPDATE SKIP LOCKED\
+        )\
+        UPDATE net.http_request_queue q\
+        SET error_msg = 'Request cancelled'\
+        FROM target\
+        WHERE q.id = target.id\
+        RETURNING q.enqueued_by, target.xmin",
+                                 1, (Oid[]){OIDOID});
+
+    if (tmp == NULL)
+      ereport(ERROR, errmsg("SPI_prepare failed: %s", SPI_result_code_string(SPI_result)));
+
+    clear_plan = SPI_saveplan(tmp);
+    if (clear_plan == NULL) ereport(ERROR, errmsg("SPI_saveplan failed"));
+
+    SPI_freeplan(tmp);
+  }
+
+  int ret_code =
+      SPI_execute_plan(clear_plan, (Datum[]){ObjectIdGetDatum(save_userid)}, NULL, false, 0);
+
+  if (ret_code != SPI_OK_UPDATE_RETURNING)
+    ereport(ERROR, errmsg("Error clearing the queue: %s", SPI_result_code_string(ret_code)));
+
+  uint64 cancelled = SPI_processed;
+
+  for (uint64 i = 0; i < cancelled; i++) {
+    bool          isnull;
+    Oid           role = DatumGetObjectId(
+        SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1, &isnull));
+    TransactionId xmin = DatumGetTransactionId(
+        SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 2, &isnull));
+
+    queue_depth_removed(role, xmin);
+  }
+
+  if (cancelled > 0) wake_worker_at_commit();
+
+  SetUserIdAndSecContext(save_userid, save_sec_context);
+
+  SPI_finish();
+
+  PG_RETURN_INT64((int64)cancelled);
+}
@@ -0,0 +1,34 @@
+#ifndef CANCEL_H
+#define CANCEL_H
+
+// requests whose cancellation can wait for the worker at once, more wait for room
+enum { max_pending_cancels = 256 };
+
+// A cancellation the worker took, it must answer it with cancel_answer
+typedef struct {
+  int   slot;
+  int64 id;
+} PendingCancel;
+
+Size cancel_shmem_size(void);
+
+void cancel_shmem_request(void);
+
+void cancel_shmem_startup(void);
+
+// The worker started sending a batch, the cancellations asked from now on are for its requests. The
+// worker gets a signal to interrupt its wait on the sockets when one arrives.
+void cancel_batch_started(void);
+
+// The requests of the batch are done, the cancellations that weren't answered yet, or that arrive
+// late, didn't cancel anything
+void cancel_batch_finished(void);
+
+// Takes the cancellations asked since the last call, `pending` must hold max_pending_cancels of
+// them. Returns how many it took.
+int cancel_take_pending(PendingCancel *pending);
+
+// Tells the backend that asked for the cancellation whether the request was cancelled
+void cancel_answer(PendingCancel pending, bool cancelled);
+
+#endif
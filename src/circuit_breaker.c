@@ -0,0 +1,223 @@
+#include "pg_prelude.h"
+
+#include "curl_prelude.h"
+
+#include "circuit_breaker.h"
+
+typedef enum {
+  CIRCUIT_CLOSED,    // requests are sent, the host is tracked because of its recent failures
+  CIRCUIT_OPEN,      // requests fail without being sent until the cooldown passes
+  CIRCUIT_HALF_OPEN, // a probe was sent, requests fail until it completes or the cooldown passes
+} CircuitState;
+
+enum { circuit_host_len = 264 }; // fits a dns name plus the port
+
+typedef struct {
+  char         host[circuit_host_len]; // hash key
+  CircuitState state;
+  int32        consecutive_failures;
+  TimestampTz  opened_at;
+  TimestampTz  retry_at; // when the next probe can be sent
+} Circuit;
+
+static const char *circuit_breaker_tranche = "pg_net circuit breaker";
+// hosts beyond this aren't tracked, only hosts that are failing take an entry
+static const long max_circuits = 1024;
+
+int guc_circuit_breaker_failures = 0;
+int guc_circuit_breaker_cooldown = 30000;
+
+static LWLock *circuits_lock = NULL;
+static HTAB   *circuits      = NULL;
+
+Size circuit_breaker_shmem_size(void) {
+  return hash_estimate_size(max_circuits, sizeof(Circuit));
+}
+
+void circuit_breaker_shmem_request(void) {
+  RequestAddinShmemSpace(circuit_breaker_shmem_size());
+  RequestNamedLWLockTranche(circuit_breaker_tranche, 1);
+}
+
+// must be called while holding the AddinShmemInitLock
+void circuit_breaker_shmem_startup(void) {
+  HASHCTL info = {
+    .keysize   = circuit_host_len,
+    .entrysize = sizeof(Circuit),
+  };
+
+  int flags = HASH_ELEM;
+#if PG_VERSION_NUM >= 140000
+  flags |= HASH_STRINGS;
+#endif
+
+  circuits_lock = &(GetNamedLWLockTranche(circuit_breaker_tranche))->lock;
+  circuits = ShmemInitHash("pg_net circuit breaker", max_circuits, max_circuits, &info, flags);
+}
+
+char *circuit_breaker_host(const char *url) {
+  if (guc_circuit_breaker_failures == 0) return NULL;
+
+  return circuit_host_of(url);
+}
+
+char *circuit_host_of(const char *url) {
+  CURLU *parsed = curl_url();
+  char  *host   = NULL;
+  char  *port   = NULL;
+  char  *result = NULL;
+
+  if (parsed && curl_url_set(parsed, CURLUPART_URL, url, 0) == CURLUE_OK &&
+      curl_url_get(parsed, CURLUPART_HOST, &host, 0) == CURLUE_OK &&
+      curl_url_get(parsed, CURLUPART_PORT, &port, CURLU_DEFAULT_PORT) == CURLUE_OK &&
+      strlen(host) + strlen(port) + 1 < circuit_host_len)
+    result = psprintf("%s:%s", host, port);
+
+  curl_free(host);
+  curl_free(port);
+  curl_url_cleanup(parsed);
+
+  return result;
+}
+
+bool circuit_breaker_allows(const char *host) {
+  if (host == NULL) return true;
+
+  bool allowed = true;
+
+  LWLockAcquire(circuits_lock, LW_EXCLUSIVE);
+
+  Circuit *circuit = hash_search(circuits, host, HASH_FIND, NULL);
+
+  if (circuit && circuit->state != CIRCUIT_CLOSED) {
+    TimestampTz now = GetCurrentTimestamp();
+
+    if (now < circuit->retry_at) {
+      allowed = false;
+    } else { // this request is the probe, another one is sent if it doesn't complete in time
+      circuit->state    = CIRCUIT_HALF_OPEN;
+      circuit->retry_at = TimestampTzPlusMilliseconds(now, guc_circuit_breaker_cooldown);
+    }
+  }
+
+  LWLockRelease(circuits_lock);
+
+  return allowed;
+}
+
+bool is_connection_failure(CURLcode curl_return_code) {
+  return curl_return_code == CURLE_COULDNT_RESOLVE_HOST ||
+         curl_return_code == CURLE_COULDNT_CONNECT || curl_return_code == CURLE_OPERATION_TIMEDOUT;
+}
+
+void circuit_breaker_record(const char *host, CURLcode curl_return_code) {
+  if (host == NULL) return;
+
+  LWLockAcquire(circuits_lock, LW_EXCLUSIVE);
+
+  if (!is_connection_failure(curl_return_code)) {
+    hash_search(circuits, host, HASH_REMOVE, NULL);
+    LWLockRelease(circuits_lock);
+    return;
+  }
+
+  bool     found;
+  Circuit *circuit = hash_search(circuits, host, HASH_ENTER_NULL, &found);
+
+  if (circuit == NULL) { // too many failing hosts, this one isn't tracked
+    LWLockRelease(circuits_lock);
+    return;
+  }
+
+  if (!found) {
+    circuit->state                = CIRCUIT_CLOSED;
+    circuit->consecutive_failures = 0;
+    circuit->opened_at            = 0;
+    circuit->retry_at             = 0;
+  }
+
+  circuit->consecutive_failures++;
+
+  if (circuit->state == CIRCUIT_HALF_OPEN ||
+      (circuit->state == CIRCUIT_CLOSED &&
+       circuit->consecutive_failures >= guc_circuit_breaker_failures)) {
+    TimestampTz now = GetCurrentTimestamp();
+
+    circuit->state     = CIRCUIT_OPEN;
+    circuit->opened_at = now;
+    circuit->retry_at  = TimestampTzPlusMilliseconds(now, guc_circuit_breaker_cooldown);
+  }
+
+  LWLockRelease(circuits_lock);
+}
+
+void circuit_breaker_reset(void) {
+  HASH_SEQ_STATUS status;
+  Circuit        *circuit;
+
+  LWLockAcquire(circuits_lock, LW_EXCLUSIVE);
+
+  hash_seq_init(&status, circuits);
+  while ((circuit = hash_seq_search(&status)))
+    hash_search(circuits, circuit->host, HASH_REMOVE, NULL);
+
+  LWLockRelease(circuits_lock);
+}
+
+static const char *circuit_state_name(CircuitState state) {
+  switch (state) {
+  case CIRCUIT_CLOSED:    return "closed";
+  case CIRCUIT_OPEN:      return "open";
+  case CIRCUIT_HALF_OPEN: return "half_open";
+  }
+
+  return "closed";
+}
+
+PG_FUNCTION_INFO_V1(circuit_breakers);
+Datum circuit_breakers(PG_FUNCTION_ARGS) {
+  ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+  TupleDesc      tupdesc;
+
+  if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) ||
+      !(rsinfo->allowedModes & SFRM_Materialize))
+    ereport(ERROR, errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+            errmsg("set-valued function called in context that cannot accept a set"));
+
+  if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+    ereport(ERROR, errmsg("return type must be a row type"));
+
+  MemoryContext old = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+  Tuplestorestate *store = tuplestore_begin_heap(true, false, work_mem);
+
+  rsinfo->returnMode = SFRM_Materialize;
+  rsinfo->setResult  = store;
+  rsinfo->setDesc    = CreateTupleDescCopy(tupdesc);
+
+  MemoryContextSwitchTo(old);
+
+  HASH_SEQ_STATUS status;
+  Circuit        *circuit;
+
+  LWLockAcquire(circuits_lock, LW_SHARED);
+
+  hash_seq_init(&status, circuits);
+  while ((circuit = hash_seq_search(&status))) {
+    Datum values[] = {
+      CStringGetTextDatum(circuit->host),
+      CStringGetTextDatum(circuit_state_name(circuit->state)),
+      Int32GetDatum(circuit->consecutive_failures),
+      TimestampTzGetDatum(circuit->opened_at),
+      TimestampTzGetDatum(circuit->retry_at),
+    };
+    bool nulls[lengthof(values)] = {false, false, false, circuit->opened_at == 0,
+                                    circuit->state == CIRCUIT_CLOSED};
+
+    tuplestore_putvalues(store, rsinfo->setDesc, values, nulls);
+  }
+
+  LWLockRelease(circuits_lock);
+
+  return (Datum)0;
+}
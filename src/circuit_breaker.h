@@ -0,0 +1,35 @@
+#ifndef CIRCUIT_BREAKER_H
+#define CIRCUIT_BREAKER_H
+
+extern int guc_circuit_breaker_failures;
+extern int guc_circuit_breaker_cooldown;
+
+Size circuit_breaker_shmem_size(void);
+
+void circuit_breaker_shmem_request(void);
+
+void circuit_breaker_shmem_startup(void);
+
+// The host the circuit of the url is kept by, as "host:port". NULL when the circuit breaker is
+// disabled or the url can't be parsed.
+char *circuit_breaker_host(const char *url);
+
+// Same as circuit_breaker_host() but also when the circuit breaker is disabled, for the urls whose
+// host is kept around
+char *circuit_host_of(const char *url);
+
+// Whether a request to the host can be sent. Once an open circuit's cooldown passes, a single
+// request is let through as a probe.
+bool circuit_breaker_allows(const char *host);
+
+// Whether the request couldn't reach its host: it failed to resolve or connect, or it timed out
+bool is_connection_failure(CURLcode curl_return_code);
+
+// Counts the result of a request that was sent, connection failures and timeouts open the circuit
+// after pg_net.circuit_breaker_failures in a row, anything else closes it
+void circuit_breaker_record(const char *host, CURLcode curl_return_code);
+
+// Closes every circuit
+void circuit_breaker_reset(void);
+
+#endif
@@ -2,77 +2,298 @@
 #include <inttypes.h>
 #include <string.h>
 #include <unistd.h>
+#include <zlib.h>
 
 #include "pg_prelude.h"
 
 #include "curl_prelude.h"
 
+#include "circuit_breaker.h"
 #include "core.h"
+#include "endpoints.h"
 #include "errors.h"
 #include "event.h"
+#include "queue_depth.h"
+#include "shared_queue.h"
+#include "util.h"
 
-static SPIPlanPtr del_response_plan     = NULL;
 static SPIPlanPtr del_return_queue_plan = NULL;
+static SPIPlanPtr fail_queue_plan       = NULL;
 static SPIPlanPtr ins_response_plan     = NULL;
+static SPIPlanPtr ins_chunk_plan        = NULL;
+static SPIPlanPtr del_chunks_plan       = NULL;
+
+int guc_response_chunk_size = 1024; // kB
 
 static size_t body_cb(void *contents, size_t size, size_t nmemb, void *userp) {
   CurlHandle *handle   = (CurlHandle *)userp;
   size_t      realsize = size * nmemb;
+
+  // curl passes the data again once the worker wrote the chunk and resumed the transfer
+  if (handle->store_response == STORE_RESPONSE_CHUNKED && handle->body->len > 0 &&
+      handle->body->len + realsize > (size_t)guc_response_chunk_size * 1024) {
+    handle->paused = true;
+    return CURL_WRITEFUNC_PAUSE;
+  }
+
   appendBinaryStringInfo(handle->body, (const char *)contents, (int)realsize);
   return realsize;
 }
 
-static struct curl_slist *pg_text_array_to_slist(ArrayType *array, struct curl_slist *headers) {
-  ArrayIterator iterator;
-  Datum         value;
-  bool          isnull;
-  char         *hdr;
+static size_t hedge_body_cb(void *contents, size_t size, size_t nmemb, void *userp) {
+  CurlHandle *handle   = (CurlHandle *)userp;
+  size_t      realsize = size * nmemb;
+  appendBinaryStringInfo(handle->hedge_body, (const char *)contents, (int)realsize);
+  return realsize;
+}
+
+// A header list shared by the rows of a batch that have the same headers and endpoint
+typedef struct {
+  uint64             hash; // of the headers jsonb, seeded with the endpoint id
+  Jsonb             *headers;
+  Endpoint          *endpoint; // NULL for requests with an absolute url
+  struct curl_slist *list;
+} SharedHeaderList;
+
+// lives in the memory context of the batch, until free_shared_header_lists()
+static HTAB *shared_header_lists = NULL;
+
+// The request headers of a queue row, with the User-Agent and the headers of its endpoint. Rows with
+// the same headers and endpoint share the list, unless their hashes collide.
+static struct curl_slist *header_list_for(Jsonb *headers, Endpoint *endpoint, bool *shared) {
+  // the endpoint keeps its own list between batches
+  if (endpoint && JB_ROOT_COUNT(headers) == 0) {
+    *shared = true;
+    return endpoint->headers;
+  }
 
-  iterator = array_create_iterator(array, 0, NULL);
+  if (shared_header_lists == NULL) {
+    HASHCTL info = {
+      .keysize   = sizeof(uint64),
+      .entrysize = sizeof(SharedHeaderList),
+      .hcxt      = CurrentMemoryContext,
+    };
 
-  while (array_iterate(iterator, &value, &isnull)) {
-    if (isnull) {
-      continue;
-    }
+    shared_header_lists = hash_create("pg_net shared header lists", 64, &info,
+                                      HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+  }
+
+  uint64 hash = DatumGetUInt64(hash_any_extended((const unsigned char *)headers, VARSIZE(headers),
+                                                 endpoint ? endpoint->id : 0));
+  bool   found;
 
-    hdr = TextDatumGetCString(value);
-    EREPORT_CURL_SLIST_APPEND(headers, hdr);
-    pfree(hdr);
+  SharedHeaderList *entry = hash_search(shared_header_lists, &hash, HASH_ENTER, &found);
+
+  if (found) {
+    *shared = entry->endpoint == endpoint && VARSIZE(entry->headers) == VARSIZE(headers) &&
+              memcmp(entry->headers, headers, VARSIZE(headers)) == 0;
+
+    if (*shared) return entry->list;
   }
-  array_free_iterator(iterator);
 
-  return headers;
+  struct curl_slist *list;
+
+  if (endpoint) {
+    list = endpoint_request_headers(endpoint, headers);
+  } else {
+    list = jsonb_headers_to_slist(headers, NULL);
+    EREPORT_CURL_SLIST_APPEND(list, "User-Agent: pg_net/" EXTVERSION);
+  }
+
+  if (!found) {
+    entry->headers  = headers;
+    entry->endpoint = endpoint;
+    entry->list     = list;
+    *shared         = true;
+  }
+
+  return list;
 }
 
-void init_curl_handle(CurlHandle *handle, RequestQueueRow row) {
-  handle->id        = row.id;
-  handle->body      = makeStringInfo();
-  handle->ez_handle = curl_easy_init();
+void free_shared_header_lists(void) {
+  if (shared_header_lists == NULL) return;
 
-  handle->timeout_milliseconds = row.timeout_milliseconds;
+  HASH_SEQ_STATUS   status;
+  SharedHeaderList *entry;
 
-  if (!row.headersBin.isnull) {
-    ArrayType         *pgHeaders       = DatumGetArrayTypeP(row.headersBin.value);
-    struct curl_slist *request_headers = NULL;
+  hash_seq_init(&status, shared_header_lists);
+  while ((entry = hash_seq_search(&status)))
+    curl_slist_free_all(entry->list);
+
+  hash_destroy(shared_header_lists);
+  shared_header_lists = NULL;
+}
+
+void unshare_request_headers(CurlHandle *handle) {
+  if (!handle->shared_headers) return;
+
+  struct curl_slist *copy = NULL;
+
+  for (struct curl_slist *h = handle->request_headers; h; h = h->next)
+    EREPORT_CURL_SLIST_APPEND(copy, h->data);
+
+  handle->request_headers = copy;
+  handle->shared_headers  = false;
+
+  EREPORT_CURL_SETOPT(handle->ez_handle, CURLOPT_HTTPHEADER, handle->request_headers);
+}
+
+char *guc_resolve = NULL;
 
-    request_headers = pg_text_array_to_slist(pgHeaders, request_headers);
+// the pg_net.resolve the worker loaded, and the curl entries for it
+static char              *static_resolve_value = NULL;
+static struct curl_slist *static_resolve       = NULL;
 
-    EREPORT_CURL_SLIST_APPEND(request_headers, "User-Agent: pg_net/" EXTVERSION);
+// Splits a pg_net.resolve value in its entries, without the spaces around them
+static List *resolve_entries(const char *value) {
+  List *entries = NIL;
+  char *copy    = pstrdup(value);
+  char *saveptr = NULL;
 
-    handle->request_headers = request_headers;
+  for (char *entry = strtok_r(copy, ",", &saveptr); entry; entry = strtok_r(NULL, ",", &saveptr)) {
+    while (isspace((unsigned char)*entry))
+      entry++;
+
+    char *end = entry + strlen(entry);
+    while (end > entry && isspace((unsigned char)end[-1]))
+      *--end = '\0';
+
+    if (*entry) entries = lappend(entries, pstrdup(entry));
   }
 
-  handle->url = TextDatumGetCString(row.url);
+  pfree(copy);
 
-  handle->req_body = !row.bodyBin.isnull ? TextDatumGetCString(row.bodyBin.value) : NULL;
+  return entries;
+}
 
-  handle->method = TextDatumGetCString(row.method);
+// the length of the "host:port" of a "host:port:address" entry, 0 when it has another format
+static size_t resolve_entry_host_port_len(const char *entry) {
+  const char *port = strchr(entry, ':');
+
+  if (port == NULL || port == entry) return 0;
+
+  const char *address = port + 1;
+  while (isdigit((unsigned char)*address))
+    address++;
+
+  if (address == port + 1 || *address != ':' || address[1] == '\0') return 0;
+
+  return address - entry;
+}
+
+bool check_resolve(char **newval, __attribute__((unused)) void **extra,
+                   __attribute__((unused)) GucSource source) {
+  if (*newval == NULL) return true;
+
+  List     *entries = resolve_entries(*newval);
+  ListCell *lc;
+  bool      valid   = true;
+
+  foreach (lc, entries) {
+    if (resolve_entry_host_port_len(lfirst(lc)) == 0) {
+      GUC_check_errdetail("\"%s\" is not a host:port:address entry.", (char *)lfirst(lc));
+      valid = false;
+      break;
+    }
+  }
+
+  list_free_deep(entries);
+
+  return valid;
+}
+
+void load_static_resolve(void) {
+  const char *value = guc_resolve ? guc_resolve : "";
+
+  if (static_resolve_value && strcmp(static_resolve_value, value) == 0) return;
+
+  struct curl_slist *list = NULL;
+
+  // The entries go into the dns cache of the multi handle and stay there, so the hosts of the
+  // previous value are removed from it first. The removals are kept until the value changes again,
+  // which makes the hosts that are no longer mapped be resolved on every request in the meantime.
+  for (struct curl_slist *h = static_resolve; h; h = h->next) {
+    if (h->data[0] == '-') continue;
+
+    char *removal = psprintf("-%.*s", (int)resolve_entry_host_port_len(h->data), h->data);
+    EREPORT_CURL_SLIST_APPEND(list, removal);
+    pfree(removal);
+  }
+
+  List     *entries = resolve_entries(value);
+  ListCell *lc;
+
+  foreach (lc, entries) {
+    char *entry = lfirst(lc);
+    EREPORT_CURL_SLIST_APPEND(list, entry);
+  }
+
+  list_free_deep(entries);
+
+  curl_slist_free_all(static_resolve);
+  if (static_resolve_value) pfree(static_resolve_value);
+
+  static_resolve       = list;
+  static_resolve_value = MemoryContextStrdup(TopMemoryContext, value);
+}
+
+// bodies smaller than this are sent as is, gzip would barely shrink them
+static const size_t min_compressed_body_len = 1024;
+
+// Replaces the request body with its gzip encoding when that makes it smaller
+static void compress_request_body(CurlHandle *handle) {
+  if (handle->req_body_len < min_compressed_body_len) return;
+
+  z_stream stream = {0};
 
+  // 16 + the max window bits makes zlib write a gzip header instead of a zlib one
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+    ereport(ERROR, errmsg("deflateInit2() failed: %s", stream.msg ? stream.msg : "out of memory"));
+
+  size_t bound      = deflateBound(&stream, handle->req_body_len);
+  char  *compressed = palloc(bound);
+
+  stream.next_in   = (Bytef *)handle->req_body;
+  stream.avail_in  = handle->req_body_len;
+  stream.next_out  = (Bytef *)compressed;
+  stream.avail_out = bound;
+
+  int    ret            = deflate(&stream, Z_FINISH);
+  size_t compressed_len = stream.total_out;
+
+  deflateEnd(&stream);
+
+  if (ret != Z_STREAM_END) ereport(ERROR, errmsg("deflate() failed with code %d", ret));
+
+  if (compressed_len >= handle->req_body_len) {
+    pfree(compressed);
+    return;
+  }
+
+  unshare_request_headers(handle);
+  EREPORT_CURL_SLIST_APPEND(handle->request_headers, "Content-Encoding: gzip");
+
+  pfree(handle->req_body);
+  handle->body_bytes_saved = handle->req_body_len - compressed_len;
+  handle->req_body         = compressed;
+  handle->req_body_len     = compressed_len;
+}
+
+// sets the curl options of a handle whose request fields are already filled
+static void setup_curl_handle(CurlHandle *handle) {
   if (strcasecmp(handle->method, "GET") != 0 && strcasecmp(handle->method, "POST") != 0 &&
       strcasecmp(handle->method, "DELETE") != 0) {
     ereport(ERROR, errmsg("Unsupported request method %s", handle->method));
   }
 
+  handle->body_bytes_saved = 0;
+
+  if (handle->req_body) {
+    handle->req_body_len = strlen(handle->req_body);
+    if (handle->compress_body) compress_request_body(handle);
+  }
+
   if (strcasecmp(handle->method, "GET") == 0) {
     if (handle->req_body) {
       EREPORT_CURL_SETOPT(handle->ez_handle, CURLOPT_POSTFIELDS, handle->req_body);
@@ -96,10 +317,24 @@ void init_curl_handle(CurlHandle *handle, RequestQueueRow row) {
     }
   }
 
+  // a compressed body has NUL bytes, so its size can't be taken with strlen() by curl
+  if (handle->req_body)
+    EREPORT_CURL_SETOPT(handle->ez_handle, CURLOPT_POSTFIELDSIZE_LARGE,
+                        (curl_off_t)handle->req_body_len);
+
+  // an empty string asks for every encoding curl can decode (gzip, br, zstd depending on its build)
+  EREPORT_CURL_SETOPT(handle->ez_handle, CURLOPT_ACCEPT_ENCODING, "");
   EREPORT_CURL_SETOPT(handle->ez_handle, CURLOPT_WRITEFUNCTION, body_cb);
   EREPORT_CURL_SETOPT(handle->ez_handle, CURLOPT_WRITEDATA, handle);
+  // curl passes up to its buffer size at once, a smaller buffer keeps the chunks within their size
+  if (handle->store_response == STORE_RESPONSE_CHUNKED &&
+      guc_response_chunk_size * 1024L < CURL_MAX_WRITE_SIZE)
+    EREPORT_CURL_SETOPT(handle->ez_handle, CURLOPT_BUFFERSIZE, guc_response_chunk_size * 1024L);
   EREPORT_CURL_SETOPT(handle->ez_handle, CURLOPT_HEADER, 0L);
   EREPORT_CURL_SETOPT(handle->ez_handle, CURLOPT_URL, handle->url);
+  if (handle->unix_socket_path)
+    EREPORT_CURL_SETOPT(handle->ez_handle, CURLOPT_UNIX_SOCKET_PATH, handle->unix_socket_path);
+  if (static_resolve) EREPORT_CURL_SETOPT(handle->ez_handle, CURLOPT_RESOLVE, static_resolve);
   EREPORT_CURL_SETOPT(handle->ez_handle, CURLOPT_HTTPHEADER, handle->request_headers);
   EREPORT_CURL_SETOPT(handle->ez_handle, CURLOPT_TIMEOUT_MS, (long)handle->timeout_milliseconds);
   EREPORT_CURL_SETOPT(handle->ez_handle, CURLOPT_PRIVATE, handle);
@@ -112,6 +347,166 @@ void init_curl_handle(CurlHandle *handle, RequestQueueRow row) {
 #endif
 }
 
+void init_curl_handle(CurlHandle *handle, RequestQueueRow row) {
+  handle->id               = row.id;
+  handle->body             = makeStringInfo();
+  handle->ez_handle        = curl_easy_init();
+  handle->request_headers  = NULL;
+  handle->shared_headers   = false;
+  handle->circuit_host     = NULL;
+  handle->rejected_msg     = row.error_msg;
+  handle->cache_key        = NULL;
+  handle->coalesced        = NIL;
+  handle->unix_socket_path = NULL;
+  handle->expired          = row.expired;
+  handle->sent             = false;
+  handle->finished         = false;
+  handle->latency_host     = NULL;
+  handle->hedged           = false;
+  handle->hedge_ez_handle  = NULL;
+  handle->hedge_body       = NULL;
+  handle->group            = NULL;
+  handle->path             = NULL;
+  handle->member           = 0;
+  handle->tried_members    = 0;
+  handle->deadline         = 0;
+  handle->chunks           = 0;
+  handle->paused           = false;
+
+  handle->timeout_milliseconds = row.timeout_milliseconds;
+
+  Endpoint *endpoint = NULL;
+
+  if (!row.endpoint_id.isnull)
+    endpoint = endpoint_lookup(DatumGetInt32(row.endpoint_id.value), row.endpoint_version);
+
+  if (!row.headersBin.isnull) {
+    handle->request_headers = header_list_for(DatumGetJsonbP(row.headersBin.value), endpoint,
+                                              &handle->shared_headers);
+  } else if (endpoint) {
+    handle->request_headers = endpoint->headers;
+    handle->shared_headers  = true;
+  }
+
+  if (endpoint) {
+    char *path = TextDatumGetCString(row.url);
+
+    // the request functions already check the path, rows written some other way mustn't send the
+    // headers of the endpoint to another host
+    if (!is_endpoint_path(path)) {
+      handle->url = pstrdup(endpoint->base_url);
+      if (handle->rejected_msg == NULL)
+        handle->rejected_msg = pstrdup("Request not sent, the path of an endpoint request must be "
+                                       "empty or start with '/' or '?'");
+      pfree(path);
+    } else {
+      handle->url              = psprintf("%s%s", endpoint->base_url, path);
+      handle->unix_socket_path = endpoint->unix_socket_path;
+
+      // the members of a group keep their own health instead of a circuit, the one the request
+      // goes to is picked when it's sent
+      if (endpoint->member_count > 1) {
+        handle->group = endpoint;
+        handle->path  = path;
+      } else {
+        // the endpoint already parsed its host
+        if (guc_circuit_breaker_failures > 0 && endpoint->host)
+          handle->circuit_host = pstrdup(endpoint->host);
+
+        pfree(path);
+      }
+    }
+  } else {
+    handle->url = TextDatumGetCString(row.url);
+  }
+
+  handle->req_body = !row.bodyBin.isnull ? TextDatumGetCString(row.bodyBin.value) : NULL;
+
+  handle->method = TextDatumGetCString(row.method);
+
+  handle->store_response = row.store_response;
+  handle->callback       = row.callback;
+  handle->enqueued_by    = row.enqueued_by;
+  handle->compress_body  = row.compress_body;
+
+  setup_curl_handle(handle);
+}
+
+void init_hedge(CurlHandle *handle, long elapsed_ms) {
+  handle->hedge_ez_handle = curl_easy_duphandle(handle->ez_handle);
+  if (handle->hedge_ez_handle == NULL) ereport(ERROR, errmsg("curl_easy_duphandle()"));
+
+  handle->hedge_body = makeStringInfo();
+
+  // both transfers receive their bodies at the same time
+  EREPORT_CURL_SETOPT(handle->hedge_ez_handle, CURLOPT_WRITEFUNCTION, hedge_body_cb);
+  EREPORT_CURL_SETOPT(handle->hedge_ez_handle, CURLOPT_TIMEOUT_MS,
+                      Max((long)handle->timeout_milliseconds - elapsed_ms, 1L));
+}
+
+void use_hedge(CurlHandle *handle) {
+  CURL      *ez_handle = handle->ez_handle;
+  StringInfo body      = handle->body;
+
+  handle->ez_handle       = handle->hedge_ez_handle;
+  handle->body            = handle->hedge_body;
+  handle->hedge_ez_handle = ez_handle;
+  handle->hedge_body      = body;
+
+  // the duplicate might still be receiving its body
+  EREPORT_CURL_SETOPT(handle->ez_handle, CURLOPT_WRITEFUNCTION, body_cb);
+  EREPORT_CURL_SETOPT(handle->hedge_ez_handle, CURLOPT_WRITEFUNCTION, hedge_body_cb);
+}
+
+void init_curl_handle_from_shared_queue(CurlHandle *handle, SharedQueueEntry *entry) {
+  SharedQueueEntryData data = shared_queue_entry_data(entry);
+
+  handle->id               = entry->id;
+  handle->body             = makeStringInfo();
+  handle->ez_handle        = curl_easy_init();
+  handle->request_headers  = NULL;
+  handle->shared_headers   = false;
+  handle->circuit_host     = NULL;
+  handle->rejected_msg     = NULL;
+  handle->cache_key        = NULL;
+  handle->coalesced        = NIL;
+  handle->unix_socket_path = NULL;
+  handle->expired          = false;
+  handle->sent             = false;
+  handle->finished         = false;
+  handle->latency_host     = NULL;
+  handle->hedged           = false;
+  handle->hedge_ez_handle  = NULL;
+  handle->hedge_body       = NULL;
+  handle->group            = NULL;
+  handle->path             = NULL;
+  handle->member           = 0;
+  handle->tried_members    = 0;
+  handle->deadline         = 0;
+  handle->chunks           = 0;
+  handle->paused           = false;
+
+  handle->timeout_milliseconds = entry->timeout_milliseconds;
+
+  for (uint32 i = 0; i < entry->header_count; i++)
+    EREPORT_CURL_SLIST_APPEND(handle->request_headers, data.headers[i]);
+
+  EREPORT_CURL_SLIST_APPEND(handle->request_headers, "User-Agent: pg_net/" EXTVERSION);
+
+  handle->url      = pstrdup(data.url);
+  handle->req_body = data.body ? pstrdup(data.body) : NULL;
+  handle->method   = pstrdup(data.method);
+
+  handle->store_response = entry->store_response;
+  handle->callback       = entry->callback;
+  handle->enqueued_by    = entry->enqueued_by;
+  handle->compress_body  = entry->compress_body;
+
+  pfree(data.headers);
+
+  setup_curl_handle(handle);
+}
+
 void set_curl_mhandle(WorkerState *wstate) {
   EREPORT_CURL_MULTI_SETOPT(wstate->curl_mhandle, CURLMOPT_SOCKETFUNCTION, multi_socket_cb);
   EREPORT_CURL_MULTI_SETOPT(wstate->curl_mhandle, CURLMOPT_SOCKETDATA, wstate);
@@ -119,58 +514,162 @@ void set_curl_mhandle(WorkerState *wstate) {
   EREPORT_CURL_MULTI_SETOPT(wstate->curl_mhandle, CURLMOPT_TIMERDATA, wstate);
 }
 
-uint64 delete_expired_responses(char *ttl, int batch_size) {
-  if (del_response_plan == NULL) {
-    SPIPlanPtr tmp = SPI_prepare("\
-        WITH\
-        rows AS (\
-          SELECT ctid\
-          FROM net._http_response\
-          WHERE created < now() - $1\
-          ORDER BY created\
-          LIMIT $2\
-        )\
-        DELETE FROM net._http_response r\
-        USING rows WHERE r.ctid = rows.ctid",
-                                 2, (Oid[]){INTERVALOID, INT4OID});
-    if (tmp == NULL)
-      ereport(ERROR, errmsg("SPI_prepare failed: %s", SPI_result_code_string(SPI_result)));
+typedef enum {
+  PARTITION_EMPTY,
+  PARTITION_LIVE,    // has rows younger than the ttl
+  PARTITION_EXPIRED, // all of its rows are older than the ttl
+} PartitionState;
 
-    del_response_plan = SPI_saveplan(tmp);
-    if (del_response_plan == NULL) ereport(ERROR, errmsg("SPI_saveplan failed"));
-  }
+static PartitionState get_partition_state(const char *partition, Datum ttl) {
+  char *query = psprintf("select max(created) < now() - $1 from %s", partition);
 
-  int ret_code = SPI_execute_plan(
-      del_response_plan,
-      (Datum[]){DirectFunctionCall3(interval_in, CStringGetDatum(ttl), ObjectIdGetDatum(InvalidOid),
-                                    Int32GetDatum(-1)),
-                Int32GetDatum(batch_size)},
-      NULL, false, 0);
+  int ret_code =
+      SPI_execute_with_args(query, 1, (Oid[]){INTERVALOID}, (Datum[]){ttl}, NULL, false, 1);
+
+  if (ret_code != SPI_OK_SELECT)
+    ereport(ERROR, errmsg("Error checking the expiry of %s: %s", partition,
+                          SPI_result_code_string(ret_code)));
 
-  uint64 affected_rows = SPI_processed;
+  bool  isnull;
+  Datum expired = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull);
+
+  pfree(query);
+
+  if (isnull) return PARTITION_EMPTY;
+
+  return DatumGetBool(expired) ? PARTITION_EXPIRED : PARTITION_LIVE;
+}
 
-  if (ret_code != SPI_OK_DELETE) {
+static uint64 delete_expired_rows(const char *partition, Datum ttl, int batch_size) {
+  char *query = psprintf("\
+      WITH\
+      rows AS (\
+        SELECT ctid\
+        FROM %s\
+        WHERE created < now() - $1\
+        LIMIT $2\
+      )\
+      DELETE FROM %s r\
+      USING rows WHERE r.ctid = rows.ctid",
+                         partition, partition);
+
+  int ret_code = SPI_execute_with_args(query, 2, (Oid[]){INTERVALOID, INT4OID},
+                                       (Datum[]){ttl, Int32GetDatum(batch_size)}, NULL, false, 0);
+
+  if (ret_code != SPI_OK_DELETE)
     ereport(ERROR,
             errmsg("Error expiring response table rows: %s", SPI_result_code_string(ret_code)));
+
+  pfree(query);
+
+  return SPI_processed;
+}
+
+uint64 delete_expired_responses(char *ttl, Oid response_oid, int batch_size, bool *has_responses) {
+  Datum  ttl_interval = DirectFunctionCall3(interval_in, CStringGetDatum(ttl),
+                                            ObjectIdGetDatum(InvalidOid), Int32GetDatum(-1));
+  uint64 expired      = 0;
+
+  List     *partitions = find_inheritance_children(response_oid, NoLock);
+  ListCell *lc;
+
+  *has_responses = false;
+
+  foreach (lc, partitions) {
+    Oid   partition_oid = lfirst_oid(lc);
+    char *relname       = get_rel_name(partition_oid);
+
+    if (relname == NULL) continue; // dropped concurrently
+
+    char *partition = quote_qualified_identifier("net", relname);
+
+    PartitionState state = get_partition_state(partition, ttl_interval);
+
+    if (state == PARTITION_EMPTY) continue;
+
+    if (state == PARTITION_LIVE) {
+      *has_responses = true;
+      continue;
+    }
+
+    // Don't wait for the readers of the partition, delete a batch of its rows instead, the
+    // partition will be truncated on a next iteration once it's not in use
+    if (!ConditionalLockRelationOid(partition_oid, AccessExclusiveLock)) {
+      uint64 deleted = delete_expired_rows(partition, ttl_interval, batch_size);
+
+      elog(DEBUG1, "Deleted " UINT64_FORMAT " expired rows of %s, it's in use", deleted, partition);
+
+      expired += deleted;
+      *has_responses = true;
+      continue;
+    }
+
+    // check again with a new snapshot, a response could have been committed before getting the lock
+    state = get_partition_state(partition, ttl_interval);
+
+    if (state == PARTITION_EXPIRED) {
+      char *query    = psprintf("truncate %s", partition);
+      int   ret_code = SPI_execute(query, false, 0);
+
+      if (ret_code != SPI_OK_UTILITY)
+        ereport(ERROR, errmsg("Error truncating %s: %s", partition,
+                              SPI_result_code_string(ret_code)));
+
+      elog(DEBUG1, "Truncated %s", partition);
+
+      pfree(query);
+      expired++;
+    } else if (state == PARTITION_LIVE) {
+      *has_responses = true;
+    }
   }
 
-  return affected_rows;
+  list_free(partitions);
+
+  return expired;
 }
 
-uint64 consume_request_queue(const int batch_size) {
+// The batch takes the requests of every role with pending ones in turn, the oldest first, so a role
+// enqueuing a large backlog only delays the others by its share of a batch. A role gets `weight`
+// requests for every one of a role with a weight of 1 and at most `max_in_flight` of them, see
+// net.role_quotas. The roles are found by skipping through the (enqueued_by, id) index.
+uint64 consume_request_queue(const int batch_size, const int max_queue_age) {
   if (del_return_queue_plan == NULL) {
     SPIPlanPtr tmp = SPI_prepare("\
-        WITH\
+        WITH RECURSIVE\
+        roles AS (\
+          (SELECT enqueued_by FROM net.http_request_queue ORDER BY enqueued_by LIMIT 1)\
+          UNION ALL\
+          SELECT (\
+            SELECT q.enqueued_by FROM net.http_request_queue q\
+            WHERE q.enqueued_by > r.enqueued_by\
+            ORDER BY q.enqueued_by LIMIT 1\
+          )\
+          FROM roles r\
+          WHERE r.enqueued_by IS NOT NULL\
+        ),\
         rows AS (\
-          SELECT id\
-          FROM net.http_request_queue\
-          ORDER BY id\
+          SELECT c.id, c.endpoint_id\
+          FROM roles r\
+          LEFT JOIN net.role_quotas l ON l.enqueued_by = r.enqueued_by\
+          CROSS JOIN LATERAL (\
+            SELECT q.id, q.endpoint_id, row_number() OVER (ORDER BY q.id) AS n\
+            FROM net.http_request_queue q\
+            WHERE q.enqueued_by = r.enqueued_by\
+            ORDER BY q.id\
+            LIMIT least($1, coalesce(l.max_in_flight, $1))\
+          ) c\
+          WHERE r.enqueued_by IS NOT NULL\
+          ORDER BY c.n::float8 / coalesce(l.weight, 1), c.id\
           LIMIT $1\
         )\
         DELETE FROM net.http_request_queue q\
-        USING rows WHERE q.id = rows.id\
-        RETURNING q.id, q.method, q.url, timeout_milliseconds, array(select key || ': ' || value from jsonb_each_text(q.headers)), q.body",
-                                 1, (Oid[]){INT4OID});
+        USING rows LEFT JOIN net.endpoints e ON e.id = rows.endpoint_id\
+        WHERE q.id = rows.id\
+        RETURNING q.id, q.method, q.url, coalesce(q.timeout_milliseconds, e.timeout_milliseconds), q.headers, q.body, q.store_response, q.callback, q.enqueued_by, q.compress_body, q.endpoint_id, e.xmin,\
+          coalesce(q.expires_at < now(), false) OR ($2 > 0 AND q.enqueued_at < now() - $2 * interval '1 millisecond'),\
+          q.error_msg",
+                                 2, (Oid[]){INT4OID, INT4OID});
 
     if (tmp == NULL)
       ereport(ERROR, errmsg("SPI_prepare failed: %s", SPI_result_code_string(SPI_result)));
@@ -180,12 +679,92 @@ uint64 consume_request_queue(const int batch_size) {
   }
 
   int ret_code =
-      SPI_execute_plan(del_return_queue_plan, (Datum[]){Int32GetDatum(batch_size)}, NULL, false, 0);
+      SPI_execute_plan(del_return_queue_plan,
+                       (Datum[]){Int32GetDatum(batch_size), Int32GetDatum(max_queue_age)}, NULL,
+                       false, 0);
 
   if (ret_code != SPI_OK_DELETE_RETURNING)
     ereport(ERROR,
             errmsg("Error getting http request queue: %s", SPI_result_code_string(ret_code)));
 
+  for (uint64 i = 0; i < SPI_processed; i++) {
+    bool isnull;
+    bool no_error_msg;
+    Oid  role =
+        DatumGetObjectId(SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 9, &isnull));
+
+    // the dropped requests stopped being counted when they were dropped
+    (void)SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 14, &no_error_msg);
+    if (no_error_msg) queue_depth_dequeued(role);
+  }
+
+  return SPI_processed;
+}
+
+// Fails every request of the queue that won't be sent at once, the expired ones and the ones
+// dropped or cancelled with their error_msg. Their responses are stored with a single insert
+// instead of one per request. The rows locked by net.cancel() are skipped. The (id, enqueued_by,
+// callback, stored, error_msg, expired) of the failed requests are left in SPI_tuptable,
+// `last_seq` gets the seq of the last stored response, or 0 when none was.
+uint64 fail_request_queue(const int max_queue_age, int64 *last_seq) {
+  if (fail_queue_plan == NULL) {
+    SPIPlanPtr tmp = SPI_prepare("\
+        WITH failed AS (\
+          DELETE FROM net.http_request_queue q\
+          WHERE q.id IN (\
+            SELECT id FROM net.http_request_queue\
+            WHERE error_msg IS NOT NULL\
+              OR expires_at < now() OR ($1 > 0 AND enqueued_at < now() - $1 * interval '1 millisecond')\
+            FOR UPDATE SKIP LOCKED\
+          )\
+          RETURNING q.id, q.enqueued_by, q.callback, q.store_response <> 'never' AS stored,\
+            coalesce(q.error_msg, $2) AS error_msg, q.error_msg IS NULL AS expired\
+        ),\
+        responses AS (\
+          INSERT INTO net._http_response(id, timed_out, error_msg)\
+          SELECT id, false, error_msg FROM failed WHERE stored\
+          RETURNING seq\
+        )\
+        SELECT *, (SELECT max(seq) FROM responses) FROM failed",
+                                 2, (Oid[]){INT4OID, TEXTOID});
+
+    if (tmp == NULL)
+      ereport(ERROR, errmsg("SPI_prepare failed: %s", SPI_result_code_string(SPI_result)));
+
+    fail_queue_plan = SPI_saveplan(tmp);
+    if (fail_queue_plan == NULL) ereport(ERROR, errmsg("SPI_saveplan failed"));
+
+    SPI_freeplan(tmp);
+  }
+
+  int ret_code = SPI_execute_plan(
+      fail_queue_plan,
+      (Datum[]){Int32GetDatum(max_queue_age), CStringGetTextDatum(REQUEST_EXPIRED_MSG)}, NULL,
+      false, 0);
+
+  if (ret_code != SPI_OK_SELECT)
+    ereport(ERROR,
+            errmsg("Error failing http request queue: %s", SPI_result_code_string(ret_code)));
+
+  *last_seq = 0;
+
+  for (uint64 i = 0; i < SPI_processed; i++) {
+    bool isnull;
+    Oid  role =
+        DatumGetObjectId(SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 2, &isnull));
+
+    // the dropped and cancelled requests stopped being counted when they were marked
+    if (DatumGetBool(SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 6, &isnull)))
+      queue_depth_dequeued(role);
+  }
+
+  if (SPI_processed > 0) {
+    bool  isnull;
+    Datum seq = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 7, &isnull);
+
+    if (!isnull) *last_seq = DatumGetInt64(seq);
+  }
+
   return SPI_processed;
 }
 
@@ -213,10 +792,76 @@ RequestQueueRow get_request_queue_row(HeapTuple spi_tupval, TupleDesc spi_tupdes
   NullableDatum bodyBin = {.value  = SPI_getbinval(spi_tupval, spi_tupdesc, 6, &tupIsNull),
                            .isnull = tupIsNull};
 
-  return (RequestQueueRow){id, method, url, timeout_milliseconds, headersBin, bodyBin};
+  Datum store_response = SPI_getbinval(spi_tupval, spi_tupdesc, 7, &tupIsNull);
+  EREPORT_NULL_ATTR(tupIsNull, store_response);
+
+  Datum callback = SPI_getbinval(spi_tupval, spi_tupdesc, 8, &tupIsNull);
+  if (tupIsNull) callback = ObjectIdGetDatum(InvalidOid);
+
+  Oid enqueued_by = DatumGetObjectId(SPI_getbinval(spi_tupval, spi_tupdesc, 9, &tupIsNull));
+  EREPORT_NULL_ATTR(tupIsNull, enqueued_by);
+
+  bool compress_body = DatumGetBool(SPI_getbinval(spi_tupval, spi_tupdesc, 10, &tupIsNull));
+  EREPORT_NULL_ATTR(tupIsNull, compress_body);
+
+  NullableDatum endpoint_id = {.value  = SPI_getbinval(spi_tupval, spi_tupdesc, 11, &tupIsNull),
+                               .isnull = tupIsNull};
+
+  TransactionId endpoint_version =
+      DatumGetTransactionId(SPI_getbinval(spi_tupval, spi_tupdesc, 12, &tupIsNull));
+
+  bool expired = DatumGetBool(SPI_getbinval(spi_tupval, spi_tupdesc, 13, &tupIsNull));
+  EREPORT_NULL_ATTR(tupIsNull, expired);
+
+  Datum error_msg = SPI_getbinval(spi_tupval, spi_tupdesc, 14, &tupIsNull);
+
+  return (RequestQueueRow){id,
+                           method,
+                           url,
+                           timeout_milliseconds,
+                           headersBin,
+                           bodyBin,
+                           parse_store_response(TextDatumGetCString(store_response)),
+                           DatumGetObjectId(callback),
+                           enqueued_by,
+                           compress_body,
+                           endpoint_id,
+                           endpoint_version,
+                           expired,
+                           tupIsNull ? NULL : TextDatumGetCString(error_msg)};
+}
+
+StoreResponse parse_store_response(const char *value) {
+  if (strcmp(value, "always") == 0) return STORE_RESPONSE_ALWAYS;
+  if (strcmp(value, "on_error") == 0) return STORE_RESPONSE_ON_ERROR;
+  if (strcmp(value, "never") == 0) return STORE_RESPONSE_NEVER;
+  if (strcmp(value, "chunked") == 0) return STORE_RESPONSE_CHUNKED;
+
+  ereport(ERROR, errmsg("invalid store_response \"%s\"", value),
+          errhint("Valid values are \"always\", \"on_error\", \"never\" and \"chunked\"."));
+}
+
+RequestOutcome get_request_outcome(CurlHandle *handle, CURLcode curl_return_code) {
+  if (curl_return_code != CURLE_OK) return REQUEST_FAILED;
+
+  long status_code = 0;
+  EREPORT_CURL_GETINFO(handle->ez_handle, CURLINFO_RESPONSE_CODE, &status_code);
+
+  return status_code >= 400 ? REQUEST_HTTP_ERROR : REQUEST_SUCCEEDED;
 }
 
-static Jsonb *jsonb_headers_from_curl_handle(CURL *ez_handle) {
+bool should_store_response(CurlHandle *handle, RequestOutcome outcome) {
+  switch (handle->store_response) {
+  case STORE_RESPONSE_ALWAYS:   return true;
+  case STORE_RESPONSE_ON_ERROR: return outcome != REQUEST_SUCCEEDED;
+  case STORE_RESPONSE_NEVER:    return false;
+  case STORE_RESPONSE_CHUNKED:  return true;
+  }
+
+  return true;
+}
+
+Jsonb *jsonb_headers_from_curl_handle(CURL *ez_handle) {
   struct curl_header *header, *prev = NULL;
   PG_JSONB_INIT_STATE(headers);
   (void)PG_JSONB_PUSH(headers, WJB_BEGIN_OBJECT, NULL);
@@ -234,11 +879,11 @@ static Jsonb *jsonb_headers_from_curl_handle(CURL *ez_handle) {
   return PG_JSONB_OBJECT_FINISH(headers);
 }
 
-void insert_response(CurlHandle *handle, CURLcode curl_return_code) {
-  enum { nparams = 7 }; // using an enum because const size_t nparams doesn't compile
-  Datum vals[nparams];
-  char  nulls[nparams];
-  MemSet(nulls, 'n', nparams);
+Response build_response(CurlHandle *handle, CURLcode curl_return_code) {
+  Response response;
+  Datum   *vals  = response.vals;
+  char    *nulls = response.nulls;
+  MemSet(nulls, 'n', response_natts);
 
   vals[0]  = Int64GetDatum(handle->id);
   nulls[0] = ' ';
@@ -269,6 +914,11 @@ void insert_response(CurlHandle *handle, CURLcode curl_return_code) {
 
     vals[5]  = BoolGetDatum(false);
     nulls[5] = ' ';
+  } else if (handle->rejected_msg) {
+    vals[5]  = BoolGetDatum(false);
+    nulls[5] = ' ';
+    vals[6]  = CStringGetTextDatum(handle->rejected_msg);
+    nulls[6] = ' ';
   } else {
     bool timed_out = curl_return_code == CURLE_OPERATION_TIMEDOUT;
 
@@ -291,10 +941,16 @@ void insert_response(CurlHandle *handle, CURLcode curl_return_code) {
     }
   }
 
+  return response;
+}
+
+int64 insert_response(Response *response) {
+  enum { nparams = response_natts };
+
   if (ins_response_plan == NULL) {
     SPIPlanPtr tmp = SPI_prepare(
         "\
-        insert into net._http_response(id, status_code, content, headers, content_type, timed_out, error_msg) values ($1, $2, $3, $4, $5, $6, $7)",
+        insert into net._http_response(id, status_code, content, headers, content_type, timed_out, error_msg) values ($1, $2, $3, $4, $5, $6, $7) returning seq",
         nparams, (Oid[nparams]){INT8OID, INT4OID, TEXTOID, JSONBOID, TEXTOID, BOOLOID, TEXTOID});
 
     if (tmp == NULL)
@@ -306,11 +962,189 @@ void insert_response(CurlHandle *handle, CURLcode curl_return_code) {
     SPI_freeplan(tmp);
   }
 
-  int ret_code = SPI_execute_plan(ins_response_plan, vals, nulls, false, 0);
+  int ret_code = SPI_execute_plan(ins_response_plan, response->vals, response->nulls, false, 0);
 
-  if (ret_code != SPI_OK_INSERT) {
+  if (ret_code != SPI_OK_INSERT_RETURNING) {
     ereport(ERROR, errmsg("Error when inserting response: %s", SPI_result_code_string(ret_code)));
   }
+
+  bool isnull;
+  return DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+}
+
+void write_response_chunk(CurlHandle *handle) {
+  if (ins_chunk_plan == NULL) {
+    SPIPlanPtr tmp = SPI_prepare("\
+        insert into net._http_response_chunks(id, seq, chunk) values ($1, $2, $3)",
+                                 3, (Oid[]){INT8OID, INT4OID, BYTEAOID});
+
+    if (tmp == NULL)
+      ereport(ERROR, errmsg("SPI_prepare failed: %s", SPI_result_code_string(SPI_result)));
+
+    ins_chunk_plan = SPI_saveplan(tmp);
+    if (ins_chunk_plan == NULL) ereport(ERROR, errmsg("SPI_saveplan failed"));
+
+    SPI_freeplan(tmp);
+  }
+
+  // bytea has the layout of text, the chunks can split a character
+  bytea *chunk = (bytea *)cstring_to_text_with_len(handle->body->data, handle->body->len);
+
+  Datum values[] = {Int64GetDatum(handle->id), Int32GetDatum(handle->chunks),
+                    PointerGetDatum(chunk)};
+  int   ret_code = SPI_execute_plan(ins_chunk_plan, values, NULL, false, 0);
+
+  if (ret_code != SPI_OK_INSERT)
+    ereport(ERROR, errmsg("Error when inserting a response chunk: %s",
+                          SPI_result_code_string(ret_code)));
+
+  pfree(chunk);
+  resetStringInfo(handle->body);
+  handle->chunks++;
+}
+
+void end_response_chunks(CurlHandle *handle, CURLcode curl_return_code) {
+  if (curl_return_code == CURLE_OK) {
+    if (handle->body->len > 0) write_response_chunk(handle);
+    return;
+  }
+
+  if (handle->chunks == 0) return;
+
+  if (del_chunks_plan == NULL) {
+    SPIPlanPtr tmp = SPI_prepare("\
+        delete from net._http_response_chunks where id = $1",
+                                 1, (Oid[]){INT8OID});
+
+    if (tmp == NULL)
+      ereport(ERROR, errmsg("SPI_prepare failed: %s", SPI_result_code_string(SPI_result)));
+
+    del_chunks_plan = SPI_saveplan(tmp);
+    if (del_chunks_plan == NULL) ereport(ERROR, errmsg("SPI_saveplan failed"));
+
+    SPI_freeplan(tmp);
+  }
+
+  int ret_code =
+      SPI_execute_plan(del_chunks_plan, (Datum[]){Int64GetDatum(handle->id)}, NULL, false, 0);
+
+  if (ret_code != SPI_OK_DELETE)
+    ereport(ERROR, errmsg("Error when deleting response chunks: %s",
+                          SPI_result_code_string(ret_code)));
+
+  handle->chunks = 0;
+}
+
+static Oid completion_type_oid(void) {
+  return DatumGetObjectId(DirectFunctionCall1(regtypein, CStringGetDatum("net.http_completion")));
+}
+
+void validate_completion_callback(Oid callback) {
+  Oid *argtypes;
+  int  nargs;
+
+  get_func_signature(callback, &argtypes, &nargs);
+
+  if (get_func_prokind(callback) != PROKIND_FUNCTION || get_func_retset(callback) || nargs != 1 ||
+      argtypes[0] != get_array_type(completion_type_oid()))
+    ereport(ERROR, errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+            errmsg("callback %s must be a function that takes a net.http_completion[]",
+                   format_procedure(callback)));
+
+  if (PG_PROC_ACLCHECK(callback, GetUserId(), ACL_EXECUTE) != ACLCHECK_OK)
+    aclcheck_error(ACLCHECK_NO_PRIV, OBJECT_FUNCTION, get_func_name(callback));
+}
+
+// Runs the callback as `role` in a subtransaction, an error is reported as a warning
+static void call_completion_callback(Oid callback, Oid role, Datum completions) {
+  MemoryContext old_context = CurrentMemoryContext;
+  ResourceOwner old_owner   = CurrentResourceOwner;
+
+  BeginInternalSubTransaction(NULL);
+  MemoryContextSwitchTo(old_context);
+
+  PG_TRY();
+  {
+    // the privilege could have been revoked since the request was enqueued
+    if (PG_PROC_ACLCHECK(callback, role, ACL_EXECUTE) != ACLCHECK_OK)
+      ereport(ERROR, errmsg("permission denied for function %s", format_procedure(callback)));
+
+    Oid save_userid;
+    int save_sec_context;
+
+    GetUserIdAndSecContext(&save_userid, &save_sec_context);
+    SetUserIdAndSecContext(role, save_sec_context | SECURITY_LOCAL_USERID_CHANGE |
+                                     SECURITY_RESTRICTED_OPERATION);
+
+    FmgrInfo flinfo;
+    LOCAL_FCINFO(fcinfo, 1);
+
+    fmgr_info(callback, &flinfo);
+    InitFunctionCallInfoData(*fcinfo, &flinfo, 1, InvalidOid, NULL, NULL);
+    fcinfo->args[0].value  = completions;
+    fcinfo->args[0].isnull = false;
+
+    (void)FunctionCallInvoke(fcinfo); // the result is ignored, it's usually void
+
+    SetUserIdAndSecContext(save_userid, save_sec_context);
+
+    ReleaseCurrentSubTransaction();
+    MemoryContextSwitchTo(old_context);
+    CurrentResourceOwner = old_owner;
+  }
+  PG_CATCH();
+  {
+    MemoryContextSwitchTo(old_context);
+    ErrorData *edata = CopyErrorData();
+    FlushErrorState();
+
+    // also restores the user id
+    RollbackAndReleaseCurrentSubTransaction();
+    MemoryContextSwitchTo(old_context);
+    CurrentResourceOwner = old_owner;
+
+    ereport(WARNING, errmsg("pg_net completion callback %s failed: %s", format_procedure(callback),
+                            edata->message));
+    FreeErrorData(edata);
+  }
+  PG_END_TRY();
+}
+
+void run_completion_callbacks(List *completions) {
+  Oid       completion_type = completion_type_oid();
+  TupleDesc tupdesc         = lookup_rowtype_tupdesc_copy(completion_type, -1);
+  List     *pending         = completions;
+
+  while (pending != NIL) {
+    Completion *first  = linitial(pending);
+    List       *rest   = NIL;
+    Datum      *elems  = palloc(sizeof(Datum) * list_length(pending));
+    int         nelems = 0;
+    ListCell   *lc;
+
+    foreach (lc, pending) {
+      Completion *c = lfirst(lc);
+
+      if (c->callback != first->callback || c->role != first->role) {
+        rest = lappend(rest, c);
+        continue;
+      }
+
+      bool isnull[response_natts];
+      for (int i = 0; i < response_natts; i++)
+        isnull[i] = c->response.nulls[i] == 'n';
+
+      elems[nelems++] = HeapTupleGetDatum(heap_form_tuple(tupdesc, c->response.vals, isnull));
+    }
+
+    ArrayType *array = construct_array(elems, nelems, completion_type, -1, false, 'd');
+
+    elog(DEBUG1, "Calling %s with %d completions", format_procedure(first->callback), nelems);
+
+    call_completion_callback(first->callback, first->role, PointerGetDatum(array));
+
+    pending = rest;
+  }
 }
 
 void pfree_handle(CurlHandle *handle) {
@@ -319,8 +1153,15 @@ void pfree_handle(CurlHandle *handle) {
   if (handle->req_body) pfree(handle->req_body);
 
   if (handle->body) destroyStringInfo(handle->body);
-
-  if (handle->request_headers) // curl_slist_free_all already handles the NULL
-                               // case, but be explicit about it
+  if (handle->hedge_body) destroyStringInfo(handle->hedge_body);
+  if (handle->latency_host) pfree(handle->latency_host);
+  if (handle->circuit_host) pfree(handle->circuit_host);
+  if (handle->rejected_msg) pfree(handle->rejected_msg);
+  if (handle->cache_key) pfree(handle->cache_key);
+  if (handle->path) pfree(handle->path);
+  list_free(handle->coalesced);
+
+  // shared lists are freed by free_shared_header_lists()
+  if (handle->request_headers && !handle->shared_headers)
     curl_slist_free_all(handle->request_headers);
 }
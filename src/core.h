@@ -7,6 +7,41 @@ typedef enum {
   WS_EXITED,
 } WorkerStatus;
 
+// Which responses get stored in net._http_response
+typedef enum {
+  STORE_RESPONSE_ALWAYS,
+  STORE_RESPONSE_ON_ERROR, // only failed requests and http status codes >= 400
+  STORE_RESPONSE_NEVER,
+  STORE_RESPONSE_CHUNKED, // always, its body goes to net._http_response_chunks as it arrives
+} StoreResponse;
+
+typedef enum {
+  REQUEST_SUCCEEDED,  // got an http status code < 400
+  REQUEST_HTTP_ERROR, // got an http status code >= 400
+  REQUEST_FAILED,     // didn't get a response, e.g. a timeout or a connection error
+} RequestOutcome;
+
+// counters of the completed requests since the server started, and the batch size in use
+typedef struct {
+  pg_atomic_uint64 requests_succeeded;
+  pg_atomic_uint64 requests_http_error;
+  pg_atomic_uint64 requests_failed;
+  pg_atomic_uint64 responses_skipped;    // not stored because of `store_response`
+  pg_atomic_uint64 bodies_compressed;    // request bodies sent gzipped because of `compress_body`
+  pg_atomic_uint64 body_bytes_saved;     // bytes not sent thanks to the compressed bodies
+  pg_atomic_uint64 event_syscalls;       // made by the event backend while running requests
+  pg_atomic_uint64 event_wakeups;        // returns from waiting on the sockets and the timer
+  pg_atomic_uint32 batch_size;           // in use, it changes with pg_net.adaptive_batch_size
+  pg_atomic_uint64 requests_coalesced;   // that got the response of an identical request
+  pg_atomic_uint64 cache_hits;           // requests that got a response from the cache
+  pg_atomic_uint64 requests_expired;     // not sent because they waited too long in the queue
+  pg_atomic_uint64 requests_cancelled;   // with net.cancel() while the worker was sending them
+  pg_atomic_uint64 requests_hedged;      // sent a second time because the first one was slow
+  pg_atomic_uint64 hedges_won;           // hedges that got the response first
+  pg_atomic_uint64 requests_failed_over; // sent to another member of their endpoint
+  pg_atomic_uint64 config_loads;         // by the worker, when it starts and on a reload
+} WorkerStats;
+
 // the state of the background worker
 typedef struct {
   pg_atomic_uint32  got_restart;
@@ -16,6 +51,7 @@ typedef struct {
   ConditionVariable cv; // required to publish the state of the worker to other backends
   int               epfd;
   CURLM            *curl_mhandle;
+  WorkerStats       stats;
 } WorkerState;
 
 // A row coming from the http_request_queue
@@ -26,6 +62,14 @@ typedef struct {
   int32         timeout_milliseconds;
   NullableDatum headersBin;
   NullableDatum bodyBin;
+  StoreResponse store_response;
+  Oid           callback; // InvalidOid when there's none
+  Oid           enqueued_by;
+  bool          compress_body;
+  NullableDatum endpoint_id;      // when not null, `url` is the path of the request on it
+  TransactionId endpoint_version; // xmin of the endpoint row
+  bool          expired;          // it waited past its expires_at or pg_net.max_queue_age
+  char         *error_msg;        // why it was dropped from the queue, NULL when it wasn't
 } RequestQueueRow;
 
 // The curl easy handle plus additional data, this acts for both the request and
@@ -34,25 +78,128 @@ typedef struct {
   int64              id;
   StringInfo         body;
   struct curl_slist *request_headers;
+  bool               shared_headers; // request_headers is shared with other handles of the batch
   int32              timeout_milliseconds;
   char              *url;
   char              *req_body;
+  size_t             req_body_len;
   char              *method;
   CURL              *ez_handle;
+  StoreResponse      store_response;
+  Oid                callback; // InvalidOid when there's none
+  Oid                enqueued_by;
+  bool               compress_body;
+  size_t             body_bytes_saved; // by gzipping the request body, 0 when it wasn't
+  char              *circuit_host;     // the circuit breaker key, NULL when it's not tracked
+  char              *rejected_msg;     // why the request wasn't sent, NULL when it was
+  char              *cache_key;        // for coalescing and caching, NULL when it can't be
+  List              *coalesced;        // identical requests that get the response of this one
+  const char        *unix_socket_path; // of its endpoint, NULL when it goes through TCP
+  bool               expired;          // it's completed with an error instead of being sent
+  bool               sent;             // its transfer is in the multi handle
+  bool               finished;         // its response was stored or passed to its callback
+  TimestampTz        sent_at;          // when its transfer was added to the multi handle
+  char              *latency_host;     // the host its latency is kept for, NULL when it isn't
+  bool               hedged;           // it was considered for a hedge, it's not hedged twice
+  CURL              *hedge_ez_handle;  // the duplicate of a slow transfer, NULL when there's none
+  StringInfo         hedge_body;       // the body the duplicate received
+  struct Endpoint   *group;            // its endpoint when it has members, NULL otherwise
+  char              *path;             // appended to the base url of the member it's sent to
+  int                member;           // of `group` its transfer goes to
+  uint64             tried_members;    // bitmask of the members of `group` it was sent to
+  TimestampTz        deadline;         // a member it fails over to gets what's left until then
+  int32              chunks;           // of its body written to net._http_response_chunks
+  bool               paused;           // its body fills a chunk, which has to be written first
 } CurlHandle;
 
-uint64 delete_expired_responses(char *ttl, int batch_size);
+enum { response_natts = 7 };
+
+// The columns of a response, in the order of net._http_response(id, status_code, content, headers,
+// content_type, timed_out, error_msg) and of the net.http_completion type
+typedef struct {
+  Datum vals[response_natts];
+  char  nulls[response_natts]; // 'n' for null, like SPI does
+} Response;
+
+// A response waiting for its callback to run, as the role that enqueued the request
+typedef struct {
+  Oid      callback;
+  Oid      role;
+  Response response;
+} Completion;
+
+// Truncates the partitions of net._http_response whose rows are all older than the ttl, partitions
+// that are in use get a batch of their rows deleted instead. Returns the number of truncated
+// partitions plus the number of deleted rows, `has_responses` tells if any rows are left.
+uint64 delete_expired_responses(char *ttl, Oid response_oid, int batch_size, bool *has_responses);
+
+uint64 consume_request_queue(const int batch_size, const int max_queue_age);
 
-uint64 consume_request_queue(const int batch_size);
+#define REQUEST_EXPIRED_MSG "Request expired before being sent"
+
+uint64 fail_request_queue(const int max_queue_age, int64 *last_seq);
 
 RequestQueueRow get_request_queue_row(HeapTuple spi_tupval, TupleDesc spi_tupdesc);
 
 void set_curl_mhandle(WorkerState *wstate);
 
-void insert_response(CurlHandle *handle, CURLcode curl_return_code);
+StoreResponse parse_store_response(const char *value);
+
+RequestOutcome get_request_outcome(CurlHandle *handle, CURLcode curl_return_code);
+
+bool should_store_response(CurlHandle *handle, RequestOutcome outcome);
+
+Response build_response(CurlHandle *handle, CURLcode curl_return_code);
+
+// returns the seq of the stored response
+int64 insert_response(Response *response);
+
+// Writes the body the handle received so far as the next chunk of its response, and empties it
+void write_response_chunk(CurlHandle *handle);
+
+// Writes the rest of the body of a request with chunked storage once it completes. The chunks of a
+// request that failed are deleted instead, a part of a body is of no use.
+void end_response_chunks(CurlHandle *handle, CURLcode curl_return_code);
+
+// Errors unless the callback is a function that takes a net.http_completion[] and the current user
+// can execute it
+void validate_completion_callback(Oid callback);
+
+// Calls each callback once with all of its completions, a failing callback doesn't prevent the
+// others from running
+void run_completion_callbacks(List *completions);
+
+// The headers of the response the handle received, as a jsonb object
+Jsonb *jsonb_headers_from_curl_handle(CURL *ez_handle);
 
 void init_curl_handle(CurlHandle *handle, RequestQueueRow row);
 
+extern char *guc_resolve;
+extern int   guc_response_chunk_size;
+
+bool check_resolve(char **newval, void **extra, GucSource source);
+
+// Makes the handles use the pg_net.resolve addresses instead of resolving their hosts. It's called
+// when the worker starts and after it reloads its config.
+void load_static_resolve(void);
+
+// Gives the handle its own copy of the request headers, to append to them
+void unshare_request_headers(CurlHandle *handle);
+
+// Frees the header lists init_curl_handle() shared, after the handles using them are cleaned up
+void free_shared_header_lists(void);
+
+// Duplicates the transfer of the handle into its hedge_ez_handle, with the rest of the timeout of
+// the request
+void init_hedge(CurlHandle *handle, long elapsed_ms);
+
+// Makes the duplicate the transfer of the handle, the original one goes in its place
+void use_hedge(CurlHandle *handle);
+
+struct SharedQueueEntry;
+
+void init_curl_handle_from_shared_queue(CurlHandle *handle, struct SharedQueueEntry *entry);
+
 void pfree_handle(CurlHandle *handle);
 
 #endif
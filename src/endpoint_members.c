@@ -0,0 +1,264 @@
+#include "pg_prelude.h"
+
+#include "curl_prelude.h"
+
+#include "circuit_breaker.h"
+#include "endpoints.h"
+#include "endpoint_members.h"
+
+typedef struct {
+  int32 endpoint_id;
+  int32 member; // 0 for the base_url, i for member_urls[i]
+} MemberKey;
+
+// The load and health of a member of an endpoint, the worker updates them as it sends requests
+typedef struct {
+  MemberKey   key; // hash key
+  int32       outstanding;
+  int32       consecutive_failures;
+  int64       requests;   // transfers that ended
+  int64       failures;   // connection failures and timeouts
+  double      latency_ms; // moving average over the responses, below 0 until the first one
+  TimestampTz down_until; // it's out of the rotation until then, 0 when it's healthy
+} MemberState;
+
+static const char *endpoint_members_tranche = "pg_net endpoint members";
+// members beyond this aren't tracked, they're picked as healthy members with nothing in flight
+static const long max_members = 1024;
+// how long a member is out of the rotation after its first failure in a row
+static const long member_down_ms = 1000;
+// the weight of the latest response in the latency of a member
+static const double latency_weight = 0.2;
+
+static LWLock *members_lock = NULL;
+static HTAB   *members      = NULL;
+
+Size endpoint_members_shmem_size(void) {
+  return hash_estimate_size(max_members, sizeof(MemberState));
+}
+
+void endpoint_members_shmem_request(void) {
+  RequestAddinShmemSpace(endpoint_members_shmem_size());
+  RequestNamedLWLockTranche(endpoint_members_tranche, 1);
+}
+
+// must be called while holding the AddinShmemInitLock
+void endpoint_members_shmem_startup(void) {
+  HASHCTL info = {
+    .keysize   = sizeof(MemberKey),
+    .entrysize = sizeof(MemberState),
+  };
+
+  members_lock = &(GetNamedLWLockTranche(endpoint_members_tranche))->lock;
+  members      = ShmemInitHash("pg_net endpoint members", max_members, max_members, &info,
+                               HASH_ELEM | HASH_BLOBS);
+}
+
+int endpoint_member_pick(Endpoint *endpoint, uint64 tried) {
+  TimestampTz now = GetCurrentTimestamp();
+  int32       outstanding[max_endpoint_members];
+  double      latency_ms[max_endpoint_members];
+  TimestampTz down_until[max_endpoint_members];
+
+  LWLockAcquire(members_lock, LW_SHARED);
+
+  for (int i = 0; i < endpoint->member_count; i++) {
+    MemberKey    key   = {.endpoint_id = endpoint->id, .member = i};
+    MemberState *state = hash_search(members, &key, HASH_FIND, NULL);
+
+    outstanding[i] = state ? state->outstanding : 0;
+    latency_ms[i]  = state ? state->latency_ms : -1;
+    down_until[i]  = state ? state->down_until : 0;
+  }
+
+  LWLockRelease(members_lock);
+
+  int  picked      = -1;
+  bool any_healthy = false;
+
+  for (int i = 0; i < endpoint->member_count; i++) {
+    if (tried & (UINT64CONST(1) << i)) continue;
+
+    any_healthy |= down_until[i] <= now;
+
+    if (picked < 0 || down_until[i] < down_until[picked]) picked = i;
+  }
+
+  if (!any_healthy) return picked;
+
+  picked = -1;
+
+  switch (endpoint->balance) {
+  case BALANCE_LEAST_OUTSTANDING: {
+    for (int n = 0; n < endpoint->member_count; n++) {
+      int i = (endpoint->next_member + n) % endpoint->member_count;
+
+      if ((tried & (UINT64CONST(1) << i)) || down_until[i] > now) continue;
+
+      if (picked < 0 || outstanding[i] < outstanding[picked]) picked = i;
+    }
+
+    endpoint->next_member = (picked + 1) % endpoint->member_count;
+    break;
+  }
+  case BALANCE_LATENCY_WEIGHTED: {
+    // smooth weighted round robin, a member without a response yet counts as the fastest one
+    double total = 0;
+
+    for (int i = 0; i < endpoint->member_count; i++) {
+      if ((tried & (UINT64CONST(1) << i)) || down_until[i] > now) continue;
+
+      double weight = 1.0 / (Max(latency_ms[i], 0) + 1);
+
+      endpoint->credits[i] += weight;
+      total += weight;
+
+      if (picked < 0 || endpoint->credits[i] > endpoint->credits[picked]) picked = i;
+    }
+
+    endpoint->credits[picked] -= total;
+    break;
+  }
+  }
+
+  return picked;
+}
+
+void endpoint_member_started(int32 endpoint_id, int member) {
+  MemberKey key = {.endpoint_id = endpoint_id, .member = member};
+  bool      found;
+
+  LWLockAcquire(members_lock, LW_EXCLUSIVE);
+
+  MemberState *state = hash_search(members, &key, HASH_ENTER_NULL, &found);
+
+  if (state && !found) {
+    state->outstanding          = 0;
+    state->consecutive_failures = 0;
+    state->requests             = 0;
+    state->failures             = 0;
+    state->latency_ms           = -1;
+    state->down_until           = 0;
+  }
+
+  if (state) state->outstanding++;
+
+  LWLockRelease(members_lock);
+}
+
+void endpoint_member_finished(int32 endpoint_id, int member, CURLcode curl_return_code,
+                              long latency_ms) {
+  MemberKey key = {.endpoint_id = endpoint_id, .member = member};
+
+  LWLockAcquire(members_lock, LW_EXCLUSIVE);
+
+  MemberState *state = hash_search(members, &key, HASH_FIND, NULL);
+
+  if (state == NULL) { // too many members, this one isn't tracked
+    LWLockRelease(members_lock);
+    return;
+  }
+
+  state->outstanding = Max(state->outstanding - 1, 0);
+
+  if (latency_ms >= 0) {
+    state->requests++;
+
+    if (is_connection_failure(curl_return_code)) {
+      long down_ms = Min(member_down_ms << Min(state->consecutive_failures, 16),
+                         (long)guc_circuit_breaker_cooldown);
+
+      state->failures++;
+      state->consecutive_failures++;
+      state->down_until = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), down_ms);
+    } else {
+      state->consecutive_failures = 0;
+      state->down_until           = 0;
+
+      if (state->latency_ms < 0)
+        state->latency_ms = latency_ms;
+      else
+        state->latency_ms += latency_weight * (latency_ms - state->latency_ms);
+    }
+  }
+
+  LWLockRelease(members_lock);
+}
+
+void endpoint_members_reset(int32 endpoint_id) {
+  HASH_SEQ_STATUS status;
+  MemberState    *state;
+
+  LWLockAcquire(members_lock, LW_EXCLUSIVE);
+
+  hash_seq_init(&status, members);
+  while ((state = hash_seq_search(&status)))
+    if (state->key.endpoint_id == endpoint_id) hash_search(members, &state->key, HASH_REMOVE, NULL);
+
+  LWLockRelease(members_lock);
+}
+
+void endpoint_members_clear_outstanding(void) {
+  HASH_SEQ_STATUS status;
+  MemberState    *state;
+
+  LWLockAcquire(members_lock, LW_EXCLUSIVE);
+
+  hash_seq_init(&status, members);
+  while ((state = hash_seq_search(&status)))
+    state->outstanding = 0;
+
+  LWLockRelease(members_lock);
+}
+
+PG_FUNCTION_INFO_V1(endpoint_members);
+Datum endpoint_members(PG_FUNCTION_ARGS) {
+  ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+  TupleDesc      tupdesc;
+
+  if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) ||
+      !(rsinfo->allowedModes & SFRM_Materialize))
+    ereport(ERROR, errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+            errmsg("set-valued function called in context that cannot accept a set"));
+
+  if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+    ereport(ERROR, errmsg("return type must be a row type"));
+
+  MemoryContext old = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+  Tuplestorestate *store = tuplestore_begin_heap(true, false, work_mem);
+
+  rsinfo->returnMode = SFRM_Materialize;
+  rsinfo->setResult  = store;
+  rsinfo->setDesc    = CreateTupleDescCopy(tupdesc);
+
+  MemoryContextSwitchTo(old);
+
+  TimestampTz     now = GetCurrentTimestamp();
+  HASH_SEQ_STATUS status;
+  MemberState    *state;
+
+  LWLockAcquire(members_lock, LW_SHARED);
+
+  hash_seq_init(&status, members);
+  while ((state = hash_seq_search(&status))) {
+    Datum values[] = {
+      Int32GetDatum(state->key.endpoint_id),
+      Int32GetDatum(state->key.member),
+      Int32GetDatum(state->outstanding),
+      Int64GetDatum(state->requests),
+      Int64GetDatum(state->failures),
+      Int32GetDatum(state->consecutive_failures),
+      Float8GetDatum(state->latency_ms),
+      TimestampTzGetDatum(state->down_until),
+    };
+    bool nulls[lengthof(values)] = {false, false, false, false, false, false,
+                                    state->latency_ms < 0, state->down_until <= now};
+
+    tuplestore_putvalues(store, rsinfo->setDesc, values, nulls);
+  }
+
+  LWLockRelease(members_lock);
+
+  return (Datum)0;
+}
@@ -0,0 +1,32 @@
+#ifndef ENDPOINT_MEMBERS_H
+#define ENDPOINT_MEMBERS_H
+
+Size endpoint_members_shmem_size(void);
+
+void endpoint_members_shmem_request(void);
+
+void endpoint_members_shmem_startup(void);
+
+// The member of the endpoint a request goes to, picked with the balance policy of the endpoint
+// among the members that aren't in `tried`, a bitmask of member indexes. A member that failed
+// recently is only picked when every other one did too, the one that's back first then. Returns -1
+// when every member was tried.
+int endpoint_member_pick(Endpoint *endpoint, uint64 tried);
+
+// Counts a transfer to the member that started
+void endpoint_member_started(int32 endpoint_id, int member);
+
+// Counts a transfer to the member that ended. Connection failures and timeouts take the member out
+// of the rotation for a while, which doubles with each failure in a row up to
+// pg_net.circuit_breaker_cooldown. Anything else puts it back. A cancelled transfer, with a
+// `latency_ms` below 0, only stops being in flight.
+void endpoint_member_finished(int32 endpoint_id, int member, CURLcode curl_return_code,
+                              long latency_ms);
+
+// Forgets the members of the endpoint, its row changed
+void endpoint_members_reset(int32 endpoint_id);
+
+// Forgets the transfers in flight, the ones of a worker that exited never end
+void endpoint_members_clear_outstanding(void);
+
+#endif
@@ -0,0 +1,155 @@
+#include "pg_prelude.h"
+
+#include "curl_prelude.h"
+
+#include "circuit_breaker.h"
+#include "endpoints.h"
+#include "endpoint_members.h"
+#include "errors.h"
+#include "util.h"
+
+static SPIPlanPtr    sel_endpoint_plan = NULL;
+static MemoryContext endpoints_context = NULL;
+static HTAB         *endpoints         = NULL;
+
+// the length of the header name of a "name: value" line
+static size_t header_name_len(const char *line) {
+  const char *colon = strchr(line, ':');
+
+  return colon ? (size_t)(colon - line) : strlen(line);
+}
+
+static bool has_header_named(struct curl_slist *headers, const char *name, size_t name_len) {
+  for (struct curl_slist *h = headers; h; h = h->next)
+    if (header_name_len(h->data) == name_len && pg_strncasecmp(h->data, name, name_len) == 0)
+      return true;
+
+  return false;
+}
+
+static void load_endpoint(Endpoint *endpoint) {
+  if (sel_endpoint_plan == NULL) {
+    SPIPlanPtr tmp = SPI_prepare("\
+        select base_url, headers, unix_socket_path, member_urls, balance\
+        from net.endpoints\
+        where id = $1",
+                                 1, (Oid[]){INT4OID});
+
+    if (tmp == NULL)
+      ereport(ERROR, errmsg("SPI_prepare failed: %s", SPI_result_code_string(SPI_result)));
+
+    sel_endpoint_plan = SPI_saveplan(tmp);
+    if (sel_endpoint_plan == NULL) ereport(ERROR, errmsg("SPI_saveplan failed"));
+
+    SPI_freeplan(tmp);
+  }
+
+  int ret_code =
+      SPI_execute_plan(sel_endpoint_plan, (Datum[]){Int32GetDatum(endpoint->id)}, NULL, true, 1);
+
+  if (ret_code != SPI_OK_SELECT)
+    ereport(ERROR, errmsg("Error getting endpoint %d: %s", endpoint->id,
+                          SPI_result_code_string(ret_code)));
+
+  // the queue references the endpoints, so a dequeued request has one
+  if (SPI_processed == 0) ereport(ERROR, errmsg("endpoint %d doesn't exist", endpoint->id));
+
+  bool  isnull, socket_isnull;
+  Datum base_url = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull);
+  Datum headers  = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2, &isnull);
+  Datum socket   = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 3, &socket_isnull);
+  Datum members  = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 4, &isnull);
+  Datum balance  = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 5, &isnull);
+
+  // the table checks it has no nulls
+  Datum *member_urls;
+  int    member_url_count;
+  deconstruct_array(DatumGetArrayTypeP(members), TEXTOID, -1, false, 'i', &member_urls, NULL,
+                    &member_url_count);
+
+  MemoryContext old = MemoryContextSwitchTo(endpoints_context);
+
+  endpoint->base_url         = TextDatumGetCString(base_url);
+  endpoint->unix_socket_path = socket_isnull ? NULL : TextDatumGetCString(socket);
+
+  // the sockets are local servers, a failing one doesn't say anything about its host name over TCP.
+  // Their paths are far shorter than a circuit breaker key.
+  endpoint->host = endpoint->unix_socket_path ? psprintf("unix:%s", endpoint->unix_socket_path)
+                                              : circuit_host_of(endpoint->base_url);
+  endpoint->headers  = jsonb_headers_to_slist(DatumGetJsonbP(headers), NULL);
+  EREPORT_CURL_SLIST_APPEND(endpoint->headers, "User-Agent: pg_net/" EXTVERSION);
+
+  endpoint->member_count   = member_url_count + 1;
+  endpoint->member_urls    = palloc(endpoint->member_count * sizeof(char *));
+  endpoint->member_urls[0] = endpoint->base_url;
+  for (int i = 0; i < member_url_count; i++)
+    endpoint->member_urls[i + 1] = TextDatumGetCString(member_urls[i]);
+
+  endpoint->credits     = palloc0(endpoint->member_count * sizeof(double));
+  endpoint->next_member = 0;
+
+  MemoryContextSwitchTo(old);
+
+  char *balance_name = TextDatumGetCString(balance);
+
+  endpoint->balance = strcmp(balance_name, "latency_weighted") == 0 ? BALANCE_LATENCY_WEIGHTED
+                                                                    : BALANCE_LEAST_OUTSTANDING;
+
+  pfree(balance_name);
+  pfree(member_urls);
+
+  SPI_freetuptable(SPI_tuptable);
+}
+
+Endpoint *endpoint_lookup(int32 id, TransactionId version) {
+  if (endpoints == NULL) {
+    endpoints_context =
+        AllocSetContextCreate(TopMemoryContext, "pg_net endpoints", ALLOCSET_SMALL_SIZES);
+
+    HASHCTL info = {
+      .keysize   = sizeof(int32),
+      .entrysize = sizeof(Endpoint),
+      .hcxt      = endpoints_context,
+    };
+
+    endpoints = hash_create("pg_net endpoints", 16, &info, HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+  }
+
+  bool      found;
+  Endpoint *endpoint = hash_search(endpoints, &id, HASH_ENTER, &found);
+
+  if (found && endpoint->version == version) return endpoint;
+
+  // the row changed since it was loaded
+  if (found) {
+    for (int i = 1; i < endpoint->member_count; i++)
+      pfree(endpoint->member_urls[i]);
+
+    pfree(endpoint->member_urls);
+    pfree(endpoint->credits);
+    pfree(endpoint->base_url);
+    if (endpoint->host) pfree(endpoint->host);
+    if (endpoint->unix_socket_path) pfree(endpoint->unix_socket_path);
+    curl_slist_free_all(endpoint->headers);
+  }
+
+  // the members might be other hosts now, or the id another endpoint's since the worker restarted
+  endpoint_members_reset(id);
+
+  load_endpoint(endpoint);
+
+  endpoint->version = version;
+
+  return endpoint;
+}
+
+struct curl_slist *endpoint_request_headers(Endpoint *endpoint, Jsonb *headers) {
+  struct curl_slist *list = jsonb_headers_to_slist(headers, NULL);
+  struct curl_slist *own  = list;
+
+  for (struct curl_slist *h = endpoint->headers; h; h = h->next)
+    if (!has_header_named(own, h->data, header_name_len(h->data)))
+      EREPORT_CURL_SLIST_APPEND(list, h->data);
+
+  return list;
+}
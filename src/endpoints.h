@@ -0,0 +1,36 @@
+#ifndef ENDPOINTS_H
+#define ENDPOINTS_H
+
+// The members of an endpoint a request can go to, base_url and its member_urls
+enum { max_endpoint_members = 64 };
+
+// How the member a request goes to is picked, the `balance` of an endpoint with member_urls
+typedef enum {
+  BALANCE_LEAST_OUTSTANDING, // the member with the fewest transfers in flight, ties go in turn
+  BALANCE_LATENCY_WEIGHTED,  // the members in turn, as often as the inverse of their latency
+} BalancePolicy;
+
+// A net.endpoints row, as the worker keeps it between batches
+typedef struct Endpoint {
+  int32              id;               // the hash table key
+  TransactionId      version;          // xmin of the row it was loaded from
+  char              *base_url;
+  char              *host;             // circuit breaker key, "host:port" or "unix:<path>"
+  char              *unix_socket_path; // NULL when it's reached through TCP
+  struct curl_slist *headers;          // with the User-Agent
+  int                member_count;     // 1 when it has no member_urls
+  char             **member_urls;      // the base url of each member, base_url first
+  BalancePolicy      balance;
+  double            *credits;          // of each member, for the latency weighted policy
+  int                next_member;      // the least outstanding policy looks from it for a member
+} Endpoint;
+
+// The endpoint with the id, loaded from net.endpoints when it isn't cached or its row changed since.
+// It must be called inside the worker's SPI connection.
+Endpoint *endpoint_lookup(int32 id, TransactionId version);
+
+// The headers of a request to the endpoint: the request's own, then the ones of the endpoint with a
+// name the request doesn't set
+struct curl_slist *endpoint_request_headers(Endpoint *endpoint, Jsonb *headers);
+
+#endif
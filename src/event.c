@@ -8,6 +8,10 @@
 #include "errors.h"
 #include "event.h"
 
+int guc_event_backend = DEFAULT_EVENT_BACKEND;
+
+uint64 event_syscalls = 0;
+
 #ifdef WAIT_USE_EPOLL
 
 static int  timerfd       = 0;
@@ -17,14 +21,31 @@ typedef struct epoll_event epoll_event;
 typedef struct itimerspec  itimerspec;
 
 inline int wait_event(int fd, event *events, size_t maxevents, int timeout_milliseconds) {
+#  ifdef WAIT_USE_IO_URING
+  if (guc_event_backend == EVENT_BACKEND_IO_URING)
+    return uring_wait_event(fd, events, maxevents, timeout_milliseconds);
+#  endif
+
+  event_syscalls++;
   return epoll_wait(fd, events, maxevents, timeout_milliseconds);
 }
 
 inline int event_monitor(void) {
+#  ifdef WAIT_USE_IO_URING
+  if (guc_event_backend == EVENT_BACKEND_IO_URING) return uring_event_monitor();
+#  endif
+
   return epoll_create1(0);
 }
 
 void ev_monitor_close(WorkerState *wstate) {
+#  ifdef WAIT_USE_IO_URING
+  if (guc_event_backend == EVENT_BACKEND_IO_URING) {
+    uring_ev_monitor_close();
+    return;
+  }
+#  endif
+
   close(wstate->epfd);
   close(timerfd);
 }
@@ -33,14 +54,21 @@ int multi_timer_cb(__attribute__((unused)) CURLM *multi, long timeout_ms, void *
   WorkerState *wstate = (WorkerState *)userp;
   elog(DEBUG2, "multi_timer_cb: Setting timeout to %ld ms\n", timeout_ms);
 
+#  ifdef WAIT_USE_IO_URING
+  if (guc_event_backend == EVENT_BACKEND_IO_URING) return uring_multi_timer_cb(timeout_ms);
+#  endif
+
   if (!timer_created) {
     timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
     if (timerfd < 0) {
       ereport(ERROR, errmsg("Failed to create timerfd"));
     }
     timerfd_settime(timerfd, 0, &(itimerspec){}, NULL);
+    // The timerfd is never read, so it's edge-triggered to be returned once per expiration instead
+    // of on every wait until curl sets another timeout. Sockets stay level-triggered since curl
+    // doesn't read or write them until EAGAIN.
     epoll_ctl(wstate->epfd, EPOLL_CTL_ADD, timerfd,
-              &(epoll_event){.events = EPOLLIN, .data.fd = timerfd});
+              &(epoll_event){.events = EPOLLIN | EPOLLET, .data.fd = timerfd});
 
     timer_created = true;
   }
@@ -67,6 +95,7 @@ int multi_timer_cb(__attribute__((unused)) CURLM *multi, long timeout_ms, void *
   // clang-format on
 
   int no_flags = 0;
+  event_syscalls++;
   if (timerfd_settime(timerfd, no_flags, &its, NULL) < 0) {
     ereport(ERROR, errmsg("timerfd_settime failed"));
   }
@@ -85,6 +114,10 @@ int multi_socket_cb(__attribute__((unused)) CURL *easy, curl_socket_t sockfd, in
                              "CURL_POLL_REMOVE"};
   elog(DEBUG2, "multi_socket_cb: sockfd %d received %s", sockfd, whatstrs[what]);
 
+#  ifdef WAIT_USE_IO_URING
+  if (guc_event_backend == EVENT_BACKEND_IO_URING) return uring_multi_socket_cb(sockfd, what);
+#  endif
+
   // libcurl calls the multi_socket_cb with socketp set to null for a socketfd when it is first
   // created. At that time we set the socketp to the marker value via a call to curl_multi_assign so
   // that any subsequent calls will have that marker value set. This helps us distinguish between
@@ -113,6 +146,7 @@ int multi_socket_cb(__attribute__((unused)) CURL *easy, curl_socket_t sockfd, in
 
   // epoll_ctl will copy ev, so there's no need to do palloc for the epoll_event
   // https://github.com/torvalds/linux/blob/e32cde8d2bd7d251a8f9b434143977ddf13dcec6/fs/eventpoll.c#L2408-L2418
+  event_syscalls++;
   if (epoll_ctl(wstate->epfd, epoll_op, sockfd, &ev) < 0) {
     int          e        = errno;
     static char *opstrs[] = {"NONE", "EPOLL_CTL_ADD", "EPOLL_CTL_DEL", "EPOLL_CTL_MOD"};
@@ -124,14 +158,25 @@ int multi_socket_cb(__attribute__((unused)) CURL *easy, curl_socket_t sockfd, in
 }
 
 bool is_timer(event ev) {
+#  ifdef WAIT_USE_IO_URING
+  if (guc_event_backend == EVENT_BACKEND_IO_URING) return uring_is_timer(ev);
+#  endif
+
   return ev.data.fd == timerfd;
 }
 
+// A socket can be ready for many things at once, e.g. EPOLLIN | EPOLLOUT, all of them are passed to
+// curl so it doesn't need another curl_multi_socket_action() for the rest. A socket that hung up
+// or failed is only passed as readable, curl then reads the end of the stream and reports it
+// precisely, e.g. "Server returned nothing" instead of "Failed sending data to the peer".
 int get_curl_event(event ev) {
-  int ev_bitmask = ev.events & EPOLLIN    ? CURL_CSELECT_IN
-                   : ev.events & EPOLLOUT ? CURL_CSELECT_OUT
-                                          : CURL_CSELECT_ERR;
-  return ev_bitmask;
+  if (ev.events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) return CURL_CSELECT_IN;
+
+  int ev_bitmask = 0;
+  if (ev.events & EPOLLIN) ev_bitmask |= CURL_CSELECT_IN;
+  if (ev.events & EPOLLOUT) ev_bitmask |= CURL_CSELECT_OUT;
+
+  return ev_bitmask ? ev_bitmask : CURL_CSELECT_ERR;
 }
 
 int get_socket_fd(event ev) {
@@ -146,8 +191,10 @@ typedef struct {
 } SocketInfo;
 
 int inline wait_event(int fd, event *events, size_t maxevents, int timeout_milliseconds) {
+  event_syscalls++;
   return kevent(fd, NULL, 0, events, maxevents,
-                &(struct timespec){.tv_sec = timeout_milliseconds / 1000});
+                &(struct timespec){.tv_sec  = timeout_milliseconds / 1000,
+                                   .tv_nsec = (timeout_milliseconds % 1000) * 1000 * 1000});
 }
 
 int inline event_monitor(void) {
@@ -177,6 +224,7 @@ int multi_timer_cb(__attribute__((unused)) CURLM *multi, long timeout_ms, void *
     EV_SET(&timer_event, id, EVFILT_TIMER, EV_DELETE, 0, 0, NULL);
   }
 
+  event_syscalls++;
   if (kevent(wstate->epfd, &timer_event, 1, NULL, 0, NULL) < 0) {
     int save_errno = errno;
     ereport(ERROR, errmsg("kevent with EVFILT_TIMER failed: %s", strerror(save_errno)));
@@ -215,6 +263,7 @@ int multi_socket_cb(__attribute__((unused)) CURL *easy, curl_socket_t sockfd, in
 
   Assert(count <= 2);
 
+  event_syscalls++;
   if (kevent(wstate->epfd, &ev[0], count, NULL, 0, NULL) < 0) {
     int save_errno = errno;
     ereport(ERROR, errmsg("kevent with %s failed for sockfd %d: %s", whatstrs[what], sockfd,
@@ -234,8 +283,8 @@ int get_curl_event(event ev) {
     ev_bitmask |= CURL_CSELECT_IN;
   else if (ev.filter == EVFILT_WRITE)
     ev_bitmask |= CURL_CSELECT_OUT;
-  else
-    ev_bitmask = CURL_CSELECT_ERR;
+
+  if (ev_bitmask == 0) ev_bitmask = CURL_CSELECT_ERR;
 
   return ev_bitmask;
 }
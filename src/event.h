@@ -7,6 +7,15 @@
 
 #ifdef __linux__
 #  define WAIT_USE_EPOLL
+// io_uring is available when the kernel headers are recent enough (5.11) for the wait timeout
+#  ifdef __has_include
+#    if __has_include(<linux/io_uring.h>)
+#      include <linux/io_uring.h>
+#      ifdef IORING_FEAT_EXT_ARG
+#        define WAIT_USE_IO_URING
+#      endif
+#    endif
+#  endif
 #elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
 #  define WAIT_USE_KQUEUE
 #else
@@ -37,6 +46,23 @@ typedef struct kevent event;
 
 #endif
 
+typedef enum {
+  EVENT_BACKEND_EPOLL,
+  EVENT_BACKEND_KQUEUE,
+  EVENT_BACKEND_IO_URING,
+} EventBackend;
+
+#ifdef WAIT_USE_EPOLL
+#  define DEFAULT_EVENT_BACKEND EVENT_BACKEND_EPOLL
+#else
+#  define DEFAULT_EVENT_BACKEND EVENT_BACKEND_KQUEUE
+#endif
+
+extern int guc_event_backend;
+
+// the number of syscalls made by the event backend in this process, to compare the backends
+extern uint64 event_syscalls;
+
 int  wait_event(int fd, event *events, size_t maxevents, int wait_milliseconds);
 int  event_monitor(void);
 void ev_monitor_close(WorkerState *wstate);
@@ -46,4 +72,18 @@ bool is_timer(event ev);
 int  get_curl_event(event ev);
 int  get_socket_fd(event ev);
 
+#ifdef WAIT_USE_IO_URING
+
+// The io_uring backend produces the same epoll_event as the epoll backend, so the worker loop
+// handles both the same way. Socket and timer changes are only queued by the callbacks and all of
+// them are submitted with the wait, in one io_uring_enter() per loop iteration.
+int  uring_event_monitor(void);
+int  uring_wait_event(int fd, event *events, size_t maxevents, int wait_milliseconds);
+void uring_ev_monitor_close(void);
+int  uring_multi_timer_cb(long timeout_ms);
+int  uring_multi_socket_cb(curl_socket_t sockfd, int what);
+bool uring_is_timer(event ev);
+
+#endif
+
 #endif
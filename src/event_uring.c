@@ -0,0 +1,395 @@
+#include <errno.h>
+#include <poll.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "curl_prelude.h"
+#include "pg_prelude.h"
+
+#include "errors.h"
+#include "event.h"
+
+#ifdef WAIT_USE_IO_URING
+
+// submission queue entries, many more completions fit in the completion queue
+static const unsigned ring_entries    = 4096;
+static const unsigned ring_cq_entries = 4 * 4096;
+
+// the `data.fd` of the event of an expired timer, never a socket
+static const int timer_event_fd = -1;
+
+// the kind of operation that a completion belongs to, stored in the top bits of its user_data
+typedef enum {
+  OP_IGNORED = 0, // the completions of removals
+  OP_POLL,
+  OP_TIMEOUT,
+} OpKind;
+
+typedef struct {
+  int    fd;
+  void  *sq_ptr;
+  size_t sq_len;
+  void  *cq_ptr;
+  size_t cq_len;
+  size_t sqes_len;
+
+  unsigned            *sq_head;
+  unsigned            *sq_tail;
+  unsigned            *sq_mask;
+  unsigned            *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned             sq_local_tail; // entries up to here are filled but maybe not submitted
+
+  unsigned            *cq_head;
+  unsigned            *cq_tail;
+  unsigned            *cq_mask;
+  struct io_uring_cqe *cqes;
+} Ring;
+
+// The poll of a socket, polls are one-shot so they're armed again after each completion while curl
+// still wants the socket, which gives the level-triggered behavior of epoll
+typedef struct {
+  uint32 wanted; // POLLIN/POLLOUT wanted by curl, 0 when the socket isn't monitored
+  uint32 armed;  // the events of the poll in flight, 0 when there's none
+  uint32 gen;    // generation of the poll in flight, completions of older polls are stale
+  bool   dirty;  // its poll has to be updated on the next submission
+} SocketPoll;
+
+static Ring ring = {.fd = -1};
+
+// indexed by socket fd
+static SocketPoll *sockets  = NULL;
+static int         nsockets = 0;
+
+static int *dirty_fds = NULL;
+static int  ndirty    = 0;
+
+static long                     timer_wanted_ms = -1; // as given by curl, -1 for no timer
+static bool                     timer_dirty     = false;
+static bool                     timer_armed     = false;
+static uint32                   timer_gen       = 0;
+static struct __kernel_timespec timer_ts;
+
+static uint64 make_user_data(OpKind kind, uint32 gen, int fd) {
+  return ((uint64)kind << 62) | ((uint64)(gen & 0x3FFFFFFF) << 32) | (uint32)fd;
+}
+
+static OpKind user_data_kind(uint64 user_data) {
+  return (OpKind)(user_data >> 62);
+}
+
+static uint32 user_data_gen(uint64 user_data) {
+  return (uint32)(user_data >> 32) & 0x3FFFFFFF;
+}
+
+static int user_data_fd(uint64 user_data) {
+  return (int)(uint32)user_data;
+}
+
+static int io_uring_enter(unsigned to_submit, unsigned min_complete, unsigned flags, void *arg,
+                          size_t argsz) {
+  event_syscalls++;
+  return (int)syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static unsigned unsubmitted(void) {
+  return ring.sq_local_tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+}
+
+static void submit(void) {
+  __atomic_store_n(ring.sq_tail, ring.sq_local_tail, __ATOMIC_RELEASE);
+
+  if (io_uring_enter(unsubmitted(), 0, 0, NULL, 0) < 0) {
+    int save_errno = errno;
+    if (save_errno != EINTR && save_errno != EBUSY && save_errno != EAGAIN)
+      ereport(ERROR, errmsg("io_uring_enter() failed: %s", strerror(save_errno)));
+  }
+}
+
+// Takes the next submission queue entry, the ring is only submitted when it's full
+static struct io_uring_sqe *get_sqe(void) {
+  if (unsubmitted() >= ring_entries) submit();
+
+  if (unsubmitted() >= ring_entries) ereport(ERROR, errmsg("io_uring submission queue is full"));
+
+  unsigned             index = ring.sq_local_tail & *ring.sq_mask;
+  struct io_uring_sqe *sqe   = &ring.sqes[index];
+
+  memset(sqe, 0, sizeof(*sqe));
+  ring.sq_array[index] = index;
+  ring.sq_local_tail++;
+
+  return sqe;
+}
+
+static void queue_poll_add(int fd, uint32 events, uint32 gen) {
+  struct io_uring_sqe *sqe = get_sqe();
+  sqe->opcode              = IORING_OP_POLL_ADD;
+  sqe->fd                  = fd;
+  sqe->poll32_events       = events;
+  sqe->user_data           = make_user_data(OP_POLL, gen, fd);
+}
+
+static void queue_poll_remove(int fd, uint32 gen) {
+  struct io_uring_sqe *sqe = get_sqe();
+  sqe->opcode              = IORING_OP_POLL_REMOVE;
+  sqe->fd                  = -1;
+  sqe->addr                = make_user_data(OP_POLL, gen, fd);
+  sqe->user_data           = make_user_data(OP_IGNORED, 0, 0);
+}
+
+static void queue_timeout(uint32 gen) {
+  struct io_uring_sqe *sqe = get_sqe();
+  sqe->opcode              = IORING_OP_TIMEOUT;
+  sqe->fd                  = -1;
+  sqe->addr                = (uint64)(uintptr_t)&timer_ts;
+  sqe->len                 = 1;
+  sqe->user_data           = make_user_data(OP_TIMEOUT, gen, 0);
+}
+
+static void queue_timeout_remove(uint32 gen) {
+  struct io_uring_sqe *sqe = get_sqe();
+  sqe->opcode              = IORING_OP_TIMEOUT_REMOVE;
+  sqe->fd                  = -1;
+  sqe->addr                = make_user_data(OP_TIMEOUT, gen, 0);
+  sqe->user_data           = make_user_data(OP_IGNORED, 0, 0);
+}
+
+static SocketPoll *get_socket(int fd) {
+  if (fd >= nsockets) {
+    int new_nsockets = Max(fd + 1, Max(nsockets * 2, 1024));
+
+    sockets = repalloc(sockets, sizeof(SocketPoll) * new_nsockets);
+    memset(&sockets[nsockets], 0, sizeof(SocketPoll) * (new_nsockets - nsockets));
+
+    dirty_fds = repalloc(dirty_fds, sizeof(int) * new_nsockets);
+    nsockets  = new_nsockets;
+  }
+
+  return &sockets[fd];
+}
+
+static void mark_dirty(int fd, SocketPoll *sock) {
+  if (sock->dirty) return;
+
+  sock->dirty         = true;
+  dirty_fds[ndirty++] = fd;
+}
+
+// Turns the changes done by curl since the last wait into submission queue entries
+static void queue_changes(void) {
+  for (int i = 0; i < ndirty; i++) {
+    int         fd   = dirty_fds[i];
+    SocketPoll *sock = &sockets[fd];
+
+    sock->dirty = false;
+
+    if (sock->armed && sock->armed != sock->wanted) {
+      queue_poll_remove(fd, sock->gen);
+      sock->armed = 0;
+    }
+
+    if (!sock->armed && sock->wanted) {
+      sock->gen++;
+      queue_poll_add(fd, sock->wanted, sock->gen);
+      sock->armed = sock->wanted;
+    }
+  }
+
+  ndirty = 0;
+
+  if (timer_dirty) {
+    if (timer_armed) {
+      queue_timeout_remove(timer_gen);
+      timer_armed = false;
+    }
+
+    if (timer_wanted_ms >= 0) {
+      // a timeout of 0 means now for curl, the closest is 1 ns
+      timer_ts = timer_wanted_ms > 0 ? (struct __kernel_timespec){
+                                           .tv_sec  = timer_wanted_ms / 1000,
+                                           .tv_nsec = (timer_wanted_ms % 1000) * 1000 * 1000,
+                                       }
+                                     : (struct __kernel_timespec){.tv_nsec = 1};
+      timer_gen++;
+      queue_timeout(timer_gen);
+      timer_armed = true;
+    }
+
+    timer_dirty = false;
+  }
+}
+
+int uring_event_monitor(void) {
+  struct io_uring_params params = {
+    .flags      = IORING_SETUP_CQSIZE,
+    .cq_entries = ring_cq_entries,
+  };
+
+  event_syscalls++;
+  ring.fd = (int)syscall(__NR_io_uring_setup, ring_entries, &params);
+
+  if (ring.fd < 0) {
+    int save_errno = errno;
+    ereport(ERROR, errmsg("io_uring_setup() failed: %s", strerror(save_errno)),
+            errhint("Set pg_net.event_backend to epoll if io_uring is disabled on this system."));
+  }
+
+  if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP))
+    ereport(ERROR, errmsg("the io_uring event backend requires Linux 5.11 or later"));
+
+  ring.sq_len   = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring.cq_len   = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring.sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    ring.sq_len = ring.cq_len = Max(ring.sq_len, ring.cq_len);
+
+  int prot  = PROT_READ | PROT_WRITE;
+  int flags = MAP_SHARED | MAP_POPULATE;
+
+  ring.sq_ptr = mmap(NULL, ring.sq_len, prot, flags, ring.fd, IORING_OFF_SQ_RING);
+  ring.cq_ptr = params.features & IORING_FEAT_SINGLE_MMAP
+                    ? ring.sq_ptr
+                    : mmap(NULL, ring.cq_len, prot, flags, ring.fd, IORING_OFF_CQ_RING);
+  ring.sqes   = mmap(NULL, ring.sqes_len, prot, flags, ring.fd, IORING_OFF_SQES);
+
+  if (ring.sq_ptr == MAP_FAILED || ring.cq_ptr == MAP_FAILED || ring.sqes == MAP_FAILED) {
+    int save_errno = errno;
+    ereport(ERROR, errmsg("Failed to map the io_uring rings: %s", strerror(save_errno)));
+  }
+
+  char *sq = ring.sq_ptr, *cq = ring.cq_ptr;
+
+  ring.sq_head       = (unsigned *)(sq + params.sq_off.head);
+  ring.sq_tail       = (unsigned *)(sq + params.sq_off.tail);
+  ring.sq_mask       = (unsigned *)(sq + params.sq_off.ring_mask);
+  ring.sq_array      = (unsigned *)(sq + params.sq_off.array);
+  ring.sq_local_tail = *ring.sq_tail;
+
+  ring.cq_head = (unsigned *)(cq + params.cq_off.head);
+  ring.cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  ring.cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+  ring.cqes    = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  sockets   = MemoryContextAllocZero(TopMemoryContext, sizeof(SocketPoll));
+  dirty_fds = MemoryContextAlloc(TopMemoryContext, sizeof(int));
+  nsockets  = 1;
+
+  return ring.fd;
+}
+
+void uring_ev_monitor_close(void) {
+  if (ring.fd < 0) return;
+
+  munmap(ring.sqes, ring.sqes_len);
+  if (ring.cq_ptr != ring.sq_ptr) munmap(ring.cq_ptr, ring.cq_len);
+  munmap(ring.sq_ptr, ring.sq_len);
+  close(ring.fd);
+
+  ring.fd = -1;
+}
+
+int uring_multi_timer_cb(long timeout_ms) {
+  timer_wanted_ms = timeout_ms;
+  timer_dirty     = true;
+
+  return 0;
+}
+
+int uring_multi_socket_cb(curl_socket_t sockfd, int what) {
+  SocketPoll *sock = get_socket(sockfd);
+
+  if (what == CURL_POLL_REMOVE) {
+    // curl closes the socket after this, so the poll is removed right away instead of on the next
+    // submission, where the fd could already belong to a new socket
+    if (sock->armed) queue_poll_remove(sockfd, sock->gen);
+
+    sock->wanted = 0;
+    sock->armed  = 0;
+    return 0;
+  }
+
+  sock->wanted = (what & CURL_POLL_IN ? POLLIN : 0) | (what & CURL_POLL_OUT ? POLLOUT : 0);
+  mark_dirty(sockfd, sock);
+
+  return 0;
+}
+
+// Translates a completion into an epoll_event, returns false when it's not an event for the worker
+static bool translate_cqe(struct io_uring_cqe *cqe, event *ev) {
+  uint32 gen = user_data_gen(cqe->user_data);
+
+  switch (user_data_kind(cqe->user_data)) {
+  case OP_POLL: {
+    int         fd   = user_data_fd(cqe->user_data);
+    SocketPoll *sock = fd < nsockets ? &sockets[fd] : NULL;
+
+    if (sock == NULL || !sock->armed || (sock->gen & 0x3FFFFFFF) != gen) return false;
+
+    sock->armed = 0;
+    if (sock->wanted) mark_dirty(fd, sock); // one-shot, arm it again
+
+    *ev = (event){
+      .data.fd = fd,
+      .events  = cqe->res < 0 ? EPOLLERR : (uint32)cqe->res,
+    };
+    return true;
+  }
+  case OP_TIMEOUT:
+    if (!timer_armed || (timer_gen & 0x3FFFFFFF) != gen) return false;
+
+    timer_armed = false;
+
+    if (cqe->res != -ETIME) return false;
+
+    *ev = (event){.data.fd = timer_event_fd};
+    return true;
+  default: return false;
+  }
+}
+
+int uring_wait_event(__attribute__((unused)) int fd, event *events, size_t maxevents,
+                     int timeout_milliseconds) {
+  queue_changes();
+
+  __atomic_store_n(ring.sq_tail, ring.sq_local_tail, __ATOMIC_RELEASE);
+
+  bool has_completions = *ring.cq_head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+
+  // submits the queued changes and waits for a completion, in a single syscall
+  if (unsubmitted() > 0 || !has_completions) {
+    struct __kernel_timespec ts = {
+      .tv_sec  = timeout_milliseconds / 1000,
+      .tv_nsec = (timeout_milliseconds % 1000) * 1000 * 1000,
+    };
+    struct io_uring_getevents_arg arg = {.ts = (uint64)(uintptr_t)&ts};
+
+    if (io_uring_enter(unsubmitted(), has_completions ? 0 : 1,
+                       IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg)) < 0) {
+      // a timeout isn't an error, it just means there are no events
+      if (errno != ETIME && errno != EBUSY && errno != EAGAIN) return -1;
+    }
+  }
+
+  size_t   nevents = 0;
+  unsigned head    = *ring.cq_head;
+  unsigned tail    = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+
+  while (head != tail && nevents < maxevents) {
+    if (translate_cqe(&ring.cqes[head & *ring.cq_mask], &events[nevents])) nevents++;
+    head++;
+  }
+
+  __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+  return (int)nevents;
+}
+
+bool uring_is_timer(event ev) {
+  return ev.data.fd == timer_event_fd;
+}
+
+#endif
@@ -0,0 +1,115 @@
+#include <stdlib.h>
+
+#include "pg_prelude.h"
+
+#include "hedge.h"
+
+enum {
+  hedge_host_len  = 264, // fits a dns name plus the port
+  latency_samples = 64,  // the p95 of a host is taken over its latest requests
+};
+
+// The latest latencies of the GETs to a host, kept in the worker's memory
+typedef struct {
+  char host[hedge_host_len]; // hash key
+  int  count;                // samples taken, up to latency_samples
+  int  next;                 // where the next sample goes in the ring
+  long samples[latency_samples];
+  long p95_ms; // 0 until there are min_latency_samples
+} HostLatency;
+
+// below this the p95 of a host says little, pg_net.hedge_delay is used instead
+static const int min_latency_samples = 20;
+// hosts beyond this aren't tracked, their requests are hedged after pg_net.hedge_delay
+static const long max_hosts = 1024;
+// hedges that can be sent in a row once the budget has grown, in hundredths of a hedge
+static const int max_budget = 10 * 100;
+
+int guc_hedge_policy      = HEDGE_OFF;
+int guc_hedge_delay       = 100;
+int guc_hedge_max_percent = 5;
+
+static HTAB *latencies = NULL;
+
+// every transfer adds pg_net.hedge_max_percent hundredths of a hedge, a hedge takes 100
+static int budget = 0;
+
+static int compare_longs(const void *a, const void *b) {
+  long x = *(const long *)a, y = *(const long *)b;
+  return (x > y) - (x < y);
+}
+
+static HostLatency *latency_of(const char *host, HASHACTION action) {
+  if (latencies == NULL) {
+    HASHCTL info = {
+      .keysize   = hedge_host_len,
+      .entrysize = sizeof(HostLatency),
+      .hcxt      = TopMemoryContext,
+    };
+
+    int flags = HASH_ELEM | HASH_CONTEXT;
+#if PG_VERSION_NUM >= 140000
+    flags |= HASH_STRINGS;
+#endif
+
+    latencies = hash_create("pg_net host latencies", 64, &info, flags);
+  }
+
+  if (strlen(host) >= hedge_host_len) return NULL;
+
+  if (action == HASH_ENTER && hash_get_num_entries(latencies) >= max_hosts)
+    return hash_search(latencies, host, HASH_FIND, NULL);
+
+  bool         found;
+  HostLatency *latency = hash_search(latencies, host, action, &found);
+
+  if (latency && !found) {
+    latency->count  = 0;
+    latency->next   = 0;
+    latency->p95_ms = 0;
+  }
+
+  return latency;
+}
+
+long hedge_delay_ms(const char *host) {
+  if (guc_hedge_policy != HEDGE_P95 || host == NULL) return guc_hedge_delay;
+
+  HostLatency *latency = latency_of(host, HASH_FIND);
+
+  return latency && latency->p95_ms > 0 ? latency->p95_ms : guc_hedge_delay;
+}
+
+void hedge_record_latency(const char *host, long latency_ms) {
+  if (guc_hedge_policy != HEDGE_P95 || host == NULL) return;
+
+  HostLatency *latency = latency_of(host, HASH_ENTER);
+
+  if (latency == NULL) return;
+
+  latency->samples[latency->next] = latency_ms;
+  latency->next                   = (latency->next + 1) % latency_samples;
+  latency->count                  = Min(latency->count + 1, latency_samples);
+
+  if (latency->count < min_latency_samples) return;
+
+  long sorted[latency_samples];
+
+  memcpy(sorted, latency->samples, latency->count * sizeof(long));
+  qsort(sorted, latency->count, sizeof(long), compare_longs);
+
+  // a hedge after 0 ms would send every request twice
+  latency->p95_ms = Max(sorted[(latency->count * 95 + 99) / 100 - 1], 1);
+}
+
+void hedge_count_transfer(void) {
+  budget = Min(budget + guc_hedge_max_percent, max_budget);
+}
+
+bool hedge_take_budget(void) {
+  // the budget left from before a reload doesn't outlast a cap of 0
+  if (guc_hedge_max_percent == 0 || budget < 100) return false;
+
+  budget -= 100;
+  return true;
+}
@@ -0,0 +1,27 @@
+#ifndef HEDGE_H
+#define HEDGE_H
+
+typedef enum {
+  HEDGE_OFF,   // requests aren't hedged
+  HEDGE_DELAY, // a GET is hedged once it runs longer than pg_net.hedge_delay
+  HEDGE_P95,   // a GET is hedged once it runs longer than the p95 latency of its host
+} HedgePolicy;
+
+extern int guc_hedge_policy;
+extern int guc_hedge_delay;
+extern int guc_hedge_max_percent;
+
+// How long a GET to the host runs before it's hedged. With the p95 policy it's pg_net.hedge_delay
+// until enough of the latencies of the host are known, or when `host` is NULL.
+long hedge_delay_ms(const char *host);
+
+// Keeps the latency of a GET to the host that got a response, for the p95 of the host
+void hedge_record_latency(const char *host, long latency_ms);
+
+// Counts a transfer the worker started, the hedges aren't counted
+void hedge_count_transfer(void);
+
+// Takes a hedge from the budget of pg_net.hedge_max_percent of the transfers, false when it's spent
+bool hedge_take_budget(void);
+
+#endif
@@ -11,28 +11,39 @@
 #include "commands/dbcommands.h"
 #include "storage/lmgr.h"
 #include <access/hash.h>
+#include <access/htup_details.h>
 #include <access/xact.h>
 #include <catalog/namespace.h>
 #include <catalog/pg_authid.h>
+#include <catalog/pg_class.h>
 #include <catalog/pg_extension.h>
+#include <catalog/pg_inherits.h>
+#include <catalog/pg_proc.h>
 #include <catalog/pg_type.h>
+#include <commands/async.h>
 #include <commands/defrem.h>
 #include <commands/extension.h>
+#include <commands/sequence.h>
 #include <executor/spi.h>
 #include <fmgr.h>
+#include <funcapi.h>
+#include <lib/ilist.h>
 #include <miscadmin.h>
 #include <nodes/makefuncs.h>
 #include <nodes/pg_list.h>
 #include <pgstat.h>
+#include <portability/instr_time.h>
 #include <postmaster/bgworker.h>
 #include <storage/condition_variable.h>
 #include <storage/ipc.h>
 #include <storage/latch.h>
+#include <storage/lwlock.h>
 #include <storage/proc.h>
 #include <storage/shmem.h>
 #include <tcop/utility.h>
 #include <tsearch/ts_locale.h>
 #include <utils/acl.h>
+#include <utils/array.h>
 #include <utils/builtins.h>
 #include <utils/fmgrprotos.h>
 #include <utils/guc.h>
@@ -42,8 +53,13 @@
 #include <utils/jsonb.h>
 #include <utils/lsyscache.h>
 #include <utils/memutils.h>
+#include <utils/numeric.h>
+#include <utils/pg_rusage.h>
 #include <utils/regproc.h>
 #include <utils/snapmgr.h>
+#include <utils/syscache.h>
+#include <utils/timestamp.h>
+#include <utils/typcache.h>
 #include <utils/varlena.h>
 
 #pragma GCC diagnostic pop
@@ -77,6 +93,13 @@
     JsonbValueToJsonb(PG_JSONB_PUSH((state), WJB_END_OBJECT, NULL))
 #endif
 
+#if PG_VERSION_NUM >= 160000
+#  define PG_PROC_ACLCHECK(proc, role, mode)                                                       \
+    object_aclcheck(ProcedureRelationId, (proc), (role), (mode))
+#else
+#  define PG_PROC_ACLCHECK(proc, role, mode) pg_proc_aclcheck((proc), (role), (mode))
+#endif
+
 const char *xact_event_name(XactEvent event);
 
 #if PG17_LT
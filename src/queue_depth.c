@@ -0,0 +1,440 @@
+#include "pg_prelude.h"
+
+#include "queue_depth.h"
+
+// The requests of a role in net.http_request_queue, the entry of InvalidOid counts every role
+typedef struct {
+  Oid   role;     // hash key
+  int64 reserved; // inserted by transactions that didn't commit yet
+  int64 queued;   // committed and not taken by the worker yet
+} QueueDepth;
+
+typedef struct {
+  LWLock *lock;
+  Oid     queue_relid; // the net.http_request_queue that is counted, a new one starts empty
+} QueueDepthState;
+
+// Requests inserted by the current transaction
+typedef struct {
+  Oid              role; // InvalidOid when the role didn't fit in the table, it's only in the total
+  SubTransactionId subid;
+  int64            count;
+} Reservation;
+
+static const char *queue_depth_tranche = "pg_net queue depth";
+// roles beyond this only count towards pg_net.max_queued_requests
+static const long max_roles = 1024;
+// how often a full queue is checked for room when pg_net.queue_full_action is wait
+static const long queue_full_poll_ms = 10;
+
+int guc_max_queued_requests          = 0;
+int guc_max_queued_requests_per_role = 0;
+int guc_queue_full_action            = QUEUE_FULL_REJECT;
+int guc_queue_full_timeout           = 1000;
+
+static QueueDepthState *state  = NULL;
+static HTAB            *depths = NULL;
+
+static List *reservations         = NIL;
+static bool  callbacks_registered = false;
+
+static SPIPlanPtr drop_oldest_plan         = NULL;
+static SPIPlanPtr drop_oldest_of_role_plan = NULL;
+static SPIPlanPtr recount_plan             = NULL;
+
+Size queue_depth_shmem_size(void) {
+  return add_size(MAXALIGN(sizeof(QueueDepthState)),
+                  hash_estimate_size(max_roles + 1, sizeof(QueueDepth)));
+}
+
+void queue_depth_shmem_request(void) {
+  RequestAddinShmemSpace(queue_depth_shmem_size());
+  RequestNamedLWLockTranche(queue_depth_tranche, 1);
+}
+
+// must be called while holding the AddinShmemInitLock
+void queue_depth_shmem_startup(void) {
+  bool found;
+
+  state = ShmemInitStruct("pg_net queue depth state", sizeof(QueueDepthState), &found);
+
+  if (!found) {
+    state->lock        = &(GetNamedLWLockTranche(queue_depth_tranche))->lock;
+    state->queue_relid = InvalidOid;
+  }
+
+  HASHCTL info = {
+    .keysize   = sizeof(Oid),
+    .entrysize = sizeof(QueueDepth),
+  };
+
+  depths = ShmemInitHash("pg_net queue depth", max_roles + 1, max_roles + 1, &info,
+                         HASH_ELEM | HASH_BLOBS);
+}
+
+// must be called while holding the lock, NULL when the table is full
+static QueueDepth *depth_of(Oid role) {
+  bool        found;
+  QueueDepth *depth = hash_search(depths, &role, HASH_ENTER_NULL, &found);
+
+  if (depth && !found) {
+    depth->reserved = 0;
+    depth->queued   = 0;
+  }
+
+  return depth;
+}
+
+// must be called while holding the lock. The counts are kept from going negative when they were
+// reset while the requests were in flight, a role without requests stops taking an entry.
+static void move_counts(Oid role, int64 reserved, int64 queued) {
+  Oid roles[] = {InvalidOid, role};
+
+  for (int i = 0; i < (OidIsValid(role) ? 2 : 1); i++) {
+    QueueDepth *depth = hash_search(depths, &roles[i], HASH_FIND, NULL);
+
+    if (depth == NULL) continue;
+
+    depth->reserved = Max(depth->reserved + reserved, 0);
+    depth->queued   = Max(depth->queued + queued, 0);
+
+    if (OidIsValid(depth->role) && depth->reserved == 0 && depth->queued == 0)
+      hash_search(depths, &depth->role, HASH_REMOVE, NULL);
+  }
+}
+
+// must be called while holding the lock
+static void forget_counts(void) {
+  HASH_SEQ_STATUS status;
+  QueueDepth     *depth;
+
+  hash_seq_init(&status, depths);
+
+  while ((depth = hash_seq_search(&status)) != NULL)
+    hash_search(depths, &depth->role, HASH_REMOVE, NULL);
+}
+
+static void queue_depth_xact_cb(XactEvent event, __attribute__((unused)) void *arg) {
+  bool committed;
+
+  switch (event) {
+  // a prepared transaction most likely commits, its requests are counted as queued from then on
+  case XACT_EVENT_PREPARE:
+  case XACT_EVENT_COMMIT:
+  case XACT_EVENT_PARALLEL_COMMIT: committed = true; break;
+  case XACT_EVENT_ABORT:
+  case XACT_EVENT_PARALLEL_ABORT: committed = false; break;
+  default: return;
+  }
+
+  if (reservations == NIL) return;
+
+  ListCell *lc;
+
+  LWLockAcquire(state->lock, LW_EXCLUSIVE);
+
+  foreach (lc, reservations) {
+    Reservation *r = lfirst(lc);
+    move_counts(r->role, -r->count, committed ? r->count : 0);
+  }
+
+  LWLockRelease(state->lock);
+
+  // the list lived in the TopTransactionContext
+  reservations = NIL;
+}
+
+static void queue_depth_subxact_cb(SubXactEvent event, SubTransactionId mySubid,
+                                   SubTransactionId parentSubid,
+                                   __attribute__((unused)) void *arg) {
+  ListCell *lc;
+
+  switch (event) {
+  case SUBXACT_EVENT_COMMIT_SUB:
+    foreach (lc, reservations) {
+      Reservation *r = lfirst(lc);
+      if (r->subid == mySubid) r->subid = parentSubid;
+    }
+    break;
+  case SUBXACT_EVENT_ABORT_SUB: {
+    List *kept = NIL;
+
+    MemoryContext old = MemoryContextSwitchTo(TopTransactionContext);
+
+    LWLockAcquire(state->lock, LW_EXCLUSIVE);
+
+    foreach (lc, reservations) {
+      Reservation *r = lfirst(lc);
+      if (r->subid == mySubid)
+        move_counts(r->role, -r->count, 0);
+      else
+        kept = lappend(kept, r);
+    }
+
+    LWLockRelease(state->lock);
+
+    MemoryContextSwitchTo(old);
+
+    reservations = kept;
+    break;
+  }
+  default: break;
+  }
+}
+
+static void add_reservation(Oid role, int64 count) {
+  if (!callbacks_registered) { // they stay registered for the life of the backend
+    RegisterXactCallback(queue_depth_xact_cb, NULL);
+    RegisterSubXactCallback(queue_depth_subxact_cb, NULL);
+    callbacks_registered = true;
+  }
+
+  SubTransactionId subid = GetCurrentSubTransactionId();
+  Reservation     *last  = reservations != NIL ? llast(reservations) : NULL;
+
+  if (last && last->role == role && last->subid == subid) {
+    last->count += count;
+    return;
+  }
+
+  MemoryContext old = MemoryContextSwitchTo(TopTransactionContext);
+
+  Reservation *r = palloc(sizeof(Reservation));
+  r->role        = role;
+  r->subid       = subid;
+  r->count       = count;
+
+  reservations = lappend(reservations, r);
+
+  MemoryContextSwitchTo(old);
+}
+
+// The requests the current transaction inserted, of the role or of every role for InvalidOid
+static int64 own_reservations(Oid role) {
+  int64     count = 0;
+  ListCell *lc;
+
+  foreach (lc, reservations) {
+    Reservation *r = lfirst(lc);
+    if (!OidIsValid(role) || r->role == role) count += r->count;
+  }
+
+  return count;
+}
+
+// Drops the oldest request of the role, or of the whole queue for InvalidOid. Its row is left for
+// the worker, which stores its error response instead of sending it, so that the responses are only
+// written by the worker. Requests being sent by the worker are skipped. Returns false when there's
+// none.
+static bool drop_oldest(Oid role) {
+  SPIPlanPtr *plan = OidIsValid(role) ? &drop_oldest_of_role_plan : &drop_oldest_plan;
+
+  if (*plan == NULL) {
+    char *query = psprintf("\
+        WITH\
+        oldest AS (\
+          SELECT id, xmin FROM net.http_request_queue\
+          WHERE error_msg IS NULL %s\
+          ORDER BY id LIMIT 1 FOR UPDATE SKIP LOCKED\
+        )\
+        UPDATE net.http_request_queue q\
+        SET error_msg = 'Request dropped, the queue was full'\
+        FROM oldest\
+        WHERE q.id = oldest.id\
+        RETURNING q.enqueued_by, oldest.xmin",
+                           OidIsValid(role) ? "AND enqueued_by = $1" : "");
+
+    SPIPlanPtr tmp = OidIsValid(role) ? SPI_prepare(query, 1, (Oid[]){REGROLEOID})
+                                      : SPI_prepare(query, 0, NULL);
+
+    if (tmp == NULL)
+      ereport(ERROR, errmsg("SPI_prepare failed: %s", SPI_result_code_string(SPI_result)));
+
+    *plan = SPI_saveplan(tmp);
+    if (*plan == NULL) ereport(ERROR, errmsg("SPI_saveplan failed"));
+
+    SPI_freeplan(tmp);
+    pfree(query);
+  }
+
+  int ret_code =
+      SPI_execute_plan(*plan, OidIsValid(role) ? (Datum[]){ObjectIdGetDatum(role)} : NULL, NULL,
+                       false, 0);
+
+  if (ret_code != SPI_OK_UPDATE_RETURNING)
+    ereport(ERROR, errmsg("Error dropping the oldest request: %s", SPI_result_code_string(ret_code)));
+
+  if (SPI_processed == 0) return false;
+
+  bool          isnull;
+  Oid           dropped_role = DatumGetObjectId(
+      SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+  TransactionId xmin =
+      DatumGetTransactionId(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2, &isnull));
+
+  SPI_freetuptable(SPI_tuptable);
+
+  queue_depth_removed(dropped_role, xmin);
+
+  return true;
+}
+
+static void report_full_queue(Oid role, int limit, bool waited) {
+  ereport(ERROR, errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+          waited ? errmsg("the pg_net request queue is still full after waiting %d ms",
+                          guc_queue_full_timeout)
+                 : errmsg("the pg_net request queue is full"),
+          OidIsValid(role)
+              ? errdetail("Role \"%s\" has pg_net.max_queued_requests_per_role (%d) requests in "
+                          "the queue.",
+                          GetUserNameFromId(role, false), limit)
+              : errdetail("The queue has pg_net.max_queued_requests (%d) requests.", limit));
+}
+
+void queue_depth_reserve(Oid role) {
+  Oid         net_oid     = get_namespace_oid("net", false);
+  Oid         queue_relid = get_relname_relid("http_request_queue", net_oid);
+  TimestampTz deadline    = 0;
+
+  for (;;) {
+    Oid full_for = InvalidOid; // the role whose limit is reached, InvalidOid for the total
+    int limit    = 0;
+
+    LWLockAcquire(state->lock, LW_EXCLUSIVE);
+
+    // the extension was recreated since the requests were counted
+    if (state->queue_relid != queue_relid) {
+      forget_counts();
+      state->queue_relid = queue_relid;
+    }
+
+    QueueDepth *total = depth_of(InvalidOid);
+    QueueDepth *own   = depth_of(role);
+
+    if (own && guc_max_queued_requests_per_role > 0 &&
+        own->reserved + own->queued >= guc_max_queued_requests_per_role) {
+      full_for = role;
+      limit    = guc_max_queued_requests_per_role;
+    } else if (total && guc_max_queued_requests > 0 &&
+               total->reserved + total->queued >= guc_max_queued_requests) {
+      limit = guc_max_queued_requests;
+    } else {
+      if (total) total->reserved++;
+      if (own) own->reserved++;
+    }
+
+    LWLockRelease(state->lock);
+
+    if (limit == 0) {
+      add_reservation(own ? role : InvalidOid, 1);
+      return;
+    }
+
+    switch (guc_queue_full_action) {
+    case QUEUE_FULL_WAIT: {
+      TimestampTz now = GetCurrentTimestamp();
+
+      if (deadline == 0) deadline = TimestampTzPlusMilliseconds(now, guc_queue_full_timeout);
+
+      // the requests of this transaction only leave the queue once it commits
+      if (own_reservations(full_for) >= limit) report_full_queue(full_for, limit, false);
+
+      if (now >= deadline) report_full_queue(full_for, limit, true);
+
+      (void)WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+                      queue_full_poll_ms, PG_WAIT_EXTENSION);
+      ResetLatch(MyLatch);
+      CHECK_FOR_INTERRUPTS();
+      break;
+    }
+    case QUEUE_FULL_DROP_OLDEST:
+      if (!drop_oldest(full_for)) report_full_queue(full_for, limit, false);
+      break;
+    default: report_full_queue(full_for, limit, false);
+    }
+  }
+}
+
+void queue_depth_removed(Oid role, TransactionId xmin) {
+  // the transaction removed one of its own requests, it's no longer inserted by it
+  bool own = TransactionIdIsCurrentTransactionId(xmin);
+
+  LWLockAcquire(state->lock, LW_EXCLUSIVE);
+  move_counts(role, own ? -1 : 0, own ? 0 : -1);
+  LWLockRelease(state->lock);
+
+  if (own) add_reservation(role, -1);
+}
+
+void queue_depth_dequeued(Oid role) {
+  LWLockAcquire(state->lock, LW_EXCLUSIVE);
+  move_counts(role, 0, -1);
+  LWLockRelease(state->lock);
+}
+
+bool queue_depth_recount(Oid queue_relid) {
+  // The lock is only taken once no transaction writes the queue, those counted their requests
+  // when they committed, and it keeps the others from writing it. The count sees every counted
+  // request then, and only those, the ones that are reserved stay counted as such. Waiting for it
+  // would keep new requests waiting behind a transaction that's left open.
+  if (!ConditionalLockRelationOid(queue_relid, ShareLock)) return false;
+
+  if (recount_plan == NULL) {
+    SPIPlanPtr tmp = SPI_prepare("\
+        SELECT enqueued_by, count(*)\
+        FROM net.http_request_queue\
+        WHERE error_msg IS NULL\
+        GROUP BY enqueued_by",
+                                 0, NULL);
+
+    if (tmp == NULL)
+      ereport(ERROR, errmsg("SPI_prepare failed: %s", SPI_result_code_string(SPI_result)));
+
+    recount_plan = SPI_saveplan(tmp);
+    if (recount_plan == NULL) ereport(ERROR, errmsg("SPI_saveplan failed"));
+
+    SPI_freeplan(tmp);
+  }
+
+  int ret_code = SPI_execute_plan(recount_plan, NULL, NULL, false, 0);
+
+  if (ret_code != SPI_OK_SELECT)
+    ereport(ERROR,
+            errmsg("Error counting the request queue: %s", SPI_result_code_string(ret_code)));
+
+  HASH_SEQ_STATUS status;
+  QueueDepth     *depth;
+
+  LWLockAcquire(state->lock, LW_EXCLUSIVE);
+
+  state->queue_relid = queue_relid;
+
+  hash_seq_init(&status, depths);
+
+  while ((depth = hash_seq_search(&status)) != NULL) {
+    depth->queued = 0;
+
+    if (OidIsValid(depth->role) && depth->reserved == 0)
+      hash_search(depths, &depth->role, HASH_REMOVE, NULL);
+  }
+
+  for (uint64 i = 0; i < SPI_processed; i++) {
+    bool isnull;
+    Oid  role = DatumGetObjectId(
+        SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1, &isnull));
+    int64 count =
+        DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 2, &isnull));
+
+    QueueDepth *total = depth_of(InvalidOid);
+    QueueDepth *own   = depth_of(role);
+
+    if (total) total->queued += count;
+    if (own) own->queued += count;
+  }
+
+  LWLockRelease(state->lock);
+
+  SPI_freetuptable(SPI_tuptable);
+
+  return true;
+}
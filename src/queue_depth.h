@@ -0,0 +1,38 @@
+#ifndef QUEUE_DEPTH_H
+#define QUEUE_DEPTH_H
+
+typedef enum {
+  QUEUE_FULL_REJECT,      // the enqueue fails
+  QUEUE_FULL_WAIT,        // the enqueue waits for room up to pg_net.queue_full_timeout, then fails
+  QUEUE_FULL_DROP_OLDEST, // the oldest request of the full queue is dropped to make room
+} QueueFullAction;
+
+extern int guc_max_queued_requests;
+extern int guc_max_queued_requests_per_role;
+extern int guc_queue_full_action;
+extern int guc_queue_full_timeout;
+
+Size queue_depth_shmem_size(void);
+
+void queue_depth_shmem_request(void);
+
+void queue_depth_shmem_startup(void);
+
+// Counts a request `role` is about to insert in net.http_request_queue, once there's room for it
+// according to pg_net.queue_full_action. It must be called inside an SPI connection as the owner of
+// the queue, dropping the oldest request updates it.
+void queue_depth_reserve(Oid role);
+
+// Stops counting a request deleted from the queue by a backend, `xmin` is the one of its row
+void queue_depth_removed(Oid role, TransactionId xmin);
+
+// Counts requests the worker took out of the queue, the dropped ones were already removed
+void queue_depth_dequeued(Oid role);
+
+// Counts the requests in the queue, the table outlives a clean restart while the counts don't.
+// False when a transaction writing the queue is still open, it's called again later then. It must
+// be called inside an SPI connection, in a transaction of its own since the queue stays locked
+// against new requests until it ends.
+bool queue_depth_recount(Oid queue_relid);
+
+#endif
@@ -0,0 +1,323 @@
+#include "pg_prelude.h"
+
+#include "curl_prelude.h"
+
+#include "core.h"
+#include "errors.h"
+#include "response_cache.h"
+
+struct CachedResponse {
+  uint64      hash; // of the key, the hash table key
+  char       *key;  // compared on lookup since hashes can collide
+  int32       status_code;
+  text       *body; // NULL when empty
+  Jsonb      *headers;
+  text       *content_type; // NULL when there's none
+  char       *etag;         // NULL when there's none
+  char       *last_modified;
+  TimestampTz fresh_until;
+  Size        size;
+  dlist_node  lru_node; // the most recently used responses are at the head
+};
+
+// What the Cache-Control of a response allows
+typedef struct {
+  bool  storable;
+  int64 max_age_secs; // 0 when it must be revalidated on every use
+} CachePolicy;
+
+int guc_response_cache_size = 0;
+
+static MemoryContext cache_context = NULL;
+static HTAB         *cache         = NULL;
+static dlist_head    lru           = DLIST_STATIC_INIT(lru);
+static Size          cached_size   = 0;
+
+static Size cache_limit(void) {
+  return (Size)guc_response_cache_size * 1024;
+}
+
+static bool has_header(struct curl_slist *headers, const char *name) {
+  size_t name_len = strlen(name);
+
+  for (struct curl_slist *h = headers; h; h = h->next)
+    if (pg_strncasecmp(h->data, name, name_len) == 0 && h->data[name_len] == ':') return true;
+
+  return false;
+}
+
+char *request_key(CurlHandle *handle) {
+  // a chunked body isn't kept in memory to be cached or shared
+  if (strcasecmp(handle->method, "GET") != 0 || handle->req_body ||
+      handle->store_response == STORE_RESPONSE_CHUNKED ||
+      has_header(handle->request_headers, "If-None-Match") ||
+      has_header(handle->request_headers, "If-Modified-Since"))
+    return NULL;
+
+  StringInfoData key;
+  initStringInfo(&key);
+
+  // urls are http or https, so they can't be mistaken for a socket
+  if (handle->unix_socket_path) appendStringInfo(&key, "unix:%s ", handle->unix_socket_path);
+
+  appendStringInfoString(&key, handle->url);
+
+  for (struct curl_slist *h = handle->request_headers; h; h = h->next)
+    appendStringInfo(&key, "\n%s", h->data);
+
+  return key.data;
+}
+
+static uint64 key_hash(const char *key) {
+  return DatumGetUInt64(hash_any_extended((const unsigned char *)key, strlen(key), 0));
+}
+
+static void remove_cached(CachedResponse *entry) {
+  dlist_delete(&entry->lru_node);
+  cached_size -= entry->size;
+
+  pfree(entry->key);
+  if (entry->body) pfree(entry->body);
+  pfree(entry->headers);
+  if (entry->content_type) pfree(entry->content_type);
+  if (entry->etag) pfree(entry->etag);
+  if (entry->last_modified) pfree(entry->last_modified);
+
+  hash_search(cache, &entry->hash, HASH_REMOVE, NULL);
+}
+
+CachedResponse *response_cache_lookup(const char *key) {
+  if (cache == NULL || cache_limit() == 0) return NULL;
+
+  uint64          hash  = key_hash(key);
+  CachedResponse *entry = hash_search(cache, &hash, HASH_FIND, NULL);
+
+  if (entry == NULL || strcmp(entry->key, key) != 0) return NULL;
+
+  dlist_move_head(&lru, &entry->lru_node);
+
+  return entry;
+}
+
+bool cached_response_is_fresh(CachedResponse *cached) {
+  return GetCurrentTimestamp() < cached->fresh_until;
+}
+
+void cached_response_add_validators(CachedResponse *cached, CurlHandle *handle) {
+  unshare_request_headers(handle);
+
+  if (cached->etag)
+    EREPORT_CURL_SLIST_APPEND(handle->request_headers,
+                              psprintf("If-None-Match: %s", cached->etag));
+
+  if (cached->last_modified)
+    EREPORT_CURL_SLIST_APPEND(handle->request_headers,
+                              psprintf("If-Modified-Since: %s", cached->last_modified));
+
+  EREPORT_CURL_SETOPT(handle->ez_handle, CURLOPT_HTTPHEADER, handle->request_headers);
+}
+
+static void *copy_varlena(const void *value) {
+  Size  size = VARSIZE(value);
+  void *copy = palloc(size);
+  memcpy(copy, value, size);
+
+  return copy;
+}
+
+// NULL when the column is null
+static void *copy_response_value(Response *response, int column) {
+  return response->nulls[column] == ' ' ? copy_varlena(DatumGetPointer(response->vals[column]))
+                                        : NULL;
+}
+
+Response cached_response_build(CachedResponse *cached) {
+  Response response;
+  Datum   *vals  = response.vals;
+  char    *nulls = response.nulls;
+  MemSet(nulls, 'n', response_natts);
+
+  vals[1]  = Int32GetDatum(cached->status_code);
+  nulls[1] = ' ';
+
+  if (cached->body) {
+    vals[2]  = PointerGetDatum(copy_varlena(cached->body));
+    nulls[2] = ' ';
+  }
+
+  vals[3]  = JsonbPGetDatum(copy_varlena(cached->headers));
+  nulls[3] = ' ';
+
+  if (cached->content_type) {
+    vals[4]  = PointerGetDatum(copy_varlena(cached->content_type));
+    nulls[4] = ' ';
+  }
+
+  vals[5]  = BoolGetDatum(false);
+  nulls[5] = ' ';
+
+  return response;
+}
+
+static char *response_header(CURL *ez_handle, const char *name) {
+  struct curl_header *header;
+
+  if (curl_easy_header(ez_handle, name, 0, CURLH_HEADER, -1, &header) != CURLHE_OK) return NULL;
+
+  return header->value;
+}
+
+// Follows the Cache-Control directives for a shared cache, the worker serves the same response to
+// every role that makes the request
+static CachePolicy cache_policy(CURL *ez_handle, struct curl_slist *request_headers) {
+  CachePolicy policy        = {.storable = true, .max_age_secs = 0};
+  char       *cache_control = response_header(ez_handle, "Cache-Control");
+  bool        is_public     = false;
+  bool        has_s_maxage  = false;
+  bool        no_cache      = false;
+
+  if (cache_control) {
+    char *directives = pstrdup(cache_control);
+    char *saveptr    = NULL;
+
+    for (char *d = strtok_r(directives, ",", &saveptr); d; d = strtok_r(NULL, ",", &saveptr)) {
+      while (*d == ' ' || *d == '\t')
+        d++;
+
+      if (pg_strncasecmp(d, "no-store", 8) == 0 || pg_strncasecmp(d, "private", 7) == 0) {
+        policy.storable = false;
+      } else if (pg_strncasecmp(d, "no-cache", 8) == 0) {
+        no_cache = true;
+      } else if (pg_strncasecmp(d, "public", 6) == 0) {
+        is_public = true;
+      } else if (pg_strncasecmp(d, "s-maxage=", 9) == 0) {
+        policy.max_age_secs = strtol(d + 9, NULL, 10);
+        has_s_maxage        = true;
+      } else if (pg_strncasecmp(d, "max-age=", 8) == 0 && !has_s_maxage) {
+        policy.max_age_secs = strtol(d + 8, NULL, 10);
+      }
+    }
+
+    pfree(directives);
+  }
+
+  // a shared cache can't reuse an authorized response unless the server says so
+  if (has_header(request_headers, "Authorization") && !is_public && !has_s_maxage)
+    policy.storable = false;
+
+  policy.max_age_secs = no_cache ? 0 : Max(policy.max_age_secs, 0);
+
+  return policy;
+}
+
+static char *copy_header(CURL *ez_handle, const char *name) {
+  char *value = response_header(ez_handle, name);
+
+  return value ? pstrdup(value) : NULL;
+}
+
+static void evict_to(Size limit) {
+  while (cached_size > limit && !dlist_is_empty(&lru))
+    remove_cached(dlist_container(CachedResponse, lru_node, dlist_tail_node(&lru)));
+}
+
+static void store_response(CurlHandle *handle, CachePolicy policy) {
+  if (cache == NULL) {
+    cache_context = AllocSetContextCreate(TopMemoryContext, "pg_net response cache",
+                                          ALLOCSET_DEFAULT_SIZES);
+
+    HASHCTL info = {
+      .keysize   = sizeof(uint64),
+      .entrysize = sizeof(CachedResponse),
+      .hcxt      = cache_context,
+    };
+
+    cache = hash_create("pg_net response cache", 256, &info, HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+    dlist_init(&lru);
+    cached_size = 0;
+  }
+
+  uint64          hash  = key_hash(handle->cache_key);
+  CachedResponse *entry = hash_search(cache, &hash, HASH_FIND, NULL);
+
+  if (entry) remove_cached(entry); // an older response or a colliding key
+
+  // built outside of the cache so its garbage goes away with the batch
+  Response response = build_response(handle, CURLE_OK);
+
+  MemoryContext old = MemoryContextSwitchTo(cache_context);
+
+  entry = hash_search(cache, &hash, HASH_ENTER, NULL);
+
+  entry->key           = pstrdup(handle->cache_key);
+  entry->status_code   = DatumGetInt32(response.vals[1]);
+  entry->body          = copy_response_value(&response, 2);
+  entry->headers       = copy_response_value(&response, 3);
+  entry->content_type  = copy_response_value(&response, 4);
+  entry->etag          = copy_header(handle->ez_handle, "ETag");
+  entry->last_modified = copy_header(handle->ez_handle, "Last-Modified");
+  entry->fresh_until   = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+                                                     policy.max_age_secs * 1000);
+
+  MemoryContextSwitchTo(old);
+
+  entry->size = strlen(entry->key) + VARSIZE(entry->headers) +
+                (entry->body ? VARSIZE(entry->body) : 0) +
+                (entry->content_type ? VARSIZE(entry->content_type) : 0) +
+                (entry->etag ? strlen(entry->etag) : 0) +
+                (entry->last_modified ? strlen(entry->last_modified) : 0) + sizeof(CachedResponse);
+
+  dlist_push_head(&lru, &entry->lru_node);
+  cached_size += entry->size;
+
+  evict_to(cache_limit());
+}
+
+CachedResponse *response_cache_update(CurlHandle *handle, CURLcode curl_return_code) {
+  if (cache_limit() == 0 || curl_return_code != CURLE_OK) return NULL;
+
+  long status_code = 0;
+  EREPORT_CURL_GETINFO(handle->ez_handle, CURLINFO_RESPONSE_CODE, &status_code);
+
+  CachePolicy     policy = cache_policy(handle->ez_handle, handle->request_headers);
+  CachedResponse *entry  = response_cache_lookup(handle->cache_key);
+
+  if (status_code == 304 && entry) {
+    char *etag = response_header(handle->ez_handle, "ETag");
+
+    if (etag && strcmp(etag, entry->etag ? entry->etag : "") != 0) {
+      MemoryContext old = MemoryContextSwitchTo(cache_context);
+      if (entry->etag) pfree(entry->etag);
+      entry->etag = pstrdup(etag);
+      MemoryContextSwitchTo(old);
+    }
+
+    entry->fresh_until =
+        TimestampTzPlusMilliseconds(GetCurrentTimestamp(), policy.max_age_secs * 1000);
+
+    return entry;
+  }
+
+  if (status_code != 200) return NULL;
+
+  bool has_validators = response_header(handle->ez_handle, "ETag") ||
+                        response_header(handle->ez_handle, "Last-Modified");
+
+  if (policy.storable && (policy.max_age_secs > 0 || has_validators))
+    store_response(handle, policy);
+  else if (entry)
+    remove_cached(entry);
+
+  return NULL;
+}
+
+void response_cache_reset(void) {
+  if (cache == NULL) return;
+
+  MemoryContextDelete(cache_context);
+
+  cache_context = NULL;
+  cache         = NULL;
+  cached_size   = 0;
+  dlist_init(&lru);
+}
@@ -0,0 +1,33 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+extern int guc_response_cache_size;
+
+typedef struct CachedResponse CachedResponse;
+
+// Identifies the request for coalescing and caching: its url and headers. NULL for requests that
+// aren't a GET, have a body or carry their own conditional headers.
+char *request_key(CurlHandle *handle);
+
+// NULL when the response for the key isn't cached or the cache is disabled
+CachedResponse *response_cache_lookup(const char *key);
+
+// Whether the response can be served without revalidating it with the server
+bool cached_response_is_fresh(CachedResponse *cached);
+
+// Adds the If-None-Match and If-Modified-Since headers of the cached response to the request, so the
+// server can answer with a 304 instead of the whole response
+void cached_response_add_validators(CachedResponse *cached, CurlHandle *handle);
+
+// Copies the cached response into the current memory context, without an id
+Response cached_response_build(CachedResponse *cached);
+
+// Caches the response of a request with a key according to its Cache-Control. When the server
+// answers with a 304, the cached response is refreshed and returned to be used instead, otherwise
+// it returns NULL.
+CachedResponse *response_cache_update(CurlHandle *handle, CURLcode curl_return_code);
+
+// Frees the cached responses
+void response_cache_reset(void);
+
+#endif
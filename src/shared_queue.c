@@ -0,0 +1,321 @@
+#include "pg_prelude.h"
+
+#include "shared_queue.h"
+
+// A byte ring in shared memory, entries are written contiguously (wrapping around the end) and are
+// only read by the worker
+typedef struct {
+  LWLock *lock;
+  uint64  head;     // read position
+  uint64  tail;     // write position
+  uint64  reserved; // bytes reserved by in-progress transactions
+  Size    size;
+  char    data[FLEXIBLE_ARRAY_MEMBER];
+} SharedQueue;
+
+// An entry waiting for its transaction to commit
+typedef struct {
+  SubTransactionId  subid;
+  SharedQueueEntry *entry;
+} PendingEntry;
+
+static const char *shared_queue_tranche = "pg_net shared queue";
+
+int guc_shared_queue_size = 0;
+
+static SharedQueue *shared_queue = NULL;
+
+// lives in the TopTransactionContext, so it's reset on every transaction end
+static List *pending_entries = NIL;
+
+// where the entries the worker popped end, the head only moves there once its batch commits
+static uint64 popped_head = 0;
+static bool   has_popped  = false;
+
+static bool subxact_cb_registered = false;
+
+static Size ring_size(void) {
+  return (Size)guc_shared_queue_size * 1024;
+}
+
+Size shared_queue_shmem_size(void) {
+  if (ring_size() == 0) return 0;
+
+  return add_size(offsetof(SharedQueue, data), ring_size());
+}
+
+void shared_queue_shmem_request(void) {
+  if (ring_size() == 0) return;
+
+  RequestAddinShmemSpace(shared_queue_shmem_size());
+  RequestNamedLWLockTranche(shared_queue_tranche, 1);
+}
+
+// must be called while holding the AddinShmemInitLock
+void shared_queue_shmem_startup(void) {
+  if (ring_size() == 0) return;
+
+  bool found;
+
+  shared_queue = ShmemInitStruct("pg_net shared queue", shared_queue_shmem_size(), &found);
+
+  if (!found) {
+    shared_queue->lock     = &(GetNamedLWLockTranche(shared_queue_tranche))->lock;
+    shared_queue->head     = 0;
+    shared_queue->tail     = 0;
+    shared_queue->reserved = 0;
+    shared_queue->size     = ring_size();
+  }
+}
+
+static void ring_write(uint64 pos, const char *src, Size len) {
+  Size offset = pos % shared_queue->size;
+  Size first  = Min(len, shared_queue->size - offset);
+
+  memcpy(shared_queue->data + offset, src, first);
+  memcpy(shared_queue->data, src + first, len - first);
+}
+
+static void ring_read(uint64 pos, char *dst, Size len) {
+  Size offset = pos % shared_queue->size;
+  Size first  = Min(len, shared_queue->size - offset);
+
+  memcpy(dst, shared_queue->data + offset, first);
+  memcpy(dst + first, shared_queue->data, len - first);
+}
+
+SharedQueueEntry *shared_queue_make_entry(const char *method, const char *url, List *header_lines,
+                                          bytea *body, int32 timeout_milliseconds,
+                                          uint8 store_response) {
+  Size method_len  = strlen(method) + 1;
+  Size url_len     = strlen(url) + 1;
+  Size headers_len = 0;
+  Size body_len    = body ? VARSIZE_ANY_EXHDR(body) : 0;
+
+  ListCell *lc;
+  foreach (lc, header_lines)
+    headers_len += strlen(lfirst(lc)) + 1;
+
+  Size size = add_size(offsetof(SharedQueueEntry, data),
+                       method_len + url_len + headers_len + (body ? body_len + 1 : 0));
+
+  if (size > PG_UINT32_MAX) ereport(ERROR, errmsg("request is too large for the shared queue"));
+
+  SharedQueueEntry *entry = MemoryContextAllocZero(TopTransactionContext, size);
+
+  entry->size                 = size;
+  entry->timeout_milliseconds = timeout_milliseconds;
+  entry->header_count         = list_length(header_lines);
+  entry->body_len             = body ? (int32)body_len : -1;
+  entry->store_response       = store_response;
+
+  char *p = entry->data;
+  memcpy(p, method, method_len);
+  p += method_len;
+  memcpy(p, url, url_len);
+  p += url_len;
+
+  foreach (lc, header_lines) {
+    Size len = strlen(lfirst(lc)) + 1;
+    memcpy(p, lfirst(lc), len);
+    p += len;
+  }
+
+  if (body) memcpy(p, VARDATA_ANY(body), body_len); // zeroed alloc already NUL terminates it
+
+  return entry;
+}
+
+static void release_reservation(uint64 bytes) {
+  if (bytes == 0) return;
+
+  LWLockAcquire(shared_queue->lock, LW_EXCLUSIVE);
+  shared_queue->reserved -= bytes;
+  LWLockRelease(shared_queue->lock);
+}
+
+static void shared_queue_subxact_cb(SubXactEvent event, SubTransactionId mySubid,
+                                    SubTransactionId parentSubid,
+                                    __attribute__((unused)) void *arg) {
+  ListCell *lc;
+
+  switch (event) {
+  case SUBXACT_EVENT_COMMIT_SUB:
+    foreach (lc, pending_entries) {
+      PendingEntry *pe = lfirst(lc);
+      if (pe->subid == mySubid) pe->subid = parentSubid;
+    }
+    break;
+  case SUBXACT_EVENT_ABORT_SUB: {
+    uint64 released = 0;
+    List  *kept     = NIL;
+
+    MemoryContext old = MemoryContextSwitchTo(TopTransactionContext);
+
+    foreach (lc, pending_entries) {
+      PendingEntry *pe = lfirst(lc);
+      if (pe->subid == mySubid)
+        released += pe->entry->size;
+      else
+        kept = lappend(kept, pe);
+    }
+
+    MemoryContextSwitchTo(old);
+
+    pending_entries = kept;
+    release_reservation(released);
+    break;
+  }
+  default: break;
+  }
+}
+
+bool shared_queue_reserve(SharedQueueEntry *entry) {
+  if (shared_queue == NULL) return false;
+
+  LWLockAcquire(shared_queue->lock, LW_EXCLUSIVE);
+
+  uint64 used     = shared_queue->tail - shared_queue->head + shared_queue->reserved;
+  bool   has_room = used + entry->size <= shared_queue->size;
+
+  if (has_room) shared_queue->reserved += entry->size;
+
+  LWLockRelease(shared_queue->lock);
+
+  if (!has_room) return false;
+
+  if (!subxact_cb_registered) {
+    RegisterSubXactCallback(shared_queue_subxact_cb, NULL);
+    subxact_cb_registered = true;
+  }
+
+  MemoryContext old = MemoryContextSwitchTo(TopTransactionContext);
+
+  PendingEntry *pe = palloc(sizeof(PendingEntry));
+  pe->subid        = GetCurrentSubTransactionId();
+  pe->entry        = entry;
+
+  pending_entries = lappend(pending_entries, pe);
+
+  MemoryContextSwitchTo(old);
+
+  return true;
+}
+
+bool shared_queue_has_pending(void) {
+  return pending_entries != NIL;
+}
+
+void shared_queue_at_commit(void) {
+  if (pending_entries == NIL) return;
+
+  ListCell *lc;
+
+  LWLockAcquire(shared_queue->lock, LW_EXCLUSIVE);
+
+  foreach (lc, pending_entries) {
+    SharedQueueEntry *entry = ((PendingEntry *)lfirst(lc))->entry;
+
+    ring_write(shared_queue->tail, (const char *)entry, entry->size);
+    shared_queue->tail += entry->size;
+    shared_queue->reserved -= entry->size;
+  }
+
+  LWLockRelease(shared_queue->lock);
+
+  pending_entries = NIL;
+}
+
+void shared_queue_at_abort(void) {
+  if (pending_entries == NIL) return;
+
+  uint64    released = 0;
+  ListCell *lc;
+
+  foreach (lc, pending_entries)
+    released += ((PendingEntry *)lfirst(lc))->entry->size;
+
+  release_reservation(released);
+
+  pending_entries = NIL;
+}
+
+bool shared_queue_is_empty(void) {
+  if (shared_queue == NULL) return true;
+
+  LWLockAcquire(shared_queue->lock, LW_SHARED);
+  bool is_empty = shared_queue->head == shared_queue->tail;
+  LWLockRelease(shared_queue->lock);
+
+  return is_empty;
+}
+
+List *shared_queue_pop(Oid queue_relid, int max) {
+  List  *entries   = NIL;
+  uint64 discarded = 0;
+
+  if (shared_queue == NULL) return NIL;
+
+  LWLockAcquire(shared_queue->lock, LW_EXCLUSIVE);
+
+  uint64 head = shared_queue->head;
+
+  while (list_length(entries) < max && head != shared_queue->tail) {
+    uint32 size;
+    ring_read(head, (char *)&size, sizeof(uint32));
+
+    SharedQueueEntry *entry = palloc(size);
+    ring_read(head, (char *)entry, size);
+    head += size;
+
+    if (entry->queue_relid != queue_relid) {
+      pfree(entry);
+      discarded++;
+      continue;
+    }
+
+    entries = lappend(entries, entry);
+  }
+
+  LWLockRelease(shared_queue->lock);
+
+  popped_head = head;
+  has_popped  = true;
+
+  if (discarded > 0)
+    elog(DEBUG1, "Discarded " UINT64_FORMAT " shared queue entries of a dropped extension",
+         discarded);
+
+  return entries;
+}
+
+void shared_queue_remove_popped(void) {
+  if (!has_popped) return;
+
+  LWLockAcquire(shared_queue->lock, LW_EXCLUSIVE);
+  shared_queue->head = popped_head;
+  LWLockRelease(shared_queue->lock);
+
+  has_popped = false;
+}
+
+SharedQueueEntryData shared_queue_entry_data(SharedQueueEntry *entry) {
+  SharedQueueEntryData data = {0};
+
+  const char *p = entry->data;
+
+  data.method = p;
+  p += strlen(p) + 1;
+  data.url = p;
+  p += strlen(p) + 1;
+
+  data.headers = palloc(sizeof(char *) * Max(entry->header_count, 1));
+  for (uint32 i = 0; i < entry->header_count; i++) {
+    data.headers[i] = p;
+    p += strlen(p) + 1;
+  }
+
+  data.body = entry->body_len >= 0 ? p : NULL;
+
+  return data;
+}
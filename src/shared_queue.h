@@ -0,0 +1,65 @@
+#ifndef SHARED_QUEUE_H
+#define SHARED_QUEUE_H
+
+// A request stored in the shared queue, the strings are laid out in `data` as:
+// method\0url\0header_1\0...header_n\0body\0
+typedef struct SharedQueueEntry {
+  uint32 size; // size of the whole entry, `data` included
+  int64  id;
+  Oid    queue_relid; // the net.http_request_queue the request belongs to
+  int32  timeout_milliseconds;
+  uint32 header_count;
+  int32  body_len;       // -1 when there's no body
+  uint8  store_response; // a StoreResponse
+  Oid    callback;       // InvalidOid when there's none
+  Oid    enqueued_by;
+  bool   compress_body;
+  char   data[FLEXIBLE_ARRAY_MEMBER];
+} SharedQueueEntry;
+
+// The decoded pointers into a SharedQueueEntry
+typedef struct {
+  const char  *method;
+  const char  *url;
+  const char **headers;
+  const char  *body;
+} SharedQueueEntryData;
+
+extern int guc_shared_queue_size;
+
+Size shared_queue_shmem_size(void);
+
+void shared_queue_shmem_request(void);
+
+void shared_queue_shmem_startup(void);
+
+// Builds an entry in the TopTransactionContext, the header lines must be in the "name: value" form
+SharedQueueEntry *shared_queue_make_entry(const char *method, const char *url, List *header_lines,
+                                          bytea *body, int32 timeout_milliseconds,
+                                          uint8 store_response);
+
+// Reserves space for the entry in the shared queue, the entry is written to the queue when the
+// transaction commits. Returns false when the queue is disabled or doesn't have enough free space.
+bool shared_queue_reserve(SharedQueueEntry *entry);
+
+// Writes the entries reserved by the committed transaction
+void shared_queue_at_commit(void);
+
+// Releases the space reserved by the aborted transaction
+void shared_queue_at_abort(void);
+
+bool shared_queue_has_pending(void);
+
+bool shared_queue_is_empty(void);
+
+// Takes up to `max` entries from the queue, entries that belong to another `queue_relid` (from a
+// dropped extension) are discarded. They stay in the queue until shared_queue_remove_popped() is
+// called, so the ones of a batch that fails are popped again by the restarted worker.
+List *shared_queue_pop(Oid queue_relid, int max);
+
+// Removes the entries of the last pop from the queue, once the batch that sent them committed
+void shared_queue_remove_popped(void);
+
+SharedQueueEntryData shared_queue_entry_data(SharedQueueEntry *entry);
+
+#endif
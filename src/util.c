@@ -66,3 +66,229 @@ Datum _encode_url_with_params_array(PG_FUNCTION_ARGS) {
 
   PG_RETURN_TEXT_P(result);
 }
+
+// Converts a jsonb value to text like `jsonb_each_text` does, json nulls become NULL
+static char *jsonb_value_to_cstring(JsonbValue *v) {
+  switch (v->type) {
+  case jbvNumeric:
+    return DatumGetCString(DirectFunctionCall1(numeric_out, NumericGetDatum(v->val.numeric)));
+  case jbvNull  : return NULL;
+  case jbvString: return pnstrdup(v->val.string.val, v->val.string.len);
+  case jbvBool  : return pstrdup(v->val.boolean ? "true" : "false");
+  default       : return JsonbToCString(NULL, v->val.binary.data, v->val.binary.len);
+  }
+}
+
+static void ensure_jsonb_object(Jsonb *object, const char *what) {
+  if (!JB_ROOT_IS_OBJECT(object) || JB_ROOT_IS_SCALAR(object))
+    ereport(ERROR, errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+            errmsg("%s must be a json object", what));
+}
+
+// The params object as url encoded "key=value" strings, params with a json null value are skipped
+static List *encode_params(Jsonb *params) {
+  List *encoded = NIL;
+
+  ensure_jsonb_object(params, "params");
+
+  JsonbIterator     *it = JsonbIteratorInit(&params->root);
+  JsonbValue         v;
+  JsonbIteratorToken r;
+
+  while ((r = JsonbIteratorNext(&it, &v, true)) != WJB_DONE) {
+    if (r != WJB_KEY) continue;
+
+    char *key = pnstrdup(v.val.string.val, v.val.string.len);
+
+    (void)JsonbIteratorNext(&it, &v, true);
+    char *value = jsonb_value_to_cstring(&v);
+
+    // a json null ends up as a null element in `_encode_url_with_params_array`, which is skipped
+    if (value) {
+      char *enc_key   = curl_easy_escape(NULL, key, strlen(key));
+      char *enc_value = curl_easy_escape(NULL, value, strlen(value));
+
+      if (!enc_key || !enc_value) ereport(ERROR, errmsg("curl_easy_escape returned NULL"));
+
+      encoded = lappend(encoded, psprintf("%s=%s", enc_key, enc_value));
+
+      curl_free(enc_key);
+      curl_free(enc_value);
+      pfree(value);
+    }
+
+    pfree(key);
+  }
+
+  return encoded;
+}
+
+char *encode_url_with_params(const char *url, Jsonb *params) {
+  char *full_url = NULL;
+
+  CURLU *h = curl_url();
+  EREPORT_CURL_URL_SET(h, CURLUPART_URL, url, 0);
+
+  if (params) {
+    List     *encoded = encode_params(params);
+    ListCell *lc;
+
+    foreach (lc, encoded) {
+      char *param = lfirst(lc);
+      EREPORT_CURL_URL_SET(h, CURLUPART_QUERY, param, CURLU_APPENDQUERY);
+    }
+
+    list_free_deep(encoded);
+  }
+
+  EREPORT_CURL_URL_GET(h, CURLUPART_URL, &full_url, 0, url);
+
+  curl_url_cleanup(h);
+
+  char *result = pstrdup(full_url);
+
+  curl_free(full_url);
+
+  return result;
+}
+
+bool is_endpoint_path(const char *path) {
+  return path[0] == '\0' || path[0] == '/' || path[0] == '?';
+}
+
+char *encode_path_with_params(const char *path, Jsonb *params) {
+  if (!is_endpoint_path(path))
+    ereport(ERROR, errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+            errmsg("path must be empty or start with '/' or '?'"));
+
+  if (!params) return pstrdup(path);
+
+  StringInfoData result;
+  List          *encoded = encode_params(params);
+  ListCell      *lc;
+  char           sep     = strchr(path, '?') ? '&' : '?';
+
+  initStringInfo(&result);
+  appendStringInfoString(&result, path);
+
+  foreach (lc, encoded) {
+    appendStringInfoChar(&result, sep);
+    appendStringInfoString(&result, lfirst(lc));
+    sep = '&';
+  }
+
+  list_free_deep(encoded);
+
+  return result.data;
+}
+
+void validate_headers(Jsonb *headers) {
+  ensure_jsonb_object(headers, "headers");
+
+  JsonbIterator     *it = JsonbIteratorInit(&headers->root);
+  JsonbValue         v;
+  JsonbIteratorToken r;
+
+  while ((r = JsonbIteratorNext(&it, &v, true)) != WJB_DONE) {
+    if (r != WJB_KEY && r != WJB_VALUE) continue;
+
+    // a CR or LF would let the header end early and smuggle another header or a body
+    if (v.type == jbvString &&
+        (memchr(v.val.string.val, '\r', v.val.string.len) ||
+         memchr(v.val.string.val, '\n', v.val.string.len)))
+      ereport(ERROR, errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+              errmsg("header %s cannot contain line breaks", r == WJB_KEY ? "names" : "values"));
+  }
+}
+
+char *jsonb_object_get_text_ci(Jsonb *object, const char *key) {
+  JsonbIterator     *it = JsonbIteratorInit(&object->root);
+  JsonbValue         v;
+  JsonbIteratorToken r;
+  size_t             keylen = strlen(key);
+
+  while ((r = JsonbIteratorNext(&it, &v, true)) != WJB_DONE) {
+    if (r != WJB_KEY) continue;
+
+    bool matches = (size_t)v.val.string.len == keylen &&
+                   pg_strncasecmp(v.val.string.val, key, keylen) == 0;
+
+    (void)JsonbIteratorNext(&it, &v, true);
+
+    if (matches) return jsonb_value_to_cstring(&v);
+  }
+
+  return NULL;
+}
+
+struct curl_slist *jsonb_headers_to_slist(Jsonb *headers, struct curl_slist *list) {
+  JsonbIterator     *it = JsonbIteratorInit(&headers->root);
+  JsonbValue         v;
+  JsonbIteratorToken r;
+  StringInfoData     line;
+
+  initStringInfo(&line);
+
+  while ((r = JsonbIteratorNext(&it, &v, true)) != WJB_DONE) {
+    if (r != WJB_KEY) continue;
+
+    resetStringInfo(&line);
+    appendBinaryStringInfo(&line, v.val.string.val, v.val.string.len);
+    appendStringInfoString(&line, ": ");
+
+    (void)JsonbIteratorNext(&it, &v, true);
+
+    // strings, the usual header values, are appended without a copy
+    if (v.type == jbvString) {
+      appendBinaryStringInfo(&line, v.val.string.val, v.val.string.len);
+    } else {
+      char *value = jsonb_value_to_cstring(&v);
+
+      if (value == NULL) continue;
+
+      appendStringInfoString(&line, value);
+      pfree(value);
+    }
+
+    EREPORT_CURL_SLIST_APPEND(list, line.data);
+  }
+
+  pfree(line.data);
+
+  return list;
+}
+
+List *jsonb_headers_to_lines(Jsonb *headers) {
+  List              *lines = NIL;
+  JsonbIterator     *it    = JsonbIteratorInit(&headers->root);
+  JsonbValue         v;
+  JsonbIteratorToken r;
+
+  while ((r = JsonbIteratorNext(&it, &v, true)) != WJB_DONE) {
+    if (r != WJB_KEY) continue;
+
+    char *key = pnstrdup(v.val.string.val, v.val.string.len);
+
+    (void)JsonbIteratorNext(&it, &v, true);
+    char *value = jsonb_value_to_cstring(&v);
+
+    if (value) lines = lappend(lines, psprintf("%s: %s", key, value));
+
+    pfree(key);
+  }
+
+  return lines;
+}
+
+Oid get_rel_owner(Oid relid) {
+  HeapTuple tuple = SearchSysCache1(RELOID, ObjectIdGetDatum(relid));
+
+  if (!HeapTupleIsValid(tuple))
+    ereport(ERROR, errmsg("cache lookup failed for relation %u", relid));
+
+  Oid owner = ((Form_pg_class)GETSTRUCT(tuple))->relowner;
+
+  ReleaseSysCache(tuple);
+
+  return owner;
+}
@@ -1,4 +1,35 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+// Appends the url encoded key/value pairs of the `params` object to the query string of `url`, like
+// `net._encode_url_with_params_array` does for an already encoded array
+char *encode_url_with_params(const char *url, Jsonb *params);
+
+// Whether `path` is empty or starts with '/' or '?', so that it can't change the host of the base
+// url of an endpoint it's appended to
+bool is_endpoint_path(const char *path);
+
+// Same as encode_url_with_params for the path of an endpoint request, which is empty or starts with
+// '/' or '?'
+char *encode_path_with_params(const char *path, Jsonb *params);
+
+// Errors if `headers` is not a json object or if any of its keys or values contain a line break
+void validate_headers(Jsonb *headers);
+
+// Gets the text value of the first key that case insensitively matches `key` in a jsonb object,
+// same as a `jsonb_each_text` lookup. Returns NULL when not found or when the value is a json null.
+char *jsonb_object_get_text_ci(Jsonb *object, const char *key);
+
+// Formats the headers object as "name: value" lines, like the worker does when dequeuing. Headers
+// with a json null value are skipped.
+List *jsonb_headers_to_lines(Jsonb *headers);
+
+// Appends the headers object to the list as "name: value" lines, in a single pass over the jsonb.
+// Headers with a json null value are skipped.
+struct curl_slist *jsonb_headers_to_slist(Jsonb *headers, struct curl_slist *list);
+
+// The owner of the relation, the request functions write to the queue as it on behalf of roles
+// that can't write to it themselves
+Oid get_rel_owner(Oid relid);
+
 #endif
@@ -8,10 +8,20 @@
 
 #include "curl_prelude.h"
 
+#include "batch_size.h"
+#include "cancel.h"
+#include "circuit_breaker.h"
 #include "core.h"
+#include "endpoints.h"
+#include "endpoint_members.h"
 #include "errors.h"
 #include "event.h"
+#include "hedge.h"
+#include "queue_depth.h"
+#include "response_cache.h"
+#include "shared_queue.h"
 #include "util.h"
+#include "worker.h"
 
 #define MIN_LIBCURL_VERSION_NUM                                                                    \
   0x075300 // This is the 7.83.0 version in hex as defined in curl/curlver.h
@@ -28,6 +38,8 @@ PG_MODULE_MAGIC;
 typedef enum {
   WORKER_WAIT_NO_TIMEOUT,
   WORKER_WAIT_ONE_SECOND,
+  WORKER_WAIT_NONE,
+  WORKER_WAIT_NEXT_EXPIRY,
 } WorkerWait;
 
 static WorkerState *worker_state = NULL;
@@ -36,13 +48,79 @@ static const int    curl_handle_event_timeout_ms = 1000;
 static const int    net_worker_restart_time_sec  = 1;
 static const long   no_timeout                   = -1L;
 static bool         wake_commit_cb_active        = false;
+static bool         xact_cb_registered           = false;
 static bool         worker_should_restart        = false;
-static const size_t total_extension_tables       = 2;
+static const size_t total_extension_tables       = 5;
+static const long   min_expiry_interval_ms       = 1000;
+static const long   max_expiry_interval_ms       = 60 * 1000;
+static TimestampTz  next_expiry_at               = 0;
+static bool         may_have_responses           = true; // unknown until the first expiry pass
+
+// responses waiting for their callbacks, they outlive the transaction that got them
+static MemoryContext completions_context = NULL;
+static List         *completions         = NIL;
+
+// seq of the last response stored in the current batch, 0 when none was stored
+static int64 last_stored_seq = 0;
+
+// most of the rows a batch took from the queue weren't sent, because they expired or were dropped
+// or cancelled, the next batch fails the rest of them in bulk
+static bool queue_has_failed = false;
+
+// the queue depth counts start at 0 while the unlogged queue outlives a clean restart
+static bool queue_depth_counted = false;
 
 static char *guc_ttl;
 static int   guc_batch_size;
+static bool  guc_adaptive_batch_size;
+static bool  guc_coalesce_requests;
+static int   guc_min_batch_size;
 static char *guc_database_name;
 static char *guc_username;
+static char *guc_notify_channel;
+
+int guc_max_queue_age = 0;
+
+static const struct config_enum_entry event_backend_options[] = {
+#ifdef WAIT_USE_EPOLL
+  {"epoll", EVENT_BACKEND_EPOLL, false},
+#else
+  {"kqueue", EVENT_BACKEND_KQUEUE, false},
+#endif
+#ifdef WAIT_USE_IO_URING
+  {"io_uring", EVENT_BACKEND_IO_URING, false},
+#endif
+  {NULL, 0, false},
+};
+
+static const struct config_enum_entry hedge_policy_options[] = {
+  {"off", HEDGE_OFF, false},
+  {"delay", HEDGE_DELAY, false},
+  {"p95", HEDGE_P95, false},
+  {NULL, 0, false},
+};
+
+static const struct config_enum_entry queue_full_action_options[] = {
+  {"reject", QUEUE_FULL_REJECT, false},
+  {"wait", QUEUE_FULL_WAIT, false},
+  {"drop_oldest", QUEUE_FULL_DROP_OLDEST, false},
+  {NULL, 0, false},
+};
+
+// the batch size in use when pg_net.adaptive_batch_size is on, and what's observed to adapt it
+static BatchSizeController batch_size_ctl;
+static BatchObservation    batch_obs;
+
+// the requests sent in the current batch by their cache_key, to coalesce the identical ones
+static HTAB *in_flight = NULL;
+
+// the part of event_syscalls already added to the worker stats
+static uint64 published_event_syscalls = 0;
+
+// Ready events are read into this buffer, reused by every wait. When more sockets are ready than it
+// holds, the rest are returned by the next wait since sockets are level-triggered.
+enum { max_wait_events = 1024 };
+static event wait_events[max_wait_events];
 
 #if PG15_GTE
 static shmem_request_hook_type prev_shmem_request_hook = NULL;
@@ -69,6 +147,14 @@ Datum worker_restart(__attribute__((unused)) PG_FUNCTION_ARGS) {
                           // backward compatibility
 }
 
+static int current_batch_size(void) {
+  return guc_adaptive_batch_size ? batch_size_ctl.size : guc_batch_size;
+}
+
+static void publish_batch_size(void) {
+  pg_atomic_write_u32(&worker_state->stats.batch_size, (uint32)current_batch_size());
+}
+
 static void wait_until_state(WorkerState *ws, WorkerStatus expected_status) {
   if (pg_atomic_read_u32(&ws->status) ==
       expected_status) // fast return without sleeping, in case condition is fulfilled
@@ -95,8 +181,17 @@ static void wake_at_commit(XactEvent event, __attribute__((unused)) void *arg) {
   elog(DEBUG2, "pg_net xact callback received: %s", xact_event_name(event));
 
   switch (event) {
+  // the shared queue entries only live in this backend's memory until commit
+  case XACT_EVENT_PRE_PREPARE:
+    if (shared_queue_has_pending())
+      ereport(ERROR, errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+              errmsg("cannot PREPARE a transaction that has enqueued requests in the pg_net "
+                     "shared queue"));
+    break;
   case XACT_EVENT_COMMIT:
   case XACT_EVENT_PARALLEL_COMMIT:
+    shared_queue_at_commit();
+
     if (wake_commit_cb_active) {
       uint32 expected = 0;
       bool   success  = pg_atomic_compare_exchange_u32(&worker_state->should_wake, &expected, 1);
@@ -116,21 +211,63 @@ static void wake_at_commit(XactEvent event, __attribute__((unused)) void *arg) {
   case XACT_EVENT_PREPARE:
   // abort the callback on rollback
   case XACT_EVENT_ABORT:
-  case XACT_EVENT_PARALLEL_ABORT: wake_commit_cb_active = false; break;
-  default                       : break;
+  case XACT_EVENT_PARALLEL_ABORT:
+    shared_queue_at_abort();
+    wake_commit_cb_active = false;
+    break;
+  default: break;
   }
 }
 
-PG_FUNCTION_INFO_V1(wake);
-Datum wake(__attribute__((unused)) PG_FUNCTION_ARGS) {
-  if (!wake_commit_cb_active) { // register only one callback per transaction
+void wake_worker_at_commit(void) {
+  if (!xact_cb_registered) { // the callback stays registered for the life of the backend
     RegisterXactCallback(wake_at_commit, NULL);
-    wake_commit_cb_active = true;
+    xact_cb_registered = true;
   }
 
+  wake_commit_cb_active = true;
+}
+
+PG_FUNCTION_INFO_V1(wake);
+Datum wake(__attribute__((unused)) PG_FUNCTION_ARGS) {
+  wake_worker_at_commit();
+
   PG_RETURN_VOID();
 }
 
+PG_FUNCTION_INFO_V1(worker_stats);
+Datum worker_stats(PG_FUNCTION_ARGS) {
+  TupleDesc tupdesc;
+
+  if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+    ereport(ERROR, errmsg("return type must be a row type"));
+
+  WorkerStats *stats = &worker_state->stats;
+
+  Datum values[] = {
+    Int64GetDatum((int64)pg_atomic_read_u64(&stats->requests_succeeded)),
+    Int64GetDatum((int64)pg_atomic_read_u64(&stats->requests_http_error)),
+    Int64GetDatum((int64)pg_atomic_read_u64(&stats->requests_failed)),
+    Int64GetDatum((int64)pg_atomic_read_u64(&stats->responses_skipped)),
+    Int64GetDatum((int64)pg_atomic_read_u64(&stats->bodies_compressed)),
+    Int64GetDatum((int64)pg_atomic_read_u64(&stats->body_bytes_saved)),
+    Int64GetDatum((int64)pg_atomic_read_u64(&stats->event_syscalls)),
+    Int64GetDatum((int64)pg_atomic_read_u64(&stats->event_wakeups)),
+    Int32GetDatum((int32)pg_atomic_read_u32(&stats->batch_size)),
+    Int64GetDatum((int64)pg_atomic_read_u64(&stats->requests_coalesced)),
+    Int64GetDatum((int64)pg_atomic_read_u64(&stats->cache_hits)),
+    Int64GetDatum((int64)pg_atomic_read_u64(&stats->requests_expired)),
+    Int64GetDatum((int64)pg_atomic_read_u64(&stats->requests_cancelled)),
+    Int64GetDatum((int64)pg_atomic_read_u64(&stats->requests_hedged)),
+    Int64GetDatum((int64)pg_atomic_read_u64(&stats->hedges_won)),
+    Int64GetDatum((int64)pg_atomic_read_u64(&stats->requests_failed_over)),
+    Int64GetDatum((int64)pg_atomic_read_u64(&stats->config_loads)),
+  };
+  bool nulls[lengthof(values)] = {0};
+
+  PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(BlessTupleDesc(tupdesc), values, nulls)));
+}
+
 static void handle_sigterm(PG_SIGNAL_PARAMS) {
   int save_errno = errno;
   pg_atomic_write_u32(&worker_state->got_restart, 1);
@@ -159,6 +296,10 @@ static void handle_sigusr1(PG_SIGNAL_PARAMS) {
   procsignal_sigusr1_handler(PG_SIGNAL_ARGS);
 }
 
+// net.cancel() only needs to interrupt the wait on the sockets, the cancelled requests are looked
+// up after it
+static void handle_sigusr2(PG_SIGNAL_PARAMS) {}
+
 static void publish_state(WorkerStatus s) {
   pg_atomic_write_u32(&worker_state->status, (uint32)s);
   pg_write_barrier();
@@ -172,6 +313,8 @@ static void net_on_exit(__attribute__((unused)) int code, __attribute__((unused)
 
   worker_state->shared_latch = NULL;
 
+  cancel_batch_finished();
+
   ev_monitor_close(worker_state);
 
   curl_multi_cleanup(worker_state->curl_mhandle);
@@ -191,6 +334,15 @@ static void wait_while_processing_interrupts(WorkerWait ww, bool *should_restart
               PG_WAIT_EXTENSION);
     ResetLatch(worker_state->shared_latch);
     break;
+  case WORKER_WAIT_NONE: break;
+  case WORKER_WAIT_NEXT_EXPIRY: {
+    long timeout = TimestampDifferenceMilliseconds(GetCurrentTimestamp(), next_expiry_at);
+
+    WaitLatch(worker_state->shared_latch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+              timeout, PG_WAIT_EXTENSION);
+    ResetLatch(worker_state->shared_latch);
+    break;
+  }
   }
 
   CHECK_FOR_INTERRUPTS();
@@ -198,6 +350,22 @@ static void wait_while_processing_interrupts(WorkerWait ww, bool *should_restart
   if (got_sighup) {
     got_sighup = false;
     ProcessConfigFile(PGC_SIGHUP);
+    next_expiry_at = 0; // the ttl might have changed, reschedule the expiry with it
+
+    if (guc_adaptive_batch_size)
+      batch_size_clamp(&batch_size_ctl, guc_min_batch_size, guc_batch_size);
+    else
+      batch_size_reset(&batch_size_ctl, guc_batch_size);
+
+    publish_batch_size();
+
+    if (guc_circuit_breaker_failures == 0) circuit_breaker_reset();
+
+    if (guc_response_cache_size == 0) response_cache_reset();
+
+    load_static_resolve();
+
+    pg_atomic_fetch_add_u64(&worker_state->stats.config_loads, 1);
   }
 
   if (pg_atomic_exchange_u32(&worker_state->got_restart, 0)) {
@@ -212,38 +380,629 @@ static bool is_extension_locked(Oid ext_table_oids[static total_extension_tables
     return false;
   }
 
-  Oid queue_oid = get_relname_relid("http_request_queue", net_oid);
-  Oid resp_oid  = get_relname_relid("_http_response", net_oid);
-
-  /*
-   * The "net" schema can exist without the extension tables, e.g. when another
-   * extension is installed into a schema named "net". ConditionalLockRelationOid
-   * doesn't validate the oid, so locking InvalidOid would succeed and the worker
-   * would crash loop on the queries that follow.
-   */
-  if (!OidIsValid(queue_oid) || !OidIsValid(resp_oid)) {
-    ereport(WARNING,
-            errmsg("schema \"net\" exists but the pg_net extension tables are missing, skipping "
-                   "request processing"),
-            errhint("The schema \"net\" might be used by another extension or be left over from a "
-                    "partially dropped pg_net installation."));
+  // the queue and the responses come first and the response chunks last, their oids are used by
+  // the callers. The batch query reads the others, locking them here keeps it from waiting on a
+  // DROP EXTENSION that holds them while it waits on the queue.
+  const char *table_names[] = {"http_request_queue", "_http_response", "endpoints", "role_quotas",
+                               "_http_response_chunks"};
+  Oid         table_oids[total_extension_tables];
+
+  for (size_t i = 0; i < total_extension_tables; i++) {
+    table_oids[i] = get_relname_relid(table_names[i], net_oid);
+
+    /*
+     * The "net" schema can exist without the extension tables, e.g. when another
+     * extension is installed into a schema named "net". ConditionalLockRelationOid
+     * doesn't validate the oid, so locking InvalidOid would succeed and the worker
+     * would crash loop on the queries that follow.
+     */
+    if (!OidIsValid(table_oids[i])) {
+      ereport(WARNING,
+              errmsg("schema \"net\" exists but the pg_net extension tables are missing, skipping "
+                     "request processing"),
+              errhint("The schema \"net\" might be used by another extension or be left over from "
+                      "a partially dropped pg_net installation."));
+      return false;
+    }
+  }
+
+  for (size_t i = 0; i < total_extension_tables; i++)
+    if (!ConditionalLockRelationOid(table_oids[i], AccessShareLock)) return false;
+
+  for (size_t i = 0; i < total_extension_tables; i++)
+    ext_table_oids[i] = table_oids[i];
+
+  return true;
+}
+
+static void unlock_extension(Oid ext_table_oids[static total_extension_tables]) {
+  for (size_t i = 0; i < total_extension_tables; i++)
+    UnlockRelationOid(ext_table_oids[i], AccessShareLock);
+}
+
+// Counts the outcome of a request and stores its response unless it's not wanted. The response
+// comes from the cache when there's one, otherwise from the transfer: the request's own handle or
+// the one it was coalesced into.
+static void finish_request(CurlHandle *request, CurlHandle *transfer, CachedResponse *cached,
+                           CURLcode curl_return_code, RequestOutcome outcome) {
+  WorkerStats *stats = &worker_state->stats;
+
+  request->finished = true;
+
+  if (request->store_response == STORE_RESPONSE_CHUNKED)
+    end_response_chunks(request, curl_return_code);
+
+  switch (outcome) {
+  case REQUEST_SUCCEEDED:  pg_atomic_fetch_add_u64(&stats->requests_succeeded, 1); break;
+  case REQUEST_HTTP_ERROR: pg_atomic_fetch_add_u64(&stats->requests_http_error, 1); break;
+  case REQUEST_FAILED:     pg_atomic_fetch_add_u64(&stats->requests_failed, 1); break;
+  }
+
+  if (cached) pg_atomic_fetch_add_u64(&stats->cache_hits, 1);
+  if (request != transfer) pg_atomic_fetch_add_u64(&stats->requests_coalesced, 1);
+
+  bool store        = should_store_response(request, outcome);
+  bool has_callback = OidIsValid(request->callback);
+
+  if (!store) pg_atomic_fetch_add_u64(&stats->responses_skipped, 1);
+
+  if (!store && !has_callback) return;
+
+  // a response for a callback is built where it survives the commit of the batch
+  MemoryContext old =
+      MemoryContextSwitchTo(has_callback ? completions_context : CurrentMemoryContext);
+
+  Response response =
+      cached ? cached_response_build(cached) : build_response(transfer, curl_return_code);
+
+  response.vals[0]  = Int64GetDatum(request->id);
+  response.nulls[0] = ' ';
+
+  if (has_callback) {
+    Completion *completion = palloc(sizeof(Completion));
+    completion->callback   = request->callback;
+    completion->role       = request->enqueued_by;
+    completion->response   = response;
+
+    completions = lappend(completions, completion);
+  }
+
+  MemoryContextSwitchTo(old);
+
+  if (store) last_stored_seq = insert_response(&response);
+}
+
+// Finishes the requests of a completed transfer, the request of its handle and the ones coalesced
+// into it
+static void complete_request(CurlHandle *handle, CURLcode curl_return_code) {
+  WorkerStats    *stats   = &worker_state->stats;
+  RequestOutcome  outcome = get_request_outcome(handle, curl_return_code);
+  CachedResponse *cached  = NULL;
+
+  // a request rejected by the circuit breaker says nothing about its upstream
+  if (handle->rejected_msg == NULL) {
+    circuit_breaker_record(handle->circuit_host, curl_return_code);
+
+    if (outcome == REQUEST_FAILED) {
+      batch_obs.failures++;
+    } else {
+      curl_off_t total_time_us = 0;
+      EREPORT_CURL_GETINFO(handle->ez_handle, CURLINFO_TOTAL_TIME_T, &total_time_us);
+      batch_obs.responses++;
+      batch_obs.latency_ms += total_time_us / 1000.0;
+    }
+  }
+
+  if (handle->body_bytes_saved > 0) {
+    pg_atomic_fetch_add_u64(&stats->bodies_compressed, 1);
+    pg_atomic_fetch_add_u64(&stats->body_bytes_saved, handle->body_bytes_saved);
+  }
+
+  // a 304 to a revalidation gets the cached response instead
+  if (handle->cache_key) cached = response_cache_update(handle, curl_return_code);
+  if (cached) outcome = REQUEST_SUCCEEDED;
+
+  // a cancelled request is already finished
+  if (!handle->finished) finish_request(handle, handle, cached, curl_return_code, outcome);
+
+  ListCell *lc;
+  foreach (lc, handle->coalesced) {
+    CurlHandle *request = lfirst(lc);
+    if (!request->finished) finish_request(request, handle, cached, curl_return_code, outcome);
+  }
+}
+
+// Makes the request the one that's sent for its key in this batch, returns the request that already
+// is when there's one it can be coalesced into
+static CurlHandle *coalesce_request(CurlHandle *handle) {
+  typedef struct {
+    uint64      hash; // of the cache_key
+    CurlHandle *leader;
+  } InFlight;
+
+  if (in_flight == NULL) {
+    HASHCTL info = {
+      .keysize   = sizeof(uint64),
+      .entrysize = sizeof(InFlight),
+      .hcxt      = CurrentMemoryContext,
+    };
+
+    in_flight = hash_create("pg_net in flight requests", 256, &info,
+                            HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+  }
+
+  uint64 hash = DatumGetUInt64(hash_any_extended((const unsigned char *)handle->cache_key,
+                                                 strlen(handle->cache_key), 0));
+  bool   found;
+
+  InFlight *entry = hash_search(in_flight, &hash, HASH_ENTER, &found);
+
+  if (!found) {
+    entry->leader = handle;
+    return NULL;
+  }
+
+  CurlHandle *leader = entry->leader;
+
+  // a different timeout could change the outcome, and colliding hashes are different requests
+  if (leader->timeout_milliseconds != handle->timeout_milliseconds ||
+      strcmp(leader->cache_key, handle->cache_key) != 0)
+    return NULL;
+
+  return leader;
+}
+
+// Only GETs without a body are hedged, sending them twice has no side effect. A chunked body is
+// written out as it arrives, so it can't come from two transfers.
+static bool is_hedgeable(CurlHandle *handle) {
+  return strcasecmp(handle->method, "GET") == 0 && handle->req_body == NULL &&
+         handle->store_response != STORE_RESPONSE_CHUNKED;
+}
+
+// Points the transfer of a request to an endpoint with members at one of them, with `timeout_ms`
+// left for the request. Each member it wasn't sent to yet gets an equal share of it to connect, so
+// the ones after a member that doesn't answer can still be tried.
+static void send_to_member(CurlHandle *handle, int member, long timeout_ms) {
+  Endpoint *group   = handle->group;
+  int       untried = group->member_count - __builtin_popcountll(handle->tried_members);
+  char     *url     = psprintf("%s%s", group->member_urls[member], handle->path);
+
+  EREPORT_CURL_SETOPT(handle->ez_handle, CURLOPT_URL, url);
+  EREPORT_CURL_SETOPT(handle->ez_handle, CURLOPT_TIMEOUT_MS, timeout_ms);
+  EREPORT_CURL_SETOPT(handle->ez_handle, CURLOPT_CONNECTTIMEOUT_MS,
+                      untried > 1 ? Max(timeout_ms / untried, 1L) : 0L);
+
+  pfree(url);
+
+  handle->member = member;
+  handle->tried_members |= UINT64CONST(1) << member;
+
+  endpoint_member_started(group->id, member);
+}
+
+// Adds the request to the multi handle. It's not added, and false is returned, when:
+// - it was dropped from the queue or the path of its endpoint is invalid, it's completed right away
+//   without being sent
+// - it expired in the queue, it's completed right away without being sent
+// - its response is fresh in the cache, it's finished right away
+// - the circuit of its host is open, it's completed right away without being sent
+// - an identical request is in flight, it gets the response of that one
+// A request to an endpoint with members goes to the one its balance policy picks.
+static bool start_request(CurlHandle *handle) {
+  if (handle->rejected_msg) {
+    complete_request(handle, CURLE_ABORTED_BY_CALLBACK);
+    return false;
+  }
+
+  if (handle->expired) {
+    pg_atomic_fetch_add_u64(&worker_state->stats.requests_expired, 1);
+    handle->rejected_msg = pstrdup(REQUEST_EXPIRED_MSG);
+    complete_request(handle, CURLE_OPERATION_TIMEDOUT);
     return false;
   }
 
-  bool is_locked = ConditionalLockRelationOid(queue_oid, AccessShareLock) &&
-                   ConditionalLockRelationOid(resp_oid, AccessShareLock);
+  if (handle->circuit_host == NULL && handle->group == NULL)
+    handle->circuit_host = circuit_breaker_host(handle->url);
+
+  CachedResponse *cached = NULL;
+
+  if (guc_coalesce_requests || guc_response_cache_size > 0) handle->cache_key = request_key(handle);
 
-  if (is_locked) {
-    ext_table_oids[0] = queue_oid;
-    ext_table_oids[1] = resp_oid;
+  if (handle->cache_key) cached = response_cache_lookup(handle->cache_key);
+
+  if (cached && cached_response_is_fresh(cached)) {
+    finish_request(handle, handle, cached, CURLE_OK, REQUEST_SUCCEEDED);
+    return false;
+  }
+
+  if (!circuit_breaker_allows(handle->circuit_host)) {
+    handle->rejected_msg = psprintf("Request not sent, the circuit breaker for %s is open",
+                                    handle->circuit_host);
+    complete_request(handle, CURLE_COULDNT_CONNECT);
+    return false;
   }
 
-  return is_locked;
+  if (handle->cache_key && guc_coalesce_requests) {
+    CurlHandle *leader = coalesce_request(handle);
+
+    if (leader) {
+      leader->coalesced = lappend(leader->coalesced, handle);
+      return false;
+    }
+  }
+
+  if (cached) cached_response_add_validators(cached, handle);
+
+  if (handle->group) {
+    handle->deadline =
+        TimestampTzPlusMilliseconds(GetCurrentTimestamp(), handle->timeout_milliseconds);
+    send_to_member(handle, endpoint_member_pick(handle->group, 0), handle->timeout_milliseconds);
+  }
+
+  EREPORT_MULTI(curl_multi_add_handle(worker_state->curl_mhandle, handle->ez_handle));
+  handle->sent = true;
+
+  if (guc_hedge_policy != HEDGE_OFF) {
+    handle->sent_at = GetCurrentTimestamp();
+    hedge_count_transfer();
+
+    if (guc_hedge_policy == HEDGE_P95 && is_hedgeable(handle))
+      handle->latency_host =
+          handle->circuit_host ? pstrdup(handle->circuit_host) : circuit_host_of(handle->url);
+  }
+
+  return true;
 }
 
-static void unlock_extension(Oid ext_table_oids[static total_extension_tables]) {
-  UnlockRelationOid(ext_table_oids[0], AccessShareLock);
-  UnlockRelationOid(ext_table_oids[1], AccessShareLock);
+// Whether requests coalesced into the handle still wait for its transfer
+static bool has_waiting_requests(CurlHandle *handle) {
+  ListCell *lc;
+  foreach (lc, handle->coalesced) {
+    if (!((CurlHandle *)lfirst(lc))->finished) return true;
+  }
+  return false;
+}
+
+// Finishes the requests of the batch whose cancellation was asked with a "Request cancelled"
+// error, and tells net.cancel() whether they were. Returns the number of transfers it removed from
+// the multi handle, the transfer of a cancelled request goes on when identical requests coalesced
+// into it wait for it.
+static int cancel_requests(CurlHandle *handles, uint64 count) {
+  PendingCancel cancels[max_pending_cancels];
+  int           pending = cancel_take_pending(cancels);
+  int           removed = 0;
+
+  for (int i = 0; i < pending; i++) {
+    bool cancelled = false;
+
+    for (uint64 j = 0; j < count; j++) {
+      CurlHandle *handle = &handles[j];
+
+      if (handle->id != cancels[i].id || handle->finished) continue;
+
+      cancelled = true;
+
+      pg_atomic_fetch_add_u64(&worker_state->stats.requests_cancelled, 1);
+
+      handle->rejected_msg = pstrdup("Request cancelled");
+      finish_request(handle, handle, NULL, CURLE_ABORTED_BY_CALLBACK, REQUEST_FAILED);
+
+      if (handle->sent && !has_waiting_requests(handle)) {
+        EREPORT_MULTI(curl_multi_remove_handle(worker_state->curl_mhandle, handle->ez_handle));
+        handle->sent = false;
+        removed++;
+
+        if (handle->group)
+          endpoint_member_finished(handle->group->id, handle->member, CURLE_ABORTED_BY_CALLBACK,
+                                   -1);
+
+        if (handle->hedge_ez_handle) {
+          EREPORT_MULTI(
+              curl_multi_remove_handle(worker_state->curl_mhandle, handle->hedge_ez_handle));
+          removed++;
+        }
+      } else {
+        // the requests coalesced into it get the response of the transfer
+        pfree(handle->rejected_msg);
+        handle->rejected_msg = NULL;
+      }
+
+      break;
+    }
+
+    cancel_answer(cancels[i], cancelled);
+  }
+
+  return removed;
+}
+
+// Sends a duplicate of the GETs that run longer than their hedge delay, as long as the budget of
+// pg_net.hedge_max_percent allows it. A request is considered once, when its delay passes. Returns
+// how long the wait on the sockets can last before the next request is due.
+static int hedge_requests(CurlHandle *handles, uint64 count, int *running_handles) {
+  TimestampTz now     = GetCurrentTimestamp();
+  long        wait_ms = curl_handle_event_timeout_ms;
+
+  for (uint64 i = 0; i < count; i++) {
+    CurlHandle *handle = &handles[i];
+
+    if (!handle->sent || handle->hedged || !is_hedgeable(handle)) continue;
+
+    long elapsed_ms = TimestampDifferenceMilliseconds(handle->sent_at, now);
+    long delay_ms   = hedge_delay_ms(handle->latency_host);
+
+    if (elapsed_ms < delay_ms) {
+      wait_ms = Min(wait_ms, delay_ms - elapsed_ms);
+      continue;
+    }
+
+    handle->hedged = true;
+
+    if (elapsed_ms >= handle->timeout_milliseconds || !hedge_take_budget()) continue;
+
+    init_hedge(handle, elapsed_ms);
+    EREPORT_MULTI(curl_multi_add_handle(worker_state->curl_mhandle, handle->hedge_ez_handle));
+    (*running_handles)++;
+
+    pg_atomic_fetch_add_u64(&worker_state->stats.requests_hedged, 1);
+  }
+
+  return (int)wait_ms;
+}
+
+// The first of the two transfers of a hedged request finished. The first response completes the
+// request and the slower transfer is removed, a failure waits for the other transfer instead.
+// Returns whether the request is complete.
+static bool settle_hedge(CurlHandle *handle, CURL *finished, CURLcode curl_return_code,
+                         int *running_handles) {
+  bool hedge_finished = finished == handle->hedge_ez_handle;
+
+  // the transfer that's kept goes in ez_handle, the other one in hedge_ez_handle
+  if ((curl_return_code == CURLE_OK) == hedge_finished) use_hedge(handle);
+
+  if (curl_return_code == CURLE_OK && hedge_finished)
+    pg_atomic_fetch_add_u64(&worker_state->stats.hedges_won, 1);
+
+  EREPORT_MULTI(curl_multi_remove_handle(worker_state->curl_mhandle, handle->hedge_ez_handle));
+  curl_easy_cleanup(handle->hedge_ez_handle);
+  destroyStringInfo(handle->hedge_body);
+
+  handle->hedge_ez_handle = NULL;
+  handle->hedge_body      = NULL;
+
+  // the removed transfer might have been running or done, curl has the count
+  EREPORT_MULTI(curl_multi_socket_action(worker_state->curl_mhandle, CURL_SOCKET_TIMEOUT, 0,
+                                         running_handles));
+
+  return curl_return_code == CURLE_OK;
+}
+
+// Writes the chunks the paused transfers filled and resumes them. Returns how many were paused,
+// curl can fill another chunk with the data it hands to a transfer that's resumed.
+static int resume_transfers(CurlHandle *handles, uint64 count) {
+  int paused = 0;
+
+  for (uint64 i = 0; i < count; i++) {
+    CurlHandle *handle = &handles[i];
+
+    if (!handle->paused) continue;
+
+    handle->paused = false;
+    paused++;
+
+    // a cancelled transfer already had its chunks deleted
+    if (!handle->sent) continue;
+
+    write_response_chunk(handle);
+
+    CURLcode ret = curl_easy_pause(handle->ez_handle, CURLPAUSE_CONT);
+    if (ret != CURLE_OK)
+      ereport(ERROR, errmsg("curl_easy_pause() failed: %s", curl_easy_strerror(ret)));
+  }
+
+  return paused;
+}
+
+// Counts the end of the transfer of a request to an endpoint member. A request that couldn't reach
+// its member, so nothing was sent, goes to another member with what's left of its timeout: true is
+// returned then.
+static bool fail_over(CurlHandle *handle, CURLcode curl_return_code, int *running_handles) {
+  curl_off_t total_time_us = 0;
+  long       request_size  = 0;
+
+  EREPORT_CURL_GETINFO(handle->ez_handle, CURLINFO_TOTAL_TIME_T, &total_time_us);
+  EREPORT_CURL_GETINFO(handle->ez_handle, CURLINFO_REQUEST_SIZE, &request_size);
+
+  endpoint_member_finished(handle->group->id, handle->member, curl_return_code,
+                           (long)(total_time_us / 1000));
+
+  // a request the member received might have had an effect there, even without a response
+  if (!is_connection_failure(curl_return_code) || request_size > 0) return false;
+
+  long remaining_ms = TimestampDifferenceMilliseconds(GetCurrentTimestamp(), handle->deadline);
+  int  member       = endpoint_member_pick(handle->group, handle->tried_members);
+
+  if (member < 0 || remaining_ms <= 0) return false;
+
+  EREPORT_MULTI(curl_multi_remove_handle(worker_state->curl_mhandle, handle->ez_handle));
+  resetStringInfo(handle->body);
+
+  send_to_member(handle, member, remaining_ms);
+
+  EREPORT_MULTI(curl_multi_add_handle(worker_state->curl_mhandle, handle->ez_handle));
+  (*running_handles)++;
+
+  pg_atomic_fetch_add_u64(&worker_state->stats.requests_failed_over, 1);
+
+  return true;
+}
+
+// Publishes the responses stored in the batch with one notification, sent when the batch commits.
+// The payload is the seq of the last response, so listeners can read up to it with
+// net.completed_since.
+static void notify_completions(void) {
+  if (last_stored_seq == 0 || guc_notify_channel == NULL || guc_notify_channel[0] == '\0') return;
+
+  Async_Notify(guc_notify_channel, psprintf(INT64_FORMAT, last_stored_seq));
+
+  last_stored_seq = 0;
+}
+
+// Fails the requests left in the queue that won't be sent with a single query, a backlog of them
+// would take a batch slot each otherwise. They count like the ones failed by a batch.
+static void fail_queued_requests(void) {
+  WorkerStats *stats    = &worker_state->stats;
+  int64        last_seq = 0;
+  uint64       failed   = fail_request_queue(guc_max_queue_age, &last_seq);
+  uint64       stored   = 0;
+  uint64       expired  = 0;
+
+  for (uint64 i = 0; i < failed; i++) {
+    HeapTuple row  = SPI_tuptable->vals[i];
+    TupleDesc desc = SPI_tuptable->tupdesc;
+    bool      isnull;
+    bool      no_callback;
+    Datum     callback = SPI_getbinval(row, desc, 3, &no_callback);
+
+    if (DatumGetBool(SPI_getbinval(row, desc, 4, &isnull))) stored++;
+    if (DatumGetBool(SPI_getbinval(row, desc, 6, &isnull))) expired++;
+
+    if (no_callback) continue;
+
+    MemoryContext old        = MemoryContextSwitchTo(completions_context);
+    Completion   *completion = palloc(sizeof(Completion));
+
+    completion->callback = DatumGetObjectId(callback);
+    completion->role     = DatumGetObjectId(SPI_getbinval(row, desc, 2, &isnull));
+    completion->response = (Response){
+        .vals  = {SPI_getbinval(row, desc, 1, &isnull), 0, 0, 0, 0, BoolGetDatum(false),
+                  PointerGetDatum(DatumGetTextPCopy(SPI_getbinval(row, desc, 5, &isnull)))},
+        .nulls = {' ', 'n', 'n', 'n', 'n', ' ', ' '},
+    };
+
+    completions = lappend(completions, completion);
+
+    MemoryContextSwitchTo(old);
+  }
+
+  pg_atomic_fetch_add_u64(&stats->requests_expired, expired);
+  pg_atomic_fetch_add_u64(&stats->requests_failed, failed);
+  pg_atomic_fetch_add_u64(&stats->responses_skipped, failed - stored);
+
+  if (last_seq > 0) {
+    last_stored_seq    = last_seq;
+    may_have_responses = true;
+  }
+
+  elog(DEBUG1, "Failed " UINT64_FORMAT " queued requests without sending them", failed);
+}
+
+// Runs the callbacks of the completed requests in their own transaction, after the responses of
+// the batch are committed
+static void run_callbacks(void) {
+  if (completions == NIL) return;
+
+  SetCurrentStatementStartTimestamp();
+  StartTransactionCommand();
+  PushActiveSnapshot(GetTransactionSnapshot());
+
+  run_completion_callbacks(completions);
+
+  PopActiveSnapshot();
+  CommitTransactionCommand();
+
+  pgstat_report_stat(false);
+
+  completions = NIL;
+  MemoryContextReset(completions_context);
+}
+
+// Counts the requests in the queue before a batch takes some of them, in a transaction of its own
+// since the queue can't get new requests until it commits
+static void count_queue(void) {
+  Oid ext_table_oids[total_extension_tables];
+
+  SetCurrentStatementStartTimestamp();
+  StartTransactionCommand();
+  PushActiveSnapshot(GetTransactionSnapshot());
+
+  if (!is_extension_locked(ext_table_oids)) {
+    PopActiveSnapshot();
+    AbortCurrentTransaction();
+    return;
+  }
+
+  SPI_connect();
+
+  queue_depth_counted = queue_depth_recount(ext_table_oids[0]);
+
+  SPI_finish();
+
+  unlock_extension(ext_table_oids);
+
+  PopActiveSnapshot();
+  CommitTransactionCommand();
+}
+
+// Expiry runs once per bucket width (a sixth of the ttl), within bounds so a short ttl doesn't
+// make it run constantly and a long one still frees the responses deleted by batches in time
+static long expiry_interval_ms(void) {
+  Interval *ttl = DatumGetIntervalP(DirectFunctionCall3(
+      interval_in, CStringGetDatum(guc_ttl), ObjectIdGetDatum(InvalidOid), Int32GetDatum(-1)));
+
+  int64 ttl_ms =
+      (ttl->time + ((int64)ttl->month * DAYS_PER_MONTH + ttl->day) * USECS_PER_DAY) / 1000;
+
+  pfree(ttl);
+
+  return Max(min_expiry_interval_ms, Min(ttl_ms / 6, max_expiry_interval_ms));
+}
+
+static bool is_expiry_due(void) {
+  return may_have_responses && GetCurrentTimestamp() >= next_expiry_at;
+}
+
+// Expires responses in their own transaction, truncating takes an exclusive lock on the partition
+// that shouldn't be held while the requests are processed
+static void expire_responses(void) {
+  Oid    ext_table_oids[total_extension_tables];
+  uint64 expired = 0;
+
+  SetCurrentStatementStartTimestamp();
+  StartTransactionCommand();
+  PushActiveSnapshot(GetTransactionSnapshot());
+
+  if (!is_extension_locked(ext_table_oids)) {
+    elog(DEBUG1, "pg_net extension not loaded");
+    PopActiveSnapshot();
+    AbortCurrentTransaction();
+    may_have_responses = false; // the next requests will bring the extension back
+    return;
+  }
+
+  SPI_connect();
+
+  bool has_chunks;
+
+  expired = delete_expired_responses(guc_ttl, ext_table_oids[1], guc_batch_size,
+                                     &may_have_responses);
+  expired += delete_expired_responses(guc_ttl, ext_table_oids[4], guc_batch_size, &has_chunks);
+
+  may_have_responses |= has_chunks;
+
+  SPI_finish();
+
+  unlock_extension(ext_table_oids);
+
+  PopActiveSnapshot();
+  CommitTransactionCommand();
+
+  pgstat_report_stat(false);
+
+  // keep going while there's a backlog of expired rows, otherwise wait for the next interval
+  next_expiry_at =
+      expired > 0 ? GetCurrentTimestamp()
+                  : TimestampTzPlusMilliseconds(GetCurrentTimestamp(), expiry_interval_ms());
 }
 
 void pg_net_worker(__attribute__((unused)) Datum main_arg) {
@@ -254,14 +1013,26 @@ void pg_net_worker(__attribute__((unused)) Datum main_arg) {
   pqsignal(SIGTERM, handle_sigterm);
   pqsignal(SIGHUP, handle_sighup);
   pqsignal(SIGUSR1, handle_sigusr1);
+  pqsignal(SIGUSR2, handle_sigusr2);
 
   BackgroundWorkerInitializeConnection(guc_database_name, guc_username, 0);
   pgstat_report_appname("pg_net " EXTVERSION); // set appname for pg_stat_activity
 
   elog(INFO,
        "pg_net worker started with a config of: pg_net.ttl=%s, pg_net.batch_size=%d, "
-       "pg_net.username=%s, pg_net.database_name=%s",
-       guc_ttl, guc_batch_size, guc_username, guc_database_name);
+       "pg_net.username=%s, pg_net.database_name=%s, pg_net.event_backend=%s, "
+       "pg_net.adaptive_batch_size=%s, pg_net.min_batch_size=%d, "
+       "pg_net.circuit_breaker_failures=%d, pg_net.circuit_breaker_cooldown=%dms",
+       guc_ttl, guc_batch_size, guc_username, guc_database_name,
+       GetConfigOption("pg_net.event_backend", false, false),
+       guc_adaptive_batch_size ? "on" : "off", guc_min_batch_size, guc_circuit_breaker_failures,
+       guc_circuit_breaker_cooldown);
+
+  pg_atomic_fetch_add_u64(&worker_state->stats.config_loads, 1);
+
+  // starts from the max and backs off when the upstreams or the worker can't keep up
+  batch_size_reset(&batch_size_ctl, guc_batch_size);
+  publish_batch_size();
 
   int curl_ret = curl_global_init(CURL_GLOBAL_ALL);
   if (curl_ret != CURLE_OK)
@@ -278,6 +1049,13 @@ void pg_net_worker(__attribute__((unused)) Datum main_arg) {
 
   set_curl_mhandle(worker_state);
 
+  load_static_resolve();
+
+  endpoint_members_clear_outstanding();
+
+  completions_context =
+      AllocSetContextCreate(TopMemoryContext, "pg_net completions", ALLOCSET_DEFAULT_SIZES);
+
   publish_state(WS_RUNNING);
 
   // Initial state: we go straight into the outer loop and wait for a wake.
@@ -285,25 +1063,41 @@ void pg_net_worker(__attribute__((unused)) Datum main_arg) {
 
   do {
 
+    if (is_expiry_due()) expire_responses();
+
     uint32 expected = 1;
     if (!pg_atomic_compare_exchange_u32(&worker_state->should_wake, &expected, 0)) {
       elog(DEBUG1, "pg_net worker waiting for wake");
-      wait_while_processing_interrupts(WORKER_WAIT_NO_TIMEOUT, &worker_should_restart);
+      // without responses there's nothing to expire, so only a wake can bring more work
+      wait_while_processing_interrupts(may_have_responses ? WORKER_WAIT_NEXT_EXPIRY
+                                                          : WORKER_WAIT_NO_TIMEOUT,
+                                       &worker_should_restart);
       continue;
     }
 
     pgstat_report_activity(STATE_RUNNING, NULL);
 
     uint64 requests_consumed = 0;
-    uint64 expired_responses = 0;
 
     do {
+      Oid      ext_table_oids[total_extension_tables];
+      PGRUsage batch_start;
+      int      batch_size = current_batch_size();
+
+      if (!queue_depth_counted) count_queue();
+
+      pg_rusage_init(&batch_start);
+      batch_obs = (BatchObservation){0};
+      in_flight = NULL; // it lived in the previous batch's transaction
+
+      // the requests committed from now on are consumed by this batch or the next one, but they
+      // must wake the worker if it's waiting after this batch
+      pg_atomic_write_u32(&worker_state->should_wake, 0);
+
       SetCurrentStatementStartTimestamp();
       StartTransactionCommand();
       PushActiveSnapshot(GetTransactionSnapshot());
 
-      Oid ext_table_oids[total_extension_tables];
-
       if (!is_extension_locked(ext_table_oids)) {
         elog(DEBUG1, "pg_net extension not loaded");
         PopActiveSnapshot();
@@ -313,33 +1107,71 @@ void pg_net_worker(__attribute__((unused)) Datum main_arg) {
 
       SPI_connect();
 
-      expired_responses = delete_expired_responses(guc_ttl, guc_batch_size);
+      // the rows the batch takes stay locked until it commits, net.cancel() asks the worker to
+      // cancel them from now on
+      cancel_batch_started();
 
-      elog(DEBUG1, "Deleted " UINT64_FORMAT " expired rows", expired_responses);
+      if (queue_has_failed) {
+        queue_has_failed = false;
+        fail_queued_requests();
+      }
 
-      requests_consumed = consume_request_queue(guc_batch_size);
+      uint64 rows_consumed = consume_request_queue(batch_size, guc_max_queue_age);
 
-      elog(DEBUG1, "Consumed " UINT64_FORMAT " request rows", requests_consumed);
+      List *shared_entries = shared_queue_pop(ext_table_oids[0], batch_size - rows_consumed);
+
+      requests_consumed = rows_consumed + list_length(shared_entries);
+
+      elog(DEBUG1, "Consumed " UINT64_FORMAT " request rows and %d shared queue entries",
+           rows_consumed, list_length(shared_entries));
 
       if (requests_consumed > 0) {
-        CurlHandle *handles = palloc(mul_size(sizeof(CurlHandle), requests_consumed));
+        CurlHandle *handles         = palloc(mul_size(sizeof(CurlHandle), requests_consumed));
+        int         running_handles = 0;
+        bool        has_chunked     = false;
+        uint64      rows_failed     = 0;
+
+        // the rows are read from it after other queries ran, loading endpoints and storing the
+        // responses that don't need a transfer
+        SPITupleTable *queue_rows = SPI_tuptable;
 
         // initialize curl handles
-        for (size_t j = 0; j < requests_consumed; j++) {
+        for (size_t j = 0; j < rows_consumed; j++) {
           init_curl_handle(&handles[j],
-                           get_request_queue_row(SPI_tuptable->vals[j], SPI_tuptable->tupdesc));
+                           get_request_queue_row(queue_rows->vals[j], queue_rows->tupdesc));
+
+          if (handles[j].expired || handles[j].rejected_msg) rows_failed++;
 
-          EREPORT_MULTI(curl_multi_add_handle(worker_state->curl_mhandle, handles[j].ez_handle));
+          has_chunked |= handles[j].store_response == STORE_RESPONSE_CHUNKED;
+          running_handles += start_request(&handles[j]);
         }
 
-        // start curl event loop
-        int   running_handles = 0;
-        int   maxevents       = requests_consumed + 1; // 1 extra for the timer
-        event events[maxevents];
+        queue_has_failed = rows_failed > 0 && rows_failed * 2 >= rows_consumed;
 
-        do {
-          int nfds =
-              wait_event(worker_state->epfd, events, maxevents, curl_handle_event_timeout_ms);
+        ListCell *lc;
+        size_t    j = rows_consumed;
+        foreach (lc, shared_entries) {
+          init_curl_handle_from_shared_queue(&handles[j], lfirst(lc));
+
+          has_chunked |= handles[j].store_response == STORE_RESPONSE_CHUNKED;
+          running_handles += start_request(&handles[j]);
+          j++;
+        }
+
+        // start curl event loop, unless the circuit breaker rejected every request
+        uint64 wakeups = 0;
+
+        while (running_handles > 0) {
+          // net.cancel() interrupts the wait below with a signal
+          running_handles -= cancel_requests(handles, requests_consumed);
+
+          if (running_handles == 0) break;
+
+          int wait_ms = guc_hedge_policy != HEDGE_OFF
+                            ? hedge_requests(handles, requests_consumed, &running_handles)
+                            : curl_handle_event_timeout_ms;
+
+          int nfds = wait_event(worker_state->epfd, wait_events, max_wait_events, wait_ms);
 
           if (nfds < 0) {
             int save_errno = errno;
@@ -353,27 +1185,48 @@ void pg_net_worker(__attribute__((unused)) Datum main_arg) {
             }
           }
 
+          wakeups++;
+
           for (int i = 0; i < nfds; i++) {
-            if (is_timer(events[i])) {
+            if (is_timer(wait_events[i])) {
               EREPORT_MULTI(curl_multi_socket_action(worker_state->curl_mhandle,
                                                      CURL_SOCKET_TIMEOUT, 0, &running_handles));
             } else {
-              int curl_event = get_curl_event(events[i]);
-              int sockfd     = get_socket_fd(events[i]);
+              int curl_event = get_curl_event(wait_events[i]);
+              int sockfd     = get_socket_fd(wait_events[i]);
 
               EREPORT_MULTI(curl_multi_socket_action(worker_state->curl_mhandle, sockfd, curl_event,
                                                      &running_handles));
             }
           }
 
+          // a paused transfer gets no events until its chunk is written
+          if (has_chunked)
+            while (resume_transfers(handles, requests_consumed) > 0) {}
+
           // insert finished responses
           CURLMsg *msg       = NULL;
           int      msgs_left = 0;
           while ((msg = curl_multi_info_read(worker_state->curl_mhandle, &msgs_left))) {
             if (msg->msg == CURLMSG_DONE) {
-              CurlHandle *handle = NULL;
-              EREPORT_CURL_GETINFO(msg->easy_handle, CURLINFO_PRIVATE, &handle);
-              insert_response(handle, msg->data.result);
+              CurlHandle *handle           = NULL;
+              CURL       *finished         = msg->easy_handle;
+              CURLcode    curl_return_code = msg->data.result;
+              EREPORT_CURL_GETINFO(finished, CURLINFO_PRIVATE, &handle);
+
+              if (handle->hedge_ez_handle &&
+                  !settle_hedge(handle, finished, curl_return_code, &running_handles))
+                continue;
+
+              if (handle->group && fail_over(handle, curl_return_code, &running_handles)) continue;
+
+              if (curl_return_code == CURLE_OK && handle->latency_host)
+                hedge_record_latency(handle->latency_host,
+                                     TimestampDifferenceMilliseconds(handle->sent_at,
+                                                                     GetCurrentTimestamp()));
+
+              handle->sent = false;
+              complete_request(handle, curl_return_code);
             } else {
               ereport(ERROR, errmsg("curl_multi_info_read(), CURLMsg=%d\n", msg->msg));
             }
@@ -382,7 +1235,7 @@ void pg_net_worker(__attribute__((unused)) Datum main_arg) {
           elog(DEBUG1, "Pending curl running_handles: %d", running_handles);
           // run while there are curl handles, some won't finish in a single iteration since they
           // could be slow and waiting for a timeout
-        } while (running_handles > 0);
+        }
 
         // cleanup
         for (uint64 i = 0; i < requests_consumed; i++) {
@@ -390,19 +1243,40 @@ void pg_net_worker(__attribute__((unused)) Datum main_arg) {
 
           curl_easy_cleanup(handles[i].ez_handle);
 
+          // the hedge of a cancelled request
+          if (handles[i].hedge_ez_handle) {
+            EREPORT_MULTI(
+                curl_multi_remove_handle(worker_state->curl_mhandle, handles[i].hedge_ez_handle));
+            curl_easy_cleanup(handles[i].hedge_ez_handle);
+          }
+
           pfree_handle(&handles[i]);
         }
 
         pfree(handles);
+
+        free_shared_header_lists();
+
+        pg_atomic_fetch_add_u64(&worker_state->stats.event_syscalls,
+                                event_syscalls - published_event_syscalls);
+        published_event_syscalls = event_syscalls;
+        pg_atomic_fetch_add_u64(&worker_state->stats.event_wakeups, wakeups);
       }
 
+      cancel_batch_finished();
+
       SPI_finish();
 
+      notify_completions();
+
       unlock_extension(ext_table_oids);
 
       PopActiveSnapshot();
       CommitTransactionCommand();
 
+      // the responses of the entries are committed, they're no longer needed to retry the batch
+      shared_queue_remove_popped();
+
       // Background workers that modify tables must flush their pending
       // pgstat counters themselves. Regular user backends do this
       // automatically after each query via the main loop in
@@ -412,10 +1286,29 @@ void pg_net_worker(__attribute__((unused)) Datum main_arg) {
       // stats.
       pgstat_report_stat(false);
 
-      // slow down queue processing to avoid using too much CPU
-      wait_while_processing_interrupts(WORKER_WAIT_ONE_SECOND, &worker_should_restart);
+      if (guc_adaptive_batch_size) {
+        batch_obs.requests = requests_consumed;
+        batch_observe_usage(&batch_obs, &batch_start);
+        batch_size_adapt(&batch_size_ctl, &batch_obs, guc_min_batch_size, guc_batch_size);
+        publish_batch_size();
+      }
+
+      if (requests_consumed > 0) may_have_responses = true;
 
-    } while (!worker_should_restart && (requests_consumed > 0 || expired_responses > 0));
+      run_callbacks();
+
+      // expire after the batch is done so it doesn't delay dispatching the requests
+      if (is_expiry_due()) expire_responses();
+
+      // slow down queue processing to avoid using too much CPU, unless there are requests waiting
+      // in the shared queue since its purpose is low latency dispatch, or requests that the next
+      // batch fails without sending them
+      wait_while_processing_interrupts(shared_queue_is_empty() && !queue_has_failed
+                                           ? WORKER_WAIT_ONE_SECOND
+                                           : WORKER_WAIT_NONE,
+                                       &worker_should_restart);
+
+    } while (!worker_should_restart && requests_consumed > 0);
 
     // Inner loop drained; back to waiting for the next wake.
     pgstat_report_activity(STATE_IDLE, NULL);
@@ -437,6 +1330,11 @@ static void net_shmem_request(void) {
   if (prev_shmem_request_hook) prev_shmem_request_hook();
 
   RequestAddinShmemSpace(net_memsize());
+  shared_queue_shmem_request();
+  circuit_breaker_shmem_request();
+  queue_depth_shmem_request();
+  cancel_shmem_request();
+  endpoint_members_shmem_request();
 }
 #endif
 
@@ -458,11 +1356,44 @@ static void net_shmem_startup(void) {
     ConditionVariableInit(&worker_state->cv);
     worker_state->epfd         = 0;
     worker_state->curl_mhandle = NULL;
+
+    pg_atomic_init_u64(&worker_state->stats.requests_succeeded, 0);
+    pg_atomic_init_u64(&worker_state->stats.requests_http_error, 0);
+    pg_atomic_init_u64(&worker_state->stats.requests_failed, 0);
+    pg_atomic_init_u64(&worker_state->stats.responses_skipped, 0);
+    pg_atomic_init_u64(&worker_state->stats.bodies_compressed, 0);
+    pg_atomic_init_u64(&worker_state->stats.body_bytes_saved, 0);
+    pg_atomic_init_u64(&worker_state->stats.event_syscalls, 0);
+    pg_atomic_init_u64(&worker_state->stats.event_wakeups, 0);
+    pg_atomic_init_u32(&worker_state->stats.batch_size, 0);
+    pg_atomic_init_u64(&worker_state->stats.requests_coalesced, 0);
+    pg_atomic_init_u64(&worker_state->stats.cache_hits, 0);
+    pg_atomic_init_u64(&worker_state->stats.requests_expired, 0);
+    pg_atomic_init_u64(&worker_state->stats.requests_cancelled, 0);
+    pg_atomic_init_u64(&worker_state->stats.requests_hedged, 0);
+    pg_atomic_init_u64(&worker_state->stats.hedges_won, 0);
+    pg_atomic_init_u64(&worker_state->stats.requests_failed_over, 0);
+    pg_atomic_init_u64(&worker_state->stats.config_loads, 0);
   }
 
+  shared_queue_shmem_startup();
+  circuit_breaker_shmem_startup();
+  queue_depth_shmem_startup();
+  cancel_shmem_startup();
+  endpoint_members_shmem_startup();
+
   LWLockRelease(AddinShmemInitLock);
 }
 
+static bool check_notify_channel(char **newval, __attribute__((unused)) void **extra,
+                                 __attribute__((unused)) GucSource source) {
+  if (*newval && strlen(*newval) >= NAMEDATALEN) {
+    GUC_check_errdetail("The channel name must be shorter than %d characters.", NAMEDATALEN);
+    return false;
+  }
+  return true;
+}
+
 void _PG_init(void) {
   if (IsBinaryUpgrade) {
     return;
@@ -483,16 +1414,6 @@ void _PG_init(void) {
     .bgw_restart_time  = net_worker_restart_time_sec,
   });
 
-#if PG15_GTE
-  prev_shmem_request_hook = shmem_request_hook;
-  shmem_request_hook      = net_shmem_request;
-#else
-  RequestAddinShmemSpace(net_memsize());
-#endif
-
-  prev_shmem_startup_hook = shmem_startup_hook;
-  shmem_startup_hook      = net_shmem_startup;
-
   DefineCustomStringVariable("pg_net.ttl", "time to live for request/response rows",
                              "should be a valid interval type", &guc_ttl, "6 hours", PGC_SIGHUP, 0,
                              NULL, NULL, NULL);
@@ -501,10 +1422,130 @@ void _PG_init(void) {
       "pg_net.batch_size", "number of requests executed in one iteration of the background worker",
       NULL, &guc_batch_size, 200, 0, PG_INT16_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
 
+  DefineCustomBoolVariable("pg_net.adaptive_batch_size",
+                           "adjust the batch size between pg_net.min_batch_size and "
+                           "pg_net.batch_size according to the failures, latency and worker CPU",
+                           NULL, &guc_adaptive_batch_size, false, PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+  DefineCustomIntVariable("pg_net.min_batch_size",
+                          "lower bound of the batch size when pg_net.adaptive_batch_size is on",
+                          NULL, &guc_min_batch_size, 10, 1, PG_INT16_MAX, PGC_SIGHUP, 0, NULL, NULL,
+                          NULL);
+
   DefineCustomStringVariable("pg_net.database_name", "Database where the worker will connect to",
                              NULL, &guc_database_name, "postgres", PGC_SU_BACKEND, 0, NULL, NULL,
                              NULL);
 
   DefineCustomStringVariable("pg_net.username", "Connection user for the worker", NULL,
                              &guc_username, NULL, PGC_SU_BACKEND, 0, NULL, NULL, NULL);
+
+  DefineCustomIntVariable("pg_net.shared_queue_size",
+                          "size of the shared memory queue that requests go through before the "
+                          "http_request_queue table, 0 disables it",
+                          NULL, &guc_shared_queue_size, 0, 0, MAX_KILOBYTES, PGC_POSTMASTER,
+                          GUC_UNIT_KB, NULL, NULL, NULL);
+
+  DefineCustomStringVariable("pg_net.notify_channel",
+                             "channel notified with the seq of the last stored response after each "
+                             "batch, empty disables notifications",
+                             NULL, &guc_notify_channel, "", PGC_SIGHUP, 0,
+                             check_notify_channel, NULL, NULL);
+
+  DefineCustomEnumVariable("pg_net.event_backend",
+                           "how the worker waits on its sockets and timers, io_uring is Linux only",
+                           NULL, &guc_event_backend, DEFAULT_EVENT_BACKEND, event_backend_options,
+                           PGC_POSTMASTER, 0, NULL, NULL, NULL);
+
+  DefineCustomBoolVariable("pg_net.coalesce_requests",
+                           "send identical GET requests of a batch once, all of them get the "
+                           "response",
+                           NULL, &guc_coalesce_requests, false, PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+  DefineCustomIntVariable("pg_net.response_cache_size",
+                          "memory the worker can use to cache GET responses according to their "
+                          "Cache-Control, 0 disables it",
+                          NULL, &guc_response_cache_size, 0, 0, MAX_KILOBYTES, PGC_SIGHUP,
+                          GUC_UNIT_KB, NULL, NULL, NULL);
+
+  DefineCustomIntVariable("pg_net.response_chunk_size",
+                          "size of the chunks the bodies of the responses with a chunked "
+                          "store_response are written in",
+                          NULL, &guc_response_chunk_size, 1024, 8, 512 * 1024, PGC_SIGHUP,
+                          GUC_UNIT_KB, NULL, NULL, NULL);
+
+  DefineCustomIntVariable("pg_net.circuit_breaker_failures",
+                          "consecutive connection failures or timeouts to a host that make the "
+                          "worker fail its requests without sending them, 0 disables it",
+                          NULL, &guc_circuit_breaker_failures, 0, 0, INT_MAX, PGC_SIGHUP, 0, NULL,
+                          NULL, NULL);
+
+  DefineCustomIntVariable("pg_net.circuit_breaker_cooldown",
+                          "time after which a single request is sent to a host whose circuit "
+                          "breaker is open, to probe it",
+                          NULL, &guc_circuit_breaker_cooldown, 30000, 1, INT_MAX, PGC_SIGHUP,
+                          GUC_UNIT_MS, NULL, NULL, NULL);
+
+  DefineCustomStringVariable("pg_net.resolve",
+                             "comma separated host:port:address entries, requests to a host and "
+                             "port connect to the address without resolving the host",
+                             NULL, &guc_resolve, "", PGC_SIGHUP, 0, check_resolve, NULL, NULL);
+
+  DefineCustomEnumVariable("pg_net.hedge_policy",
+                           "when a slow GET is sent a second time, the first response is kept: "
+                           "off, after pg_net.hedge_delay or after the p95 latency of its host",
+                           NULL, &guc_hedge_policy, HEDGE_OFF, hedge_policy_options, PGC_SIGHUP, 0,
+                           NULL, NULL, NULL);
+
+  DefineCustomIntVariable("pg_net.hedge_delay",
+                          "time after which a GET that didn't complete is sent a second time, and "
+                          "the p95 of its host until it's known",
+                          NULL, &guc_hedge_delay, 100, 1, INT_MAX, PGC_SIGHUP, GUC_UNIT_MS, NULL,
+                          NULL, NULL);
+
+  DefineCustomIntVariable("pg_net.hedge_max_percent",
+                          "percentage of the requests sent that can be hedged", NULL,
+                          &guc_hedge_max_percent, 5, 0, 100, PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+  DefineCustomIntVariable("pg_net.max_queue_age",
+                          "time after which a request waiting in the queue expires instead of being "
+                          "sent, 0 is no limit",
+                          NULL, &guc_max_queue_age, 0, 0, INT_MAX, PGC_SIGHUP, GUC_UNIT_MS, NULL,
+                          NULL, NULL);
+
+  DefineCustomIntVariable("pg_net.max_queued_requests",
+                          "number of requests net.http_request_queue can hold, 0 is no limit", NULL,
+                          &guc_max_queued_requests, 0, 0, INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+  DefineCustomIntVariable("pg_net.max_queued_requests_per_role",
+                          "number of requests of a single role net.http_request_queue can hold, 0 "
+                          "is no limit",
+                          NULL, &guc_max_queued_requests_per_role, 0, 0, INT_MAX, PGC_SUSET, 0,
+                          NULL, NULL, NULL);
+
+  DefineCustomEnumVariable("pg_net.queue_full_action",
+                           "what happens to a request enqueued when the queue is full: reject it, "
+                           "wait for room or drop the oldest request",
+                           NULL, &guc_queue_full_action, QUEUE_FULL_REJECT,
+                           queue_full_action_options, PGC_SUSET, 0, NULL, NULL, NULL);
+
+  DefineCustomIntVariable("pg_net.queue_full_timeout",
+                          "time a request waits for room in the full queue before being rejected "
+                          "when pg_net.queue_full_action is wait",
+                          NULL, &guc_queue_full_timeout, 1000, 0, INT_MAX, PGC_SUSET, GUC_UNIT_MS,
+                          NULL, NULL, NULL);
+
+#if PG15_GTE
+  prev_shmem_request_hook = shmem_request_hook;
+  shmem_request_hook      = net_shmem_request;
+#else
+  RequestAddinShmemSpace(net_memsize());
+  shared_queue_shmem_request();
+  circuit_breaker_shmem_request();
+  queue_depth_shmem_request();
+  cancel_shmem_request();
+  endpoint_members_shmem_request();
+#endif
+
+  prev_shmem_startup_hook = shmem_startup_hook;
+  shmem_startup_hook      = net_shmem_startup;
 }
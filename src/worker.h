@@ -0,0 +1,10 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+extern int guc_max_queue_age;
+
+// Wakes the background worker once the current transaction commits, only the first call in a
+// transaction registers the callback
+void wake_worker_at_commit(void);
+
+#endif
@@ -1,3 +1,5 @@
+import time
+
 import pytest
 from sqlalchemy import create_engine
 from sqlalchemy.orm import Session
@@ -42,3 +44,42 @@ def autocommit_sess(engine):
     session = Session(ac_engine)
 
     yield session
+
+
+def config_loads(autocommit_sess):
+    return autocommit_sess.execute(text("select config_loads from net.worker_stats()")).scalar_one()
+
+
+@pytest.fixture(scope="function")
+def pg_net_settings(sess, autocommit_sess):
+    """
+    Sets pg_net settings with alter system, e.g. pg_net_settings(batch_size=8), a None value
+    resets one. It returns once the worker loaded its config again, on the reload or when it
+    started, and the settings are reset after the test.
+    """
+
+    names = set()
+
+    def reload_conf(**settings):
+        for name, value in settings.items():
+            if value is None:
+                autocommit_sess.execute(text(f"alter system reset pg_net.{name}"))
+            else:
+                autocommit_sess.execute(text(f"alter system set pg_net.{name} to '{value}'"))
+            names.add(name)
+
+        # read after the config file is written, a load counted from now on has the settings, the
+        # worker could be restarting and load them when it starts instead of on the reload
+        before = config_loads(autocommit_sess)
+
+        autocommit_sess.execute(text("select pg_reload_conf()"))
+
+        deadline = time.monotonic() + 10
+        while config_loads(autocommit_sess) == before:
+            assert time.monotonic() < deadline, "the worker didn't load its config"
+            time.sleep(0.01)
+
+    yield reload_conf
+
+    if names:
+        reload_conf(**dict.fromkeys(names))
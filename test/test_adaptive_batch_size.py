@@ -0,0 +1,117 @@
+import pytest
+from sqlalchemy import text
+from common import get_response_count, http_requests, wait_for_response_count, wait_until
+
+
+def worker_batch_size(autocommit_sess):
+    (batch_size,) = autocommit_sess.execute(text(
+        "select batch_size from net.worker_stats()"
+    )).fetchone()
+
+    return batch_size
+
+
+@pytest.fixture
+def adaptive_batch_size(pg_net_settings):
+    """Turns on pg_net.adaptive_batch_size with a batch size between 5 and 40"""
+
+    pg_net_settings(adaptive_batch_size="on", min_batch_size=5, batch_size=40)
+
+    return pg_net_settings
+
+
+def test_batch_size_is_the_configured_one_by_default(sess, autocommit_sess):
+    """Without pg_net.adaptive_batch_size the worker uses pg_net.batch_size"""
+
+    (batch_size,) = autocommit_sess.execute(text("show pg_net.batch_size")).fetchone()
+
+    assert worker_batch_size(autocommit_sess) == int(batch_size)
+
+
+def test_batch_size_decreases_on_timeouts(sess, autocommit_sess, adaptive_batch_size):
+    """A full batch of timed out requests makes the worker back off"""
+
+    assert worker_batch_size(autocommit_sess) == 40
+
+    http_requests(sess, text(
+        """
+        select net.http_get('http://localhost:8080/pathological?delay=1', timeout_milliseconds := 200)
+        from generate_series(1, 40);
+    """
+    ))
+
+    wait_for_response_count(autocommit_sess, 40)
+
+    assert worker_batch_size(autocommit_sess) == 30
+
+
+def test_batch_size_doesnt_go_below_the_min(sess, autocommit_sess, adaptive_batch_size):
+    """Repeated timeouts leave the batch size at pg_net.min_batch_size"""
+
+    http_requests(sess, text(
+        """
+        select net.http_get('http://localhost:8080/pathological?delay=1', timeout_milliseconds := 100)
+        from generate_series(1, 150);
+    """
+    ))
+
+    wait_until(
+        lambda: worker_batch_size(autocommit_sess),
+        lambda batch_size: batch_size == 5,
+        timeout=20,
+        description="the batch size to reach the min"
+    )
+
+    wait_until(
+        get_response_count(autocommit_sess),
+        lambda response_count: response_count == 150,
+        timeout=20,
+        description="all responses to arrive"
+    )
+
+    assert worker_batch_size(autocommit_sess) == 5
+
+
+def test_batch_size_increases_after_recovering(sess, autocommit_sess, adaptive_batch_size):
+    """Once requests stop failing, full batches grow the batch size back up to the max"""
+
+    http_requests(sess, text(
+        """
+        select net.http_get('http://localhost:8080/pathological?delay=1', timeout_milliseconds := 200)
+        from generate_series(1, 40);
+    """
+    ))
+
+    wait_for_response_count(autocommit_sess, 40)
+
+    assert worker_batch_size(autocommit_sess) == 30
+
+    http_requests(sess, text(
+        """
+        select net.http_get('http://localhost:8080/pathological?delay=1')
+        from generate_series(1, 60);
+    """
+    ))
+
+    wait_for_response_count(autocommit_sess, 100)
+
+    assert worker_batch_size(autocommit_sess) == 40
+
+
+def test_batch_size_resets_when_turned_off(sess, autocommit_sess, adaptive_batch_size):
+    """Turning pg_net.adaptive_batch_size off goes back to pg_net.batch_size"""
+
+    http_requests(sess, text(
+        """
+        select net.http_get('http://localhost:8080/pathological?delay=1', timeout_milliseconds := 200)
+        from generate_series(1, 40);
+    """
+    ))
+
+    wait_for_response_count(autocommit_sess, 40)
+
+    assert worker_batch_size(autocommit_sess) == 30
+
+    adaptive_batch_size(adaptive_batch_size="off")
+
+    assert worker_batch_size(autocommit_sess) == 40
@@ -0,0 +1,155 @@
+import time
+
+import pytest
+from sqlalchemy import text
+from common import collect_response_sync, http_request
+
+
+def cancel(sess, request_id):
+    return sess.execute(text("select net.cancel(:id)").bindparams(id=request_id)).scalar_one()
+
+
+def test_cancel_queued_request(sess):
+    """A request cancelled before the worker takes it isn't sent, the worker stores its response"""
+
+    (request_id,) = sess.execute(text("select net.http_get('http://localhost:8080/anything')")).one()
+
+    assert cancel(sess, request_id) is True
+    assert cancel(sess, request_id) is False
+
+    (error_msg,) = sess.execute(text(
+        "select error_msg from net.http_request_queue where id = :id"
+    ).bindparams(id=request_id)).one()
+
+    assert error_msg == "Request cancelled"
+
+    (stored,) = sess.execute(text(
+        "select count(*) from net._http_response where id = :id"
+    ).bindparams(id=request_id)).one()
+
+    assert stored == 0
+
+    sess.commit()
+
+    response = collect_response_sync(sess, request_id)
+
+    assert response["status"] == "ERROR"
+    assert response["message"] == "Request cancelled"
+
+
+def test_cancelled_request_leaves_room_in_the_queue(sess, autocommit_sess):
+    """A cancelled request doesn't count towards pg_net.max_queued_requests"""
+
+    sess.execute(text("set local pg_net.max_queued_requests_per_role to 1"))
+
+    (request_id,) = sess.execute(text("select net.http_get('http://localhost:8080/anything')")).one()
+
+    cancel(sess, request_id)
+
+    sess.execute(text("select net.http_get('http://localhost:8080/anything')"))
+
+
+def test_cancel_in_flight_request(sess, autocommit_sess):
+    """A request the worker is sending is stopped right away"""
+
+    (before,) = autocommit_sess.execute(text(
+        "select requests_cancelled from net.worker_stats()"
+    )).one()
+
+    request_id = http_request(sess, text(
+        "select net.http_get('http://localhost:8080/pathological?delay=5', timeout_milliseconds := 10000)"
+    ))
+
+    # the worker takes the request from the queue
+    time.sleep(0.5)
+
+    start = time.monotonic()
+
+    assert cancel(autocommit_sess, request_id) is True
+    assert cancel(autocommit_sess, request_id) is False
+
+    response = collect_response_sync(sess, request_id)
+
+    assert time.monotonic() - start < 2
+    assert response["status"] == "ERROR"
+    assert response["message"] == "Request cancelled"
+
+    (after,) = autocommit_sess.execute(text(
+        "select requests_cancelled from net.worker_stats()"
+    )).one()
+
+    assert after == before + 1
+
+
+def test_cancel_completed_request(sess, autocommit_sess):
+    """Completed and unknown requests can't be cancelled"""
+
+    request_id = http_request(sess, text("select net.http_get('http://localhost:8080/anything')"))
+
+    assert collect_response_sync(sess, request_id)["status"] == "SUCCESS"
+
+    assert cancel(autocommit_sess, request_id) is False
+    assert cancel(autocommit_sess, -1) is False
+
+
+def test_cancel_needs_the_role_of_the_request(sess):
+    """Only roles with the privileges of the role that enqueued a request can cancel it"""
+
+    (request_id,) = sess.execute(text("select net.http_get('http://localhost:8080/anything')")).one()
+
+    sess.execute(text("set local role to pre_existing"))
+
+    with pytest.raises(Exception) as execinfo:
+        cancel(sess, request_id)
+
+    assert f"permission denied to cancel request {request_id}" in str(execinfo.value)
+
+    sess.rollback()
+
+    sess.execute(text("set local role to pre_existing"))
+
+    with pytest.raises(Exception) as execinfo:
+        sess.execute(text("delete from net.http_request_queue"))
+
+    assert "permission denied" in str(execinfo.value)
+
+    sess.rollback()
+
+    sess.execute(text("set local role to pre_existing"))
+
+    (request_id,) = sess.execute(text("select net.http_get('http://localhost:8080/anything')")).one()
+
+    assert cancel(sess, request_id) is True
+
+
+def test_clear_queue(sess):
+    """net.clear_queue cancels the queued requests the role can cancel, and only those"""
+
+    (other_id,) = sess.execute(text("select net.http_get('http://localhost:8080/anything')")).one()
+
+    sess.execute(text("set local role to pre_existing"))
+
+    (ids,) = sess.execute(text(
+        "select array_agg(net.http_get('http://localhost:8080/anything')) from generate_series(1, 3)"
+    )).one()
+
+    assert sess.execute(text("select net.clear_queue()")).scalar_one() == 3
+    assert sess.execute(text("select net.clear_queue()")).scalar_one() == 0
+
+    sess.execute(text("reset role"))
+
+    (error_msg,) = sess.execute(text(
+        "select error_msg from net.http_request_queue where id = :id"
+    ).bindparams(id=other_id)).one()
+
+    assert error_msg is None
+
+    sess.commit()
+
+    for request_id in ids:
+        response = collect_response_sync(sess, request_id)
+
+        assert response["status"] == "ERROR"
+        assert response["message"] == "Request cancelled"
+
+    assert collect_response_sync(sess, other_id)["status"] == "SUCCESS"
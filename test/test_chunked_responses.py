@@ -0,0 +1,109 @@
+import pytest
+from sqlalchemy import text
+from common import collect_response_sync, http_request
+
+LARGE_BODY = b"x" * 262144
+
+
+@pytest.fixture
+def small_chunks(pg_net_settings):
+    """Writes the chunked bodies in chunks of 8kB"""
+
+    pg_net_settings(response_chunk_size="8kB")
+
+
+def chunk_sizes(sess, request_id):
+    return sess.execute(text(
+        "select octet_length(chunk) from net._http_response_chunks where id = :id order by seq"
+    ).bindparams(id=request_id)).scalars().all()
+
+
+def body(sess, request_id):
+    body = sess.execute(text(
+        "select net.chunked_response_body(:id)"
+    ).bindparams(id=request_id)).scalar_one()
+
+    return None if body is None else bytes(body)
+
+
+def test_body_is_written_in_chunks(sess, small_chunks):
+    """The body of a chunked response is stored in chunks of pg_net.response_chunk_size at most"""
+
+    request_id = http_request(sess, text(
+        "select net.http_get('http://localhost:8080/large', store_response := 'chunked')"
+    ))
+
+    response = collect_response_sync(sess, request_id)
+
+    assert response["status"] == "SUCCESS"
+    assert response["status_code"] == 200
+    assert response["body"] is None
+
+    sizes = chunk_sizes(sess, request_id)
+
+    assert len(sizes) >= len(LARGE_BODY) // 8192
+    assert max(sizes) <= 8192
+    assert body(sess, request_id) == LARGE_BODY
+
+
+def test_small_body_is_one_chunk(sess):
+    """A body smaller than pg_net.response_chunk_size is stored in a single chunk"""
+
+    request_id = http_request(sess, text(
+        "select net.http_get('http://localhost:8080/large', store_response := 'chunked')"
+    ))
+
+    assert collect_response_sync(sess, request_id)["status_code"] == 200
+
+    assert chunk_sizes(sess, request_id) == [len(LARGE_BODY)]
+    assert body(sess, request_id) == LARGE_BODY
+
+
+def test_failed_request_has_no_chunks(sess):
+    """A chunked request that fails gets an error response and no chunks"""
+
+    request_id = http_request(sess, text(
+        """
+        select net.http_get(
+            'http://localhost:8080/pathological?delay=2',
+            timeout_milliseconds := 500,
+            store_response := 'chunked'
+        )
+    """
+    ))
+
+    response = collect_response_sync(sess, request_id)
+
+    assert response["status"] == "ERROR"
+    assert "Timeout of 500 ms reached" in response["message"]
+
+    assert chunk_sizes(sess, request_id) == []
+    assert body(sess, request_id) is None
+
+
+def test_chunked_requests_in_one_batch(sess, small_chunks):
+    """The chunked bodies of concurrent requests don't mix"""
+
+    request_ids = sess.execute(text(
+        """
+        select net.http_get(
+            'http://localhost:8080/large?n=' || n,
+            store_response := case when n % 2 = 0 then 'chunked' else 'always' end
+        )
+        from generate_series(1, 6) n;
+    """
+    )).scalars().all()
+
+    sess.commit()
+
+    for n, request_id in enumerate(request_ids, start=1):
+        response = collect_response_sync(sess, request_id)
+
+        assert response["status_code"] == 200
+
+        if n % 2 == 0:
+            assert response["body"] is None
+            assert body(sess, request_id) == LARGE_BODY
+        else:
+            assert response["body"] == LARGE_BODY.decode()
+            assert chunk_sizes(sess, request_id) == []
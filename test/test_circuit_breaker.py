@@ -0,0 +1,134 @@
+import time
+
+import pytest
+from sqlalchemy import text
+from common import http_requests, wait_for_response_count
+
+
+@pytest.fixture
+def circuit_breaker(pg_net_settings):
+    """Opens a host's circuit after 3 failures, for a second"""
+
+    pg_net_settings(circuit_breaker_failures=3, circuit_breaker_cooldown="1s")
+
+    return pg_net_settings
+
+
+def circuits(autocommit_sess):
+    return autocommit_sess.execute(text(
+        "select host, state, consecutive_failures from net.circuit_breakers order by host"
+    )).fetchall()
+
+
+def error_msgs(autocommit_sess):
+    return [row[0] for row in autocommit_sess.execute(text(
+        "select error_msg from net._http_response order by id"
+    )).fetchall()]
+
+
+def fail_requests(sess, autocommit_sess, count, total):
+    """Sends requests to a port nothing listens on and waits for their responses"""
+
+    http_requests(sess, text(
+        f"""
+        select net.http_get('http://localhost:8081')
+        from generate_series(1, {count});
+    """
+    ))
+
+    wait_for_response_count(autocommit_sess, total)
+
+
+def test_circuit_breaker_is_disabled_by_default(sess, autocommit_sess):
+    """Without pg_net.circuit_breaker_failures, failing hosts aren't tracked"""
+
+    fail_requests(sess, autocommit_sess, 5, 5)
+
+    assert circuits(autocommit_sess) == []
+
+
+def test_circuit_opens_after_consecutive_failures(sess, autocommit_sess, circuit_breaker):
+    """Once open, requests to the host fail without being sent"""
+
+    fail_requests(sess, autocommit_sess, 3, 3)
+
+    assert circuits(autocommit_sess) == [("localhost:8081", "open", 3)]
+
+    fail_requests(sess, autocommit_sess, 1, 4)
+
+    assert error_msgs(autocommit_sess)[3] == \
+        "Request not sent, the circuit breaker for localhost:8081 is open"
+
+    (requests_failed,) = autocommit_sess.execute(text(
+        "select requests_failed from net.worker_stats()"
+    )).fetchone()
+
+    assert requests_failed >= 4
+
+
+def test_open_circuit_doesnt_affect_other_hosts(sess, autocommit_sess, circuit_breaker):
+    """Requests to other hosts are sent as usual"""
+
+    fail_requests(sess, autocommit_sess, 3, 3)
+
+    http_requests(sess, text("select net.http_get('http://localhost:8080')"))
+
+    wait_for_response_count(autocommit_sess, 4)
+
+    (status_code,) = autocommit_sess.execute(text(
+        "select status_code from net._http_response order by id desc limit 1"
+    )).fetchone()
+
+    assert status_code == 200
+
+
+def test_successful_probe_closes_the_circuit(sess, autocommit_sess, circuit_breaker):
+    """After the cooldown a request is sent, its success closes the circuit"""
+
+    http_requests(sess, text(
+        """
+        select net.http_get('http://localhost:8080/pathological?delay=1', timeout_milliseconds := 100)
+        from generate_series(1, 3);
+    """
+    ))
+
+    wait_for_response_count(autocommit_sess, 3)
+
+    assert circuits(autocommit_sess) == [("localhost:8080", "open", 3)]
+
+    time.sleep(1)
+
+    http_requests(sess, text("select net.http_get('http://localhost:8080')"))
+
+    wait_for_response_count(autocommit_sess, 4)
+
+    assert error_msgs(autocommit_sess)[3] is None
+    assert circuits(autocommit_sess) == []
+
+
+def test_failed_probe_reopens_the_circuit(sess, autocommit_sess, circuit_breaker):
+    """Only one request is sent as a probe, if it fails the circuit opens again"""
+
+    fail_requests(sess, autocommit_sess, 3, 3)
+
+    time.sleep(1)
+
+    fail_requests(sess, autocommit_sess, 2, 5)
+
+    probe_msg, rejected_msg = error_msgs(autocommit_sess)[3:]
+
+    assert probe_msg.startswith("Couldn't connect")
+    assert rejected_msg == "Request not sent, the circuit breaker for localhost:8081 is open"
+    assert circuits(autocommit_sess) == [("localhost:8081", "open", 4)]
+
+
+def test_disabling_the_circuit_breaker_closes_circuits(sess, autocommit_sess, circuit_breaker):
+    """Setting pg_net.circuit_breaker_failures to 0 forgets the failing hosts"""
+
+    fail_requests(sess, autocommit_sess, 3, 3)
+
+    assert circuits(autocommit_sess) == [("localhost:8081", "open", 3)]
+
+    circuit_breaker(circuit_breaker_failures=0)
+
+    assert circuits(autocommit_sess) == []
@@ -0,0 +1,161 @@
+import pytest
+from sqlalchemy import text
+from common import http_requests, wait_until
+
+
+@pytest.fixture
+def callback(sess):
+    """A callback that records its calls and the completions it receives"""
+
+    sess.execute(text(
+        """
+        create table public.callback_calls(completions int, called_by text);
+        create table public.callback_results(id bigint, status_code int, content text, error_msg text);
+
+        create function public.record_completions(completions net.http_completion[]) returns void as $$
+          insert into public.callback_calls values (cardinality(completions), current_user);
+          insert into public.callback_results select id, status_code, content, error_msg from unnest(completions);
+        $$ language sql;
+
+        grant all on public.callback_calls, public.callback_results to pre_existing;
+    """
+    ))
+    sess.commit()
+
+    yield "public.record_completions(net.http_completion[])"
+
+    sess.rollback()
+    sess.execute(text(
+        """
+        drop function public.record_completions;
+        drop table public.callback_calls, public.callback_results;
+    """
+    ))
+    sess.commit()
+
+
+def wait_for_callback_results(autocommit_sess, expected_count):
+    wait_until(
+        fetch=lambda: autocommit_sess.execute(text(
+            "select count(*) from public.callback_results"
+        )).scalar(),
+        predicate=lambda count: count == expected_count,
+        description="the callback results"
+    )
+
+
+def test_callback_receives_completions_in_batch(sess, autocommit_sess, callback):
+    """One call of the callback receives the completions of many requests"""
+
+    http_requests(sess, text(
+        """
+        select net.http_get('http://localhost:8080/pathological?status=' || s, callback := :callback)
+        from unnest(array[200, 201, 503]) s;
+    """
+    ).bindparams(callback=callback))
+
+    wait_for_callback_results(autocommit_sess, 3)
+
+    (calls, completions) = autocommit_sess.execute(text(
+        "select count(*), sum(completions) from public.callback_calls"
+    )).fetchone()
+
+    assert calls == 1
+    assert completions == 3
+
+    (status_codes,) = autocommit_sess.execute(text(
+        "select array_agg(status_code order by status_code) from public.callback_results"
+    )).fetchone()
+
+    assert status_codes == [200, 201, 503]
+
+
+def test_callback_without_stored_response(sess, autocommit_sess, callback):
+    """Callbacks receive the responses that aren't stored"""
+
+    http_requests(sess, text(
+        """
+        select net.http_get('http://localhost:8080/echo-method', store_response := 'never', callback := :callback)
+        union all
+        select net.http_get('http://localhost:8081', store_response := 'never', callback := :callback);
+    """
+    ).bindparams(callback=callback))
+
+    wait_for_callback_results(autocommit_sess, 2)
+
+    (content, error_msg) = autocommit_sess.execute(text(
+        "select string_agg(content, ''), string_agg(error_msg, '') from public.callback_results"
+    )).fetchone()
+
+    assert content == "GET\n"
+    assert "Couldn't connect to server" in error_msg
+
+    (responses,) = autocommit_sess.execute(text(
+        "select count(*) from net._http_response"
+    )).fetchone()
+
+    assert responses == 0
+
+
+def test_callback_runs_as_the_enqueuing_role(sess, autocommit_sess, callback):
+    """The callback runs with the privileges of the role that made the request"""
+
+    http_requests(sess, text(
+        """
+        set local role to pre_existing;
+        select net.http_get('http://localhost:8080/pathological?status=200', callback := :callback);
+    """
+    ).bindparams(callback=callback))
+
+    wait_for_callback_results(autocommit_sess, 1)
+
+    (called_by,) = autocommit_sess.execute(text(
+        "select called_by from public.callback_calls"
+    )).fetchone()
+
+    assert called_by == "pre_existing"
+
+
+def test_failing_callback_doesnt_stop_the_worker(sess, autocommit_sess, callback):
+    """An error in a callback doesn't affect the other callbacks or the responses"""
+
+    sess.execute(text(
+        """
+        create function public.failing_callback(completions net.http_completion[]) returns void as $$
+        begin
+          raise exception 'callback failed';
+        end $$ language plpgsql;
+    """
+    ))
+
+    http_requests(sess, text(
+        """
+        select net.http_get('http://localhost:8080/pathological?status=200', callback := 'public.failing_callback(net.http_completion[])')
+        union all
+        select net.http_get('http://localhost:8080/pathological?status=200', callback := :callback);
+    """
+    ).bindparams(callback=callback))
+
+    wait_for_callback_results(autocommit_sess, 1)
+
+    (responses,) = autocommit_sess.execute(text(
+        "select count(*) from net._http_response"
+    )).fetchone()
+
+    assert responses == 2
+
+    sess.execute(text("drop function public.failing_callback"))
+    sess.commit()
+
+
+def test_callback_must_take_completions(sess):
+    """Only functions taking a net.http_completion[] are accepted as callbacks"""
+
+    with pytest.raises(Exception) as execinfo:
+        sess.execute(text(
+            """
+            select net.http_get('http://localhost:8080', callback := 'pg_catalog.lower(text)');
+        """
+        ))
+
+    assert "callback lower(text) must be a function that takes a net.http_completion[]" in str(execinfo)
@@ -0,0 +1,124 @@
+import select
+import time
+
+import pytest
+from sqlalchemy import text
+from common import http_requests, wait_for_response_count
+
+
+@pytest.fixture
+def notify_channel(autocommit_sess, pg_net_settings):
+    """Sets pg_net.notify_channel and listens on it"""
+
+    pg_net_settings(notify_channel="pg_net_completions")
+
+    conn = autocommit_sess.get_bind().raw_connection()
+    conn.driver_connection.autocommit = True
+    conn.cursor().execute("listen pg_net_completions")
+
+    yield conn.driver_connection
+
+    conn.cursor().execute("unlisten *")
+    conn.close()
+
+
+def wait_for_notifications(conn, timeout_secs=5):
+    deadline = time.monotonic() + timeout_secs
+
+    while not conn.notifies and time.monotonic() < deadline:
+        select.select([conn], [], [], deadline - time.monotonic())
+        conn.poll()
+
+    notifications = [n.payload for n in conn.notifies]
+    conn.notifies.clear()
+
+    return notifications
+
+
+def test_completed_since_reads_only_new_responses(sess, autocommit_sess):
+    """Each call with the last seq returns only the responses stored after it"""
+
+    http_requests(sess, text(
+        """
+        select net.http_get('http://localhost:8080/pathological?status=' || s)
+        from unnest(array[200, 201, 202]) s;
+    """
+    ))
+
+    wait_for_response_count(autocommit_sess, 3)
+
+    rows = autocommit_sess.execute(text(
+        "select seq, status_code from net.completed_since(0, max_rows := 2)"
+    )).fetchall()
+
+    assert len(rows) == 2
+    assert rows[0].seq < rows[1].seq
+
+    rows += autocommit_sess.execute(text(
+        "select seq, status_code from net.completed_since(:last_seq)"
+    ), {"last_seq": rows[-1].seq}).fetchall()
+
+    assert sorted(row.status_code for row in rows) == [200, 201, 202]
+
+    http_requests(sess, text(
+        """
+        select net.http_get('http://localhost:8080/pathological?status=203');
+    """
+    ))
+
+    wait_for_response_count(autocommit_sess, 4)
+
+    new_rows = autocommit_sess.execute(text(
+        "select seq, status_code from net.completed_since(:last_seq)"
+    ), {"last_seq": rows[-1].seq}).fetchall()
+
+    assert [row.status_code for row in new_rows] == [203]
+
+
+def test_one_notification_per_batch(sess, autocommit_sess, notify_channel):
+    """A batch of responses is published with a single notification carrying its last seq"""
+
+    http_requests(sess, text(
+        """
+        select net.http_get('http://localhost:8080/pathological?status=200')
+        from generate_series(1, 5);
+    """
+    ))
+
+    wait_for_response_count(autocommit_sess, 5)
+
+    notifications = wait_for_notifications(notify_channel)
+
+    assert len(notifications) == 1
+
+    (max_seq,) = autocommit_sess.execute(text(
+        "select max(seq) from net.completed_since()"
+    )).fetchone()
+
+    assert notifications == [str(max_seq)]
+
+
+def test_no_notification_without_stored_responses(sess, autocommit_sess, notify_channel):
+    """Responses that aren't stored can't be read, so they aren't notified"""
+
+    http_requests(sess, text(
+        """
+        select net.http_get('http://localhost:8080/pathological?status=200', store_response := 'never');
+    """
+    ))
+
+    http_requests(sess, text(
+        """
+        select net.http_get('http://localhost:8080/pathological?status=201');
+    """
+    ))
+
+    wait_for_response_count(autocommit_sess, 1)
+
+    notifications = wait_for_notifications(notify_channel)
+
+    (seq,) = autocommit_sess.execute(text(
+        "select seq from net.completed_since()"
+    )).fetchone()
+
+    assert notifications == [str(seq)]
@@ -0,0 +1,107 @@
+from sqlalchemy import text
+from common import http_request, wait_until
+
+
+def get_compression_stats(sess):
+    return sess.execute(text(
+        "select bodies_compressed, body_bytes_saved from net.worker_stats()"
+    )).fetchone()
+
+
+def test_response_is_decompressed(sess):
+    """Compressed responses are negotiated and stored decompressed"""
+
+    request_id = http_request(sess, text(
+        """
+        select net.http_get('http://localhost:8080/gzip');
+    """
+    ))
+
+    (status_code, content, headers) = sess.execute(text(
+        """
+        select (x.response).status_code, (x.response).body, (x.response).headers
+        from net._http_collect_response(:request_id, async:=false) x;
+    """
+    ), {"request_id": request_id}).fetchone()
+
+    assert status_code == 200
+    assert content == "compressible " * 100
+    assert headers["Content-Encoding"] == "gzip"
+
+
+def test_accept_encoding_is_sent(sess):
+    """Requests ask for a compressed response"""
+
+    request_id = http_request(sess, text(
+        """
+        select net.http_get('http://localhost:8080/headers');
+    """
+    ))
+
+    (content,) = sess.execute(text(
+        """
+        select (x.response).body
+        from net._http_collect_response(:request_id, async:=false) x;
+    """
+    ), {"request_id": request_id}).fetchone()
+
+    assert "gzip" in next(line for line in content.splitlines() if line.lower().startswith("accept-encoding"))
+
+
+def test_large_body_is_compressed(sess, autocommit_sess):
+    """A large body sent with compress_body goes gzipped and its savings are counted"""
+
+    (compressed, saved) = get_compression_stats(autocommit_sess)
+
+    request_id = http_request(sess, text(
+        """
+        select net.http_post(
+          'http://localhost:8080/headers',
+          body := jsonb_build_object('data', repeat('compressible ', 1000)),
+          compress_body := true
+        );
+    """
+    ))
+
+    (content,) = sess.execute(text(
+        """
+        select (x.response).body
+        from net._http_collect_response(:request_id, async:=false) x;
+    """
+    ), {"request_id": request_id}).fetchone()
+
+    assert "Content-Encoding: gzip" in content
+
+    stats = wait_until(
+        fetch=lambda: get_compression_stats(autocommit_sess),
+        predicate=lambda stats: stats[0] == compressed + 1,
+        description="the compressed body to be counted"
+    )
+
+    assert stats[1] > saved + 10000
+
+
+def test_small_body_is_not_compressed(sess, autocommit_sess):
+    """Bodies too small to benefit from compression are sent as is"""
+
+    (compressed, _) = get_compression_stats(autocommit_sess)
+
+    request_id = http_request(sess, text(
+        """
+        select net.http_post(
+          'http://localhost:8080/headers',
+          body := '{"hello": "world"}',
+          compress_body := true
+        );
+    """
+    ))
+
+    (content,) = sess.execute(text(
+        """
+        select (x.response).body
+        from net._http_collect_response(:request_id, async:=false) x;
+    """
+    ), {"request_id": request_id}).fetchone()
+
+    assert "Content-Encoding" not in content
+    assert get_compression_stats(autocommit_sess)[0] == compressed
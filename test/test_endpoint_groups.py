@@ -0,0 +1,139 @@
+import pytest
+import sqlalchemy as sa
+from sqlalchemy import text
+from common import collect_response_sync, http_request
+
+# nothing listens on these ports, connecting to them is refused right away
+DEAD_URL = "http://localhost:1"
+OTHER_DEAD_URL = "http://localhost:2"
+
+
+def add_endpoint(sess, base_url, member_urls, balance="least_outstanding"):
+    endpoint_id = sess.execute(text(
+        """
+        insert into net.endpoints(name, base_url, member_urls, balance)
+        values ('group', :base_url, :member_urls, :balance)
+        returning id;
+    """
+    ).bindparams(base_url=base_url, member_urls=member_urls, balance=balance)).scalar_one()
+
+    sess.commit()
+
+    return endpoint_id
+
+
+def members(sess, endpoint_id):
+    return sess.execute(text(
+        """
+        select member, base_url, requests, failures, healthy
+        from net.endpoint_members
+        where endpoint_id = :id
+        order by member;
+    """
+    ).bindparams(id=endpoint_id)).all()
+
+
+def failed_over(sess):
+    return sess.execute(text("select requests_failed_over from net.worker_stats()")).scalar_one()
+
+
+def test_request_fails_over_to_another_member(sess, autocommit_sess):
+    """A request that can't connect to its member is sent to another one"""
+
+    endpoint_id = add_endpoint(sess, DEAD_URL, ["http://localhost:8080"])
+
+    before = failed_over(autocommit_sess)
+
+    request_id = http_request(sess, text(
+        "select net.http_get_endpoint(:endpoint, '/anything')"
+    ).bindparams(endpoint=endpoint_id))
+
+    response = collect_response_sync(sess, request_id)
+
+    assert response["status"] == "SUCCESS"
+    assert response["status_code"] == 200
+
+    assert failed_over(autocommit_sess) == before + 1
+
+    (dead, alive) = members(autocommit_sess, endpoint_id)
+
+    assert (dead.base_url, dead.requests, dead.failures, dead.healthy) == (DEAD_URL, 1, 1, False)
+    assert (alive.base_url, alive.requests, alive.failures, alive.healthy) == (
+        "http://localhost:8080", 1, 0, True
+    )
+
+
+def test_down_member_is_skipped(sess, autocommit_sess):
+    """Once a member failed, the next requests go straight to the healthy ones"""
+
+    endpoint_id = add_endpoint(sess, DEAD_URL, ["http://localhost:8080"])
+
+    for _ in range(3):
+        request_id = http_request(sess, text(
+            "select net.http_get_endpoint(:endpoint, '/anything')"
+        ).bindparams(endpoint=endpoint_id))
+
+        assert collect_response_sync(sess, request_id)["status_code"] == 200
+
+    (dead, alive) = members(autocommit_sess, endpoint_id)
+
+    assert dead.requests == 1
+    assert alive.requests == 3
+
+
+def test_every_member_down(sess, autocommit_sess):
+    """A request fails with the error of the last member when none of them can be reached"""
+
+    endpoint_id = add_endpoint(sess, DEAD_URL, [OTHER_DEAD_URL])
+
+    request_id = http_request(sess, text(
+        "select net.http_get_endpoint(:endpoint, '/anything')"
+    ).bindparams(endpoint=endpoint_id))
+
+    response = collect_response_sync(sess, request_id)
+
+    assert response["status"] == "ERROR"
+    assert "Couldn't connect to server" in response["message"]
+
+    assert [m.failures for m in members(autocommit_sess, endpoint_id)] == [1, 1]
+
+
+@pytest.mark.parametrize("balance", ["least_outstanding", "latency_weighted"])
+def test_requests_are_balanced(sess, autocommit_sess, balance):
+    """The requests of a batch are spread over the members"""
+
+    endpoint_id = add_endpoint(sess, "http://localhost:8080", ["http://127.0.0.1:8080"], balance)
+
+    request_ids = sess.execute(text(
+        """
+        select net.http_get_endpoint(:endpoint, '/pathological?delay=0.1&n=' || n)
+        from generate_series(1, 10) n;
+    """
+    ).bindparams(endpoint=endpoint_id)).scalars().all()
+
+    sess.commit()
+
+    for request_id in request_ids:
+        assert collect_response_sync(sess, request_id)["status_code"] == 200
+
+    requests = [m.requests for m in members(autocommit_sess, endpoint_id)]
+
+    assert sum(requests) == 10
+    assert min(requests) >= 3
+
+
+def test_member_urls_are_checked(sess):
+    """Member urls are http(s) and don't go with a unix socket"""
+
+    with pytest.raises(sa.exc.IntegrityError):
+        add_endpoint(sess, "http://localhost:8080", ["ftp://localhost"])
+
+    sess.rollback()
+
+    with pytest.raises(sa.exc.IntegrityError):
+        sess.execute(text(
+            """
+            insert into net.endpoints(name, base_url, member_urls, unix_socket_path)
+            values ('group', 'http://localhost', '{http://localhost:8080}', '/tmp/server.sock');
+        """
+        ))
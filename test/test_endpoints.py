@@ -0,0 +1,206 @@
+import pytest
+from sqlalchemy import text
+from common import collect_response_sync, http_request, wakeup_worker
+
+
+@pytest.fixture
+def endpoint(sess):
+    """An endpoint for the local server, with a header sent on every request"""
+
+    endpoint_id = sess.execute(text(
+        """
+        insert into net.endpoints(name, base_url, headers)
+        values ('local', 'http://localhost:8080', '{"X-Endpoint": "secret"}')
+        returning id;
+    """
+    )).scalar_one()
+
+    sess.commit()
+
+    return endpoint_id
+
+
+def test_endpoint_get_with_params(sess, endpoint):
+    """The path and params are appended to the base url of the endpoint"""
+
+    request_id = http_request(sess, text(
+        """
+        select net.http_get_endpoint(:endpoint, '/anything', params := '{"a": "1", "b": "x y"}');
+    """
+    ).bindparams(endpoint=endpoint))
+
+    response = collect_response_sync(sess, request_id)
+
+    assert response["status_code"] == 200
+    assert response["body"] == "?a=1&b=x%20y\n"
+
+
+def test_endpoint_headers_are_sent(sess, endpoint):
+    """The headers of the endpoint are sent with the request's own"""
+
+    request_id = http_request(sess, text(
+        """
+        select net.http_get_endpoint(:endpoint, '/headers', headers := '{"X-Request": "mine"}');
+    """
+    ).bindparams(endpoint=endpoint))
+
+    body = collect_response_sync(sess, request_id)["body"]
+
+    assert "X-Endpoint: secret" in body
+    assert "X-Request: mine" in body
+    assert "User-Agent: pg_net/" in body
+
+
+def test_request_header_replaces_the_endpoint_one(sess, endpoint):
+    """A request header with the name of an endpoint header is sent instead of it"""
+
+    request_id = http_request(sess, text(
+        """
+        select net.http_get_endpoint(:endpoint, '/headers', headers := '{"x-endpoint": "override"}');
+    """
+    ).bindparams(endpoint=endpoint))
+
+    body = collect_response_sync(sess, request_id)["body"]
+
+    assert "x-endpoint: override" in body
+    assert "secret" not in body
+
+
+def test_endpoint_post(sess, endpoint):
+    """POSTs to an endpoint send the json body with its Content-Type"""
+
+    request_id = http_request(sess, text(
+        """
+        select net.http_post_endpoint(:endpoint, '/post', body := '{"hello": "world"}');
+    """
+    ).bindparams(endpoint=endpoint))
+
+    response = collect_response_sync(sess, request_id)
+
+    assert response["status_code"] == 200
+    assert response["body"] == '{"hello": "world"}\n'
+
+
+def test_endpoint_changes_are_picked_up(sess, endpoint):
+    """The worker reloads an endpoint once its row changes"""
+
+    first = http_request(sess, text(
+        "select net.http_get_endpoint(:endpoint, '/headers');"
+    ).bindparams(endpoint=endpoint))
+
+    assert "X-Endpoint: secret" in collect_response_sync(sess, first)["body"]
+
+    sess.execute(text(
+        "update net.endpoints set headers = '{\"X-Endpoint\": \"rotated\"}' where id = :endpoint"
+    ).bindparams(endpoint=endpoint))
+    sess.commit()
+
+    second = http_request(sess, text(
+        "select net.http_get_endpoint(:endpoint, '/headers');"
+    ).bindparams(endpoint=endpoint))
+
+    body = collect_response_sync(sess, second)["body"]
+
+    assert "X-Endpoint: rotated" in body
+    assert "secret" not in body
+
+
+def test_endpoint_timeout_is_the_default(sess, endpoint):
+    """Requests without their own timeout use the one of the endpoint"""
+
+    sess.execute(text(
+        "update net.endpoints set timeout_milliseconds = 100 where id = :endpoint"
+    ).bindparams(endpoint=endpoint))
+
+    request_id = http_request(sess, text(
+        "select net.http_get_endpoint(:endpoint, '/pathological?delay=1');"
+    ).bindparams(endpoint=endpoint))
+
+    response = collect_response_sync(sess, request_id)
+
+    assert response["status"] == "ERROR"
+    assert "Timeout of 100 ms reached" in response["message"]
+
+
+def test_endpoint_path_must_be_relative(sess, endpoint):
+    """A path that would change the host of the endpoint is rejected"""
+
+    with pytest.raises(Exception) as execinfo:
+        sess.execute(text(
+            "select net.http_get_endpoint(:endpoint, '@evil.com/');"
+        ).bindparams(endpoint=endpoint))
+
+    assert "path must be empty or start with '/' or '?'" in str(execinfo.value)
+
+
+def test_endpoint_path_is_checked_by_the_worker(sess, endpoint):
+    """A queue row with a path that would change the host of the endpoint isn't sent"""
+
+    request_id = sess.execute(text(
+        """
+        insert into net.http_request_queue(method, url, timeout_milliseconds, endpoint_id)
+        values ('GET', '@localhost:8080/headers', 1000, :endpoint)
+        returning id;
+    """
+    ).bindparams(endpoint=endpoint)).scalar_one()
+
+    sess.commit()
+
+    wakeup_worker(sess)
+
+    response = collect_response_sync(sess, request_id)
+
+    assert response["status"] == "ERROR"
+    assert "the path of an endpoint request must be empty" in response["message"]
+
+
+def test_endpoint_must_exist(sess):
+    """Requests to an unknown endpoint are rejected when enqueued"""
+
+    with pytest.raises(Exception) as execinfo:
+        sess.execute(text("select net.http_get_endpoint(42, '/anything');"))
+
+    assert 'violates foreign key constraint' in str(execinfo.value)
+
+
+def test_endpoint_headers_are_private(sess, endpoint):
+    """Other roles can send requests to an endpoint without reading its headers"""
+
+    sess.execute(text("set local role to pre_existing"))
+
+    with pytest.raises(Exception) as execinfo:
+        sess.execute(text("select headers from net.endpoints"))
+
+    assert 'permission denied' in str(execinfo.value)
+
+    sess.rollback()
+
+    sess.execute(text(
+        "update net.endpoints set allowed_roles = '{pre_existing}' where id = :endpoint"
+    ).bindparams(endpoint=endpoint))
+    sess.execute(text("set local role to pre_existing"))
+
+    request_id = http_request(sess, text(
+        "select net.http_get_endpoint(:endpoint, '/headers');"
+    ).bindparams(endpoint=endpoint))
+
+    assert "X-Endpoint: secret" in collect_response_sync(sess, request_id)["body"]
+
+
+def test_endpoint_needs_an_allowed_role(sess, endpoint):
+    """A role that isn't in the allowed_roles of an endpoint can't send requests with its headers"""
+
+    sess.execute(text("set local role to pre_existing"))
+
+    with pytest.raises(Exception) as execinfo:
+        sess.execute(text(
+            "select net.http_get_endpoint(:endpoint, '/headers');"
+        ).bindparams(endpoint=endpoint))
+
+    assert f"permission denied for endpoint {endpoint}" in str(execinfo.value)
+
+    sess.rollback()
+
+    (queued,) = sess.execute(text("select count(*) from net.http_request_queue")).one()
+
+    assert queued == 0
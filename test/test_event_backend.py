@@ -0,0 +1,130 @@
+import os
+import subprocess
+
+import pytest
+from sqlalchemy import create_engine, text
+from sqlalchemy.orm import Session
+from common import wait_for_postgres_ready, wait_for_response_count
+
+
+def restart_postgres(engine):
+    """Restarts postgres, needed for pg_net.event_backend since the worker picks it at startup"""
+
+    engine.dispose()
+    subprocess.run(["pg_ctl", "restart", "-D", os.getenv('PGDATA')])
+    wait_for_postgres_ready(engine, None)
+
+
+@pytest.fixture(scope="module")
+def io_uring_sess():
+    """An autocommit session on a postgres whose worker uses the io_uring event backend"""
+
+    engine = create_engine("postgresql:///postgres")
+    sess = Session(engine.execution_options(isolation_level="AUTOCOMMIT"))
+    sess.execute(text("alter system set pg_net.event_backend to 'io_uring'"))
+    restart_postgres(engine)
+
+    sess = Session(engine.execution_options(isolation_level="AUTOCOMMIT"))
+    sess.execute(text("create extension if not exists pg_net"))
+    sess.execute(text("select net.wait_until_running()"))
+
+    yield sess
+
+    sess.execute(text("drop extension if exists pg_net cascade"))
+    sess.execute(text("alter system reset pg_net.event_backend"))
+    restart_postgres(engine)
+    engine.dispose()
+
+
+def test_io_uring_completes_requests(io_uring_sess):
+    """Responses, connection errors and timeouts all complete with io_uring"""
+
+    io_uring_sess.execute(text("delete from net._http_response"))
+
+    (syscalls_before,) = io_uring_sess.execute(text(
+        "select event_syscalls from net.worker_stats()"
+    )).fetchone()
+
+    io_uring_sess.execute(text(
+        """
+        select net.http_get('http://localhost:8080/pathological?status=' || (200 + s % 4))
+        from generate_series(1, 100) s;
+
+        select net.http_post('http://localhost:8080/post', '{"hello": "world"}');
+
+        select net.http_get('http://localhost:8081');
+
+        select net.http_get('http://localhost:8080/pathological?delay=2', timeout_milliseconds := 500);
+    """
+    ))
+
+    wait_for_response_count(io_uring_sess, 103)
+
+    (ok, post_body, connect_errors, timeouts) = io_uring_sess.execute(text(
+        """
+        select
+          count(*) filter (where status_code between 200 and 203),
+          max(content) filter (where content like '{%'),
+          count(*) filter (where error_msg like 'Couldn''t connect to server%'),
+          count(*) filter (where timed_out)
+        from net._http_response;
+    """
+    )).fetchone()
+
+    assert ok == 101
+    assert post_body == '{"hello": "world"}\n'
+    assert connect_errors == 1
+    assert timeouts == 1
+
+    (syscalls_after,) = io_uring_sess.execute(text(
+        "select event_syscalls from net.worker_stats()"
+    )).fetchone()
+
+    assert syscalls_after > syscalls_before
+
+
+def test_io_uring_reuses_sockets(io_uring_sess):
+    """Sockets closed and reopened between batches, which reuses their fds, keep being polled"""
+
+    io_uring_sess.execute(text("delete from net._http_response"))
+
+    for _ in range(5):
+        io_uring_sess.execute(text(
+            """
+            select net.http_get('http://localhost:8080/pathological?status=200')
+            from generate_series(1, 20);
+        """
+        ))
+
+    wait_for_response_count(io_uring_sess, 100)
+
+    (errors,) = io_uring_sess.execute(text(
+        "select count(*) from net._http_response where error_msg is not null"
+    )).fetchone()
+
+    assert errors == 0
+
+
+def test_io_uring_wakes_up_less_than_once_per_socket_event(io_uring_sess):
+    """Sockets ready at the same time, connected, writable and readable, share their wakeups"""
+
+    io_uring_sess.execute(text("delete from net._http_response"))
+
+    (wakeups_before,) = io_uring_sess.execute(text(
+        "select event_wakeups from net.worker_stats()"
+    )).fetchone()
+
+    io_uring_sess.execute(text(
+        """
+        select net.http_get('http://localhost:8080/pathological?status=200')
+        from generate_series(1, 100);
+    """
+    ))
+
+    wait_for_response_count(io_uring_sess, 100)
+
+    (wakeups_after,) = io_uring_sess.execute(text(
+        "select event_wakeups from net.worker_stats()"
+    )).fetchone()
+
+    assert 0 < wakeups_after - wakeups_before < 100 * 3
@@ -0,0 +1,27 @@
+from sqlalchemy import text
+from common import http_requests, wait_for_response_count
+
+
+def worker_wakeups(autocommit_sess):
+    (wakeups,) = autocommit_sess.execute(text(
+        "select event_wakeups from net.worker_stats()"
+    )).fetchone()
+
+    return wakeups
+
+
+def test_slow_response_doesnt_spin_the_worker(sess, autocommit_sess):
+    """While waiting on a slow response, the worker only wakes up for its socket and timeouts"""
+
+    wakeups_before = worker_wakeups(autocommit_sess)
+
+    http_requests(sess, text(
+        """
+        select net.http_get('http://localhost:8080/pathological?delay=2');
+    """
+    ))
+
+    wait_for_response_count(autocommit_sess, 1)
+
+    assert 0 < worker_wakeups(autocommit_sess) - wakeups_before < 50
+
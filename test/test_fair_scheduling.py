@@ -0,0 +1,147 @@
+import pytest
+from sqlalchemy import text
+from common import get_response_count, wait_for_any_response, wait_for_response_count
+
+
+@pytest.fixture
+def small_batches(pg_net_settings):
+    """Makes the worker take 8 requests per batch"""
+
+    pg_net_settings(batch_size=8)
+
+
+def first_batch_roles(sess):
+    """The roles that enqueued the requests of the first 8 stored responses"""
+
+    return sess.execute(text(
+        """
+        select q.role, count(*)
+        from (select id from net._http_response order by seq limit 8) r
+        join requests q on q.id = r.id
+        group by q.role;
+    """
+    )).all()
+
+
+def enqueue(sess, role, count):
+    sess.execute(text(f"set local role to {role}"))
+    sess.execute(text(
+        """
+        insert into requests
+        select net.http_get('http://localhost:8080/anything'), current_user
+        from generate_series(1, :count);
+    """
+    ).bindparams(count=count))
+    sess.execute(text("reset role"))
+
+
+@pytest.fixture
+def requests(sess):
+    """A table to remember the role of each request, the queue rows are gone once they're sent"""
+
+    sess.execute(text("create temp table requests(id bigint, role text)"))
+    sess.execute(text("grant all on requests to pre_existing"))
+
+    yield
+
+
+def test_backlog_doesnt_delay_other_roles(sess, autocommit_sess, small_batches, requests):
+    """A role enqueued after a large backlog of another one is in the first batch"""
+
+    enqueue(sess, "postgres", 30)
+    enqueue(sess, "pre_existing", 1)
+    sess.commit()
+
+    wait_for_response_count(sess, 31)
+
+    assert dict(first_batch_roles(sess)) == {"postgres": 7, "pre_existing": 1}
+
+
+def test_weight_gives_a_larger_share(sess, autocommit_sess, small_batches, requests):
+    """A role with a weight of 3 gets three requests for every one of a role with the default"""
+
+    sess.execute(text("insert into net.role_quotas(enqueued_by, weight) values ('postgres', 3)"))
+
+    enqueue(sess, "pre_existing", 12)
+    enqueue(sess, "postgres", 12)
+    sess.commit()
+
+    wait_for_response_count(sess, 24)
+
+    assert dict(first_batch_roles(sess)) == {"postgres": 6, "pre_existing": 2}
+
+
+def test_max_in_flight_caps_a_role(sess, autocommit_sess):
+    """The worker doesn't send more than max_in_flight requests of a role at once"""
+
+    sess.execute(text(
+        "insert into net.role_quotas(enqueued_by, max_in_flight) values ('postgres', 2)"
+    ))
+    sess.execute(text(
+        """
+        select net.http_get('http://localhost:8080/pathological?delay=0.2')
+        from generate_series(1, 6);
+    """
+    ))
+
+    (pending, max_in_flight) = sess.execute(text(
+        "select pending, max_in_flight from net.role_queue where enqueued_by = 'postgres'::regrole"
+    )).one()
+
+    assert pending == 6
+    assert max_in_flight == 2
+
+    sess.commit()
+
+    # the responses of a batch are stored together
+    wait_for_any_response(autocommit_sess)
+
+    assert get_response_count(autocommit_sess)() == 2
+
+    wait_for_response_count(autocommit_sess, 6)
+
+
+def test_share_goes_to_the_calling_role(sess):
+    """A role can't take the share of another one by enqueuing in its name"""
+
+    sess.execute(text("insert into net.role_quotas(enqueued_by, weight) values ('postgres', 3)"))
+    sess.execute(text("set local role to pre_existing"))
+
+    with pytest.raises(Exception) as execinfo:
+        sess.execute(text(
+            """
+            insert into net.http_request_queue(method, url, timeout_milliseconds, enqueued_by)
+            values ('GET', 'http://localhost:8080/anything', 1000, 'postgres');
+        """
+        ))
+
+    assert 'permission denied' in str(execinfo.value)
+
+    sess.rollback()
+
+    sess.execute(text("set local role to pre_existing"))
+    sess.execute(text(
+        "select net.http_get('http://localhost:8080/anything') from generate_series(1, 3)"
+    ))
+    sess.execute(text("reset role"))
+
+    roles = sess.execute(text("select enqueued_by::text, pending, weight from net.role_queue")).all()
+
+    assert roles == [("pre_existing", 3, 1)]
+
+    sess.rollback()
+
+
+def test_role_quotas_are_private(sess):
+    """Roles can see their quota but not change it"""
+
+    sess.execute(text("set local role to pre_existing"))
+
+    sess.execute(text("select * from net.role_quotas"))
+
+    with pytest.raises(Exception) as execinfo:
+        sess.execute(text(
+            "insert into net.role_quotas(enqueued_by, weight) values ('pre_existing', 100)"
+        ))
+
+    assert 'permission denied' in str(execinfo.value)
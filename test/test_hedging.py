@@ -0,0 +1,117 @@
+import time
+
+import pytest
+from sqlalchemy import text
+from common import collect_response_sync, http_request, http_requests
+
+
+@pytest.fixture
+def hedging(pg_net_settings):
+    """Sets the hedging settings, they're reset after the test"""
+
+    return pg_net_settings
+
+
+def hedge_stats(sess):
+    return sess.execute(text("select requests_hedged, hedges_won from net.worker_stats()")).one()
+
+
+def test_slow_get_is_hedged(sess, autocommit_sess, hedging):
+    """A GET that runs longer than pg_net.hedge_delay is sent a second time, it gets one response"""
+
+    hedging(hedge_policy="delay", hedge_delay=50, hedge_max_percent=100)
+
+    (hedged_before, won_before) = hedge_stats(autocommit_sess)
+
+    request_id = http_request(sess, text(
+        "select net.http_get('http://localhost:8080/pathological?delay=0.3')"
+    ))
+
+    response = collect_response_sync(sess, request_id)
+
+    assert response["status"] == "SUCCESS"
+    assert response["status_code"] == 200
+    assert response["body"] == "ok\n"
+
+    (hedged_after, won_after) = hedge_stats(autocommit_sess)
+
+    assert hedged_after == hedged_before + 1
+    assert won_after - won_before in (0, 1)
+
+    (responses,) = sess.execute(text(
+        "select count(*) from net._http_response where id = :id"
+    ).bindparams(id=request_id)).one()
+
+    assert responses == 1
+
+
+def test_fast_get_isnt_hedged(sess, autocommit_sess, hedging):
+    """A GET that completes within pg_net.hedge_delay is sent once"""
+
+    hedging(hedge_policy="delay", hedge_delay=2000, hedge_max_percent=100)
+
+    (hedged_before, _) = hedge_stats(autocommit_sess)
+
+    request_id = http_request(sess, text("select net.http_get('http://localhost:8080/anything')"))
+
+    assert collect_response_sync(sess, request_id)["status"] == "SUCCESS"
+
+    (hedged_after, _) = hedge_stats(autocommit_sess)
+
+    assert hedged_after == hedged_before
+
+
+def test_hedges_are_capped(sess, autocommit_sess, hedging):
+    """No hedge is sent when pg_net.hedge_max_percent is 0, nor for a POST"""
+
+    hedging(hedge_policy="delay", hedge_delay=50, hedge_max_percent=0)
+
+    (hedged_before, _) = hedge_stats(autocommit_sess)
+
+    request_id = http_request(sess, text(
+        "select net.http_get('http://localhost:8080/pathological?delay=0.3')"
+    ))
+
+    assert collect_response_sync(sess, request_id)["status"] == "SUCCESS"
+
+    hedging(hedge_max_percent=100)
+
+    request_id = http_request(sess, text(
+        "select net.http_post('http://localhost:8080/pathological?delay=0.3')"
+    ))
+
+    assert collect_response_sync(sess, request_id)["status"] == "SUCCESS"
+
+    (hedged_after, _) = hedge_stats(autocommit_sess)
+
+    assert hedged_after == hedged_before
+
+
+def test_hedge_keeps_the_timeout(sess, autocommit_sess, hedging):
+    """A hedged request still times out after its timeout_milliseconds"""
+
+    hedging(hedge_policy="delay", hedge_delay=50, hedge_max_percent=100)
+
+    start = time.monotonic()
+
+    request_id = http_request(sess, text(
+        "select net.http_get('http://localhost:8080/pathological?delay=2', timeout_milliseconds := 500)"
+    ))
+
+    response = collect_response_sync(sess, request_id)
+
+    assert response["status"] == "ERROR"
+    assert "Timeout of 500 ms reached" in response["message"]
+    assert time.monotonic() - start < 1.5
+
+
+def test_p95_policy(sess, autocommit_sess, hedging):
+    """Requests complete with the p95 policy, which learns the latency of the hosts"""
+
+    hedging(hedge_policy="p95", hedge_delay=50, hedge_max_percent=100)
+
+    request_id = http_requests(sess, text(
+        "select net.http_get('http://localhost:8080/anything?n=' || n) from generate_series(1, 30) n"
+    ))
+
+    assert collect_response_sync(sess, request_id)["status"] == "SUCCESS"
@@ -1,3 +1,4 @@
+import pytest
 from sqlalchemy import text
 from common import collect_response_sync, http_request
 
@@ -17,3 +18,51 @@ def test_http_headers_set(sess):
 
     assert response is not None
     assert "pytest-header" in response["body"]
+
+
+def test_http_headers_with_line_breaks_rejected(sess):
+    """Check that headers containing line breaks are rejected at enqueue time"""
+
+    with pytest.raises(Exception) as execinfo:
+        sess.execute(text(
+            """
+            select net.http_get(
+                url:='http://localhost:8080/headers',
+                headers:=jsonb_build_object('x-injected', E'value\r\nevil: header')
+            );
+        """
+        ))
+
+    assert 'header values cannot contain line breaks' in str(execinfo.value)
+
+
+def test_http_headers_shared_by_a_batch(sess):
+    """Requests of a batch with the same headers send them, appending to one doesn't affect the others"""
+
+    (compressed, plain) = sess.execute(text(
+        """
+        select
+          net.http_post(
+            'http://localhost:8080/headers',
+            body := jsonb_build_object('data', repeat('compressible ', 1000)),
+            headers := '{"pytest-header": "shared", "Content-Type": "application/json"}',
+            compress_body := true
+          ),
+          net.http_post(
+            'http://localhost:8080/headers',
+            body := jsonb_build_object('data', repeat('compressible ', 1000)),
+            headers := '{"pytest-header": "shared", "Content-Type": "application/json"}'
+          );
+    """
+    )).fetchone()
+
+    sess.commit()
+
+    compressed_response = collect_response_sync(sess, compressed)
+    plain_response = collect_response_sync(sess, plain)
+
+    assert "pytest-header: shared" in compressed_response["body"]
+    assert "Content-Encoding: gzip" in compressed_response["body"]
+
+    assert "pytest-header: shared" in plain_response["body"]
+    assert "Content-Encoding" not in plain_response["body"]
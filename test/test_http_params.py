@@ -36,3 +36,21 @@ def test_http_post_url_params_set(sess):
     assert response is not None
     assert response["status"] == "SUCCESS"
     assert "?hello=world" in response["body"]
+
+
+def test_http_get_url_params_non_string_values(sess):
+    """Check that non string params are encoded like jsonb_each_text and that nulls are skipped"""
+    request_id = http_request(sess, text(
+        """
+        select net.http_get(
+            url:='http://localhost:8080/anything',
+            params:='{"n": 1.5, "b": true, "o": {"k": "v v"}, "z": null}'::jsonb
+        );
+    """
+    ))
+
+    response = collect_response_sync(sess, request_id)
+
+    assert response is not None
+    assert response["status"] == "SUCCESS"
+    assert response["body"] == "?b=true&n=1.5&o=%7b%22k%22%3a%20%22v%20v%22%7d\n"
@@ -41,6 +41,39 @@ def test_http_responses_deleted_after_ttl(sess, autocommit_sess):
         restart_worker(autocommit_sess)
 
 
+def test_http_responses_deleted_without_wake(sess, autocommit_sess):
+    """
+    Check that http responses are deleted on the expiry schedule of
+    the worker, without new requests waking it
+    """
+
+    try:
+        autocommit_sess.execute(
+            text("alter system set pg_net.ttl to '1 second'"))
+        restart_worker(autocommit_sess)
+
+        request_id = http_request(sess, text(
+            """
+            select net.http_get('http://localhost:8080/anything');
+        """
+        ))
+
+        response = collect_response_sync(sess, request_id)
+
+        assert response is not None
+        assert response["status"] == "SUCCESS"
+
+        # End the transaction so the partition isn't in use and gets truncated
+        sess.commit()
+
+        # No wakeup_worker() here, the worker expires responses on its own
+        wait_for_response_count(autocommit_sess, 0)
+
+    finally:
+        autocommit_sess.execute(text("alter system reset pg_net.ttl"))
+        restart_worker(autocommit_sess)
+
+
 def test_http_responses_will_complete_deletion(sess, autocommit_sess):
     """
     Check that http responses will keep being deleted
@@ -73,13 +106,8 @@ def test_http_responses_will_complete_deletion(sess, autocommit_sess):
 
         wakeup_worker(sess)
 
-        # In one inner loop, the worker will delete batch size
-        # worth of responses
-        wait_for_response_count(autocommit_sess, 2)
-
-        # But it will keep going as long as it had deleted
-        # some responses. So after a wait of 1 second it
-        # will delete another batch before going back to sleep
+        # Expired responses are truncated by bucket, so the batch
+        # size doesn't limit how many of them get deleted
         wait_for_response_count(autocommit_sess, 0)
 
     finally:
@@ -88,6 +116,53 @@ def test_http_responses_will_complete_deletion(sess, autocommit_sess):
         autocommit_sess.execute(text("select pg_reload_conf();"))
 
 
+def test_http_responses_expire_by_bucket(sess, autocommit_sess):
+    """
+    Check that only the buckets whose responses are all expired are deleted
+    """
+
+    try:
+        autocommit_sess.execute(
+            text("alter system set pg_net.ttl to '1 second'"))
+        restart_worker(autocommit_sess)
+
+        old_request_id = http_request(sess, text(
+            """
+            select net.http_get('http://localhost:8080/pathological?status=200');
+        """
+        ))
+
+        assert collect_response_sync(sess, old_request_id) is not None
+
+        # Sleep more than the ttl so the next response goes to another bucket
+        time.sleep(1.5)
+
+        new_request_id = http_request(sess, text(
+            """
+            select net.http_get('http://localhost:8080/pathological?status=201');
+        """
+        ))
+
+        assert collect_response_sync(sess, new_request_id) is not None
+
+        wait_for_response_count(autocommit_sess, 1)
+
+        (response_id, partitions) = autocommit_sess.execute(text(
+            """
+            select
+              (select id from net._http_response),
+              (select count(*) from pg_inherits where inhparent = 'net._http_response'::regclass);
+        """
+        )).fetchone()
+
+        assert response_id == new_request_id
+        assert partitions == 8
+
+    finally:
+        autocommit_sess.execute(text("alter system reset pg_net.ttl"))
+        restart_worker(autocommit_sess)
+
+
 def test_http_responses_will_delete_despite_restart(sess, autocommit_sess):
     """
     Check that http responses will keep being deleted despite no
@@ -0,0 +1,98 @@
+import pytest
+from sqlalchemy import text
+from common import collect_response_sync, http_request
+
+
+@pytest.fixture
+def static_resolve(pg_net_settings):
+    """Maps a host that doesn't exist to the local server"""
+
+    pg_net_settings(resolve="pg-net-sidecar:8080:127.0.0.1, other:80:127.0.0.2")
+
+    return pg_net_settings
+
+
+def endpoint(sess, unix_socket_path):
+    endpoint_id = sess.execute(text(
+        """
+        insert into net.endpoints(name, base_url, unix_socket_path)
+        values ('sidecar', 'http://localhost', :unix_socket_path)
+        returning id;
+    """
+    ).bindparams(unix_socket_path=unix_socket_path)).scalar_one()
+
+    sess.commit()
+
+    return endpoint_id
+
+
+def test_endpoint_on_unix_socket(sess):
+    """Requests to an endpoint with a unix socket go through it"""
+
+    endpoint_id = endpoint(sess, "/tmp/pg_net_nginx.sock")
+
+    request_id = http_request(sess, text(
+        "select net.http_get_endpoint(:endpoint, '/anything', params := '{\"a\": \"1\"}');"
+    ).bindparams(endpoint=endpoint_id))
+
+    response = collect_response_sync(sess, request_id)
+
+    assert response["status_code"] == 200
+    assert response["body"] == "?a=1\n"
+
+
+def test_endpoint_on_missing_unix_socket(sess):
+    """A socket nothing listens on fails like an unreachable host"""
+
+    endpoint_id = endpoint(sess, "/tmp/pg_net_nothing.sock")
+
+    request_id = http_request(sess, text(
+        "select net.http_get_endpoint(:endpoint, '/anything');"
+    ).bindparams(endpoint=endpoint_id))
+
+    response = collect_response_sync(sess, request_id)
+
+    assert response["status"] == "ERROR"
+    assert "Couldn't connect to server" in response["message"]
+
+
+def test_static_resolve(sess, autocommit_sess, static_resolve):
+    """A host in pg_net.resolve connects to its address without being resolved"""
+
+    request_id = http_request(sess, text(
+        "select net.http_get('http://pg-net-sidecar:8080/anything?a=1');"
+    ))
+
+    response = collect_response_sync(sess, request_id)
+
+    assert response["status_code"] == 200
+    assert response["body"] == "?a=1\n"
+
+
+def test_static_resolve_removed(sess, autocommit_sess, static_resolve):
+    """A host removed from pg_net.resolve is resolved again"""
+
+    # a connection left open would be reused without resolving the host
+    first = http_request(sess, text(
+        """
+        select net.http_get('http://pg-net-sidecar:8080/anything', headers := '{"Connection": "close"}');
+    """
+    ))
+    assert collect_response_sync(sess, first)["status_code"] == 200
+
+    static_resolve(resolve=None)
+
+    second = http_request(sess, text("select net.http_get('http://pg-net-sidecar:8080/anything');"))
+    response = collect_response_sync(sess, second)
+
+    assert response["status"] == "ERROR"
+    assert "resolve host" in response["message"]
+
+
+def test_static_resolve_rejects_bad_entries(autocommit_sess):
+    """Entries must be host:port:address"""
+
+    with pytest.raises(Exception) as execinfo:
+        autocommit_sess.execute(text("alter system set pg_net.resolve to 'localhost:127.0.0.1'"))
+
+    assert '"localhost:127.0.0.1" is not a host:port:address entry' in str(execinfo.value)
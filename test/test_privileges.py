@@ -1,3 +1,5 @@
+import pytest
+import sqlalchemy as sa
 from sqlalchemy import text
 from common import collect_response_sync, http_request
 
@@ -98,3 +100,96 @@ def test_net_on_new_role(sess):
         set local role postgres;
         drop role another;
     """))
+
+
+def test_requests_are_enqueued_by_the_calling_role(sess):
+    """The enqueued_by of a request, the role its callback runs as, is the role that made it"""
+
+    request_id = sess.execute(text(
+        """
+        set local role to pre_existing;
+        select net.http_get('http://localhost:8080/anything');
+    """
+    )).scalar_one()
+
+    sess.execute(text("reset role"))
+
+    enqueued_by = sess.execute(text(
+        "select enqueued_by::text from net.http_request_queue where id = :id"
+    ).bindparams(id=request_id)).scalar_one()
+
+    assert enqueued_by == 'pre_existing'
+
+
+def test_queue_rows_cant_be_written_directly(sess):
+    """A role can't insert or update the rows of the queue, it could pick the enqueued_by"""
+
+    with pytest.raises(sa.exc.ProgrammingError, match="permission denied"):
+        sess.execute(text(
+            """
+            set local role to pre_existing;
+            insert into net.http_request_queue(method, url, timeout_milliseconds, enqueued_by)
+            values ('GET', 'http://localhost:8080/anything', 1000, 'postgres');
+        """
+        ))
+
+    sess.rollback()
+
+    with pytest.raises(sa.exc.ProgrammingError, match="permission denied"):
+        sess.execute(text(
+            """
+            set local role to pre_existing;
+            update net.http_request_queue set enqueued_by = 'postgres';
+        """
+        ))
+
+
+def test_worker_views_are_read_only(sess):
+    """Roles read the views of the worker state and can't use the sequence of net.endpoints"""
+
+    privileges = sess.execute(text(
+        """
+        select
+          v, has_table_privilege('pre_existing', v, 'select'), has_table_privilege('pre_existing', v, 'insert')
+        from unnest(array['net.circuit_breakers', 'net.endpoint_members', 'net.role_queue']) v
+    """
+    )).all()
+
+    assert privileges == [
+        ("net.circuit_breakers", True, False),
+        ("net.endpoint_members", True, False),
+        ("net.role_queue", True, False),
+    ]
+
+    assert sess.execute(text(
+        "select has_sequence_privilege('pre_existing', 'net.endpoints_id_seq', 'usage')"
+    )).scalar_one() is False
+
+
+def test_insert_privilege_controls_who_can_enqueue(sess):
+    """Roles insert into the queue as themselves, and can't enqueue once the insert privilege is revoked"""
+
+    enqueued_by = sess.execute(text(
+        """
+        set local role to pre_existing;
+        insert into net.http_request_queue(method, url, timeout_milliseconds)
+        values ('GET', 'http://localhost:8080/anything', 1000)
+        returning enqueued_by::text;
+    """
+    )).scalar_one()
+
+    assert enqueued_by == 'pre_existing'
+
+    sess.rollback()
+
+    sess.execute(text("revoke insert on net.http_request_queue from PUBLIC"))
+
+    with pytest.raises(sa.exc.ProgrammingError, match="permission denied for table http_request_queue"):
+        sess.execute(text(
+            """
+            set local role to pre_existing;
+            select net.http_get('http://localhost:8080/anything');
+        """
+        ))
+
+    sess.rollback()
@@ -0,0 +1,186 @@
+import threading
+import time
+
+import pytest
+from sqlalchemy import text
+from sqlalchemy.orm import Session
+from common import collect_response_sync, http_request, wait_for_response_count
+
+
+@pytest.fixture
+def queue_limits(pg_net_settings):
+    """Sets the queue limits, they're reset after the test"""
+
+    return pg_net_settings
+
+
+def enqueue(sess, count, url="http://localhost:8080/anything"):
+    sess.execute(text(
+        "select net.http_get(:url) from generate_series(1, :count)"
+    ).bindparams(url=url, count=count))
+
+
+def test_full_queue_rejects_requests(sess, queue_limits):
+    """Requests beyond pg_net.max_queued_requests are rejected"""
+
+    queue_limits(max_queued_requests=3)
+
+    enqueue(sess, 3)
+
+    with pytest.raises(Exception) as execinfo:
+        enqueue(sess, 1)
+
+    assert "the pg_net request queue is full" in str(execinfo.value)
+    assert "The queue has pg_net.max_queued_requests (3) requests." in str(execinfo.value)
+
+
+def test_rolled_back_requests_leave_the_queue(sess, queue_limits):
+    """The requests of an aborted transaction don't count"""
+
+    queue_limits(max_queued_requests=2)
+
+    enqueue(sess, 2)
+    sess.rollback()
+
+    sess.execute(text("savepoint a"))
+    enqueue(sess, 2)
+    sess.execute(text("rollback to savepoint a"))
+
+    enqueue(sess, 2)
+
+
+def test_limit_per_role(sess, queue_limits):
+    """A role with pg_net.max_queued_requests_per_role requests queued doesn't hold back the others"""
+
+    queue_limits(max_queued_requests_per_role=2)
+
+    sess.execute(text("set local role to pre_existing"))
+    enqueue(sess, 2)
+
+    with pytest.raises(Exception) as execinfo:
+        enqueue(sess, 1)
+
+    assert 'Role "pre_existing" has pg_net.max_queued_requests_per_role (2) requests in the queue.' in str(execinfo.value)
+
+    sess.rollback()
+
+    sess.execute(text("set local role to pre_existing"))
+    enqueue(sess, 2)
+    sess.execute(text("reset role"))
+
+    enqueue(sess, 2)
+
+
+def test_wait_for_room(engine, sess, queue_limits):
+    """A request waits for the queue to have room up to pg_net.queue_full_timeout"""
+
+    queue_limits(max_queued_requests=1, queue_full_action="wait", queue_full_timeout=200)
+
+    other = Session(engine)
+    enqueue(other, 1)
+
+    with pytest.raises(Exception) as execinfo:
+        enqueue(sess, 1)
+
+    assert "the pg_net request queue is still full after waiting 200 ms" in str(execinfo.value)
+
+    sess.rollback()
+    sess.execute(text("set local pg_net.queue_full_timeout to 5000"))
+
+    # the other transaction ends while the request waits
+    threading.Timer(0.5, other.rollback).start()
+
+    start = time.monotonic()
+    enqueue(sess, 1)
+
+    assert time.monotonic() - start >= 0.4
+
+    other.close()
+
+
+def test_wait_doesnt_wait_for_its_own_requests(sess, queue_limits):
+    """A transaction that fills the queue by itself is rejected right away"""
+
+    queue_limits(max_queued_requests=2, queue_full_action="wait", queue_full_timeout=5000)
+
+    enqueue(sess, 2)
+
+    start = time.monotonic()
+
+    with pytest.raises(Exception) as execinfo:
+        enqueue(sess, 1)
+
+    assert "the pg_net request queue is full" in str(execinfo.value)
+    assert time.monotonic() - start < 1
+
+
+def test_drop_oldest(sess, queue_limits):
+    """The oldest request is dropped to make room, with an error response"""
+
+    queue_limits(max_queued_requests=2, queue_full_action="drop_oldest")
+
+    (oldest,) = sess.execute(text("select net.http_get('http://localhost:8080/anything?a=1')")).one()
+    enqueue(sess, 2)
+
+    # the worker stores the response of the dropped request
+    (stored,) = sess.execute(text(
+        "select count(*) from net._http_response where id = :id"
+    ).bindparams(id=oldest)).one()
+
+    assert stored == 0
+
+    sess.commit()
+
+    dropped = collect_response_sync(sess, oldest)
+
+    assert dropped["status"] == "ERROR"
+    assert dropped["message"] == "Request dropped, the queue was full"
+
+    wait_for_response_count(sess, 3)
+
+    (sent,) = sess.execute(text(
+        "select count(*) from net._http_response where status_code = 200"
+    )).one()
+
+    assert sent == 2
+
+
+def test_drop_oldest_queued_request(sess, autocommit_sess, queue_limits):
+    """A committed request waiting for the worker is dropped"""
+
+    queue_limits(max_queued_requests=2, queue_full_action="drop_oldest", batch_size=1)
+
+    # keeps the worker busy with a batch of one request
+    http_request(sess, text("select net.http_get('http://localhost:8080/pathological?delay=1')"))
+    time.sleep(0.2)
+
+    first = http_request(sess, text("select net.http_get('http://localhost:8080/anything?a=1')"))
+    http_request(sess, text("select net.http_get('http://localhost:8080/anything?a=2')"))
+    http_request(sess, text("select net.http_get('http://localhost:8080/anything?a=3')"))
+
+    response = collect_response_sync(sess, first)
+
+    assert response["message"] == "Request dropped, the queue was full"
+
+
+def test_drop_oldest_of_role(sess, queue_limits):
+    """A role that can't write to the queue drops its own oldest request, which stops counting"""
+
+    queue_limits(max_queued_requests_per_role=2, queue_full_action="drop_oldest")
+
+    sess.execute(text("set local role to pre_existing"))
+
+    (oldest,) = sess.execute(text("select net.http_get('http://localhost:8080/anything?a=1')")).one()
+    enqueue(sess, 2)
+
+    (pending,) = sess.execute(text(
+        "select pending from net.role_queue where enqueued_by = 'pre_existing'::regrole"
+    )).one()
+
+    assert pending == 2
+
+    sess.commit()
+
+    response = collect_response_sync(sess, oldest)
+
+    assert response["message"] == "Request dropped, the queue was full"
@@ -0,0 +1,110 @@
+import time
+
+import pytest
+from sqlalchemy import text
+from common import http_requests, wait_for_response_count
+
+
+@pytest.fixture
+def coalesce_requests(pg_net_settings):
+    """Turns on pg_net.coalesce_requests"""
+
+    pg_net_settings(coalesce_requests="on")
+
+
+def requests_coalesced(autocommit_sess):
+    (coalesced,) = autocommit_sess.execute(text(
+        "select requests_coalesced from net.worker_stats()"
+    )).fetchone()
+
+    return coalesced
+
+
+def test_requests_are_not_coalesced_by_default(sess, autocommit_sess):
+    """Without pg_net.coalesce_requests every request is sent"""
+
+    coalesced_before = requests_coalesced(autocommit_sess)
+
+    http_requests(sess, text(
+        "select net.http_get('http://localhost:8080/anything?flag=1') from generate_series(1, 10)"
+    ))
+
+    wait_for_response_count(autocommit_sess, 10)
+
+    assert requests_coalesced(autocommit_sess) == coalesced_before
+
+
+def test_identical_gets_are_coalesced(sess, autocommit_sess, coalesce_requests):
+    """Identical GETs of a batch are sent once, every request id gets the response"""
+
+    coalesced_before = requests_coalesced(autocommit_sess)
+
+    http_requests(sess, text(
+        "select net.http_get('http://localhost:8080/anything?flag=1') from generate_series(1, 10)"
+    ))
+
+    wait_for_response_count(autocommit_sess, 10)
+
+    assert requests_coalesced(autocommit_sess) - coalesced_before == 9
+
+    responses = autocommit_sess.execute(text(
+        "select count(distinct id), count(*) filter (where status_code = 200 and content = '?flag=1\n') from net._http_response"
+    )).fetchone()
+
+    assert responses == (10, 10)
+
+
+def test_gets_with_different_headers_are_not_coalesced(sess, autocommit_sess, coalesce_requests):
+    """The headers are part of the request identity"""
+
+    coalesced_before = requests_coalesced(autocommit_sess)
+
+    http_requests(sess, text(
+        """
+        select net.http_get('http://localhost:8080/headers', headers := jsonb_build_object('X-Flag', i % 2))
+        from generate_series(1, 10) i
+    """
+    ))
+
+    wait_for_response_count(autocommit_sess, 10)
+
+    assert requests_coalesced(autocommit_sess) - coalesced_before == 8
+
+    (distinct_bodies,) = autocommit_sess.execute(text(
+        "select count(distinct content) from net._http_response"
+    )).fetchone()
+
+    assert distinct_bodies == 2
+
+
+def test_posts_are_not_coalesced(sess, autocommit_sess, coalesce_requests):
+    """Only GETs without a body are coalesced"""
+
+    coalesced_before = requests_coalesced(autocommit_sess)
+
+    http_requests(sess, text(
+        "select net.http_post('http://localhost:8080/post') from generate_series(1, 10)"
+    ))
+
+    wait_for_response_count(autocommit_sess, 10)
+
+    assert requests_coalesced(autocommit_sess) == coalesced_before
+
+
+def test_coalesced_requests_keep_their_store_response(sess, autocommit_sess, coalesce_requests):
+    """Each coalesced request is stored according to its own store_response"""
+
+    http_requests(sess, text(
+        """
+        select net.http_get('http://localhost:8080/anything?flag=1', store_response := s::net.response_storage)
+        from unnest(array['always', 'never', 'always', 'on_error']) s
+    """
+    ))
+
+    wait_for_response_count(autocommit_sess, 2)
+
+    time.sleep(0.5)
+
+    (stored,) = autocommit_sess.execute(text("select count(*) from net._http_response")).fetchone()
+
+    assert stored == 2
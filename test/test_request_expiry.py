@@ -0,0 +1,117 @@
+import time
+
+import pytest
+from sqlalchemy import text
+from common import collect_response_sync, http_request
+
+
+@pytest.fixture
+def max_queue_age(pg_net_settings):
+    """Makes the requests expire after 100 ms in the queue"""
+
+    pg_net_settings(max_queue_age="100ms")
+
+
+@pytest.fixture
+def small_batches(pg_net_settings):
+    """Makes the worker take 10 requests per batch"""
+
+    pg_net_settings(batch_size=10)
+
+
+def expired_count(sess):
+    (count,) = sess.execute(text("select requests_expired from net.worker_stats()")).one()
+    return count
+
+
+def test_request_past_its_expiry_isnt_sent(sess):
+    """A request whose expires_at passed gets an error response instead of being sent"""
+
+    before = expired_count(sess)
+
+    request_id = http_request(sess, text(
+        """
+        select net.http_get(
+            'http://localhost:8080/anything',
+            expires_at := now() - interval '1 second'
+        );
+    """
+    ))
+
+    response = collect_response_sync(sess, request_id)
+
+    assert response["status"] == "ERROR"
+    assert response["message"] == "Request expired before being sent"
+    assert expired_count(sess) == before + 1
+
+
+def test_request_before_its_expiry_is_sent(sess):
+    """A request whose expires_at is ahead is sent as usual"""
+
+    request_id = http_request(sess, text(
+        """
+        select net.http_post(
+            'http://localhost:8080/post',
+            expires_at := now() + interval '1 minute'
+        );
+    """
+    ))
+
+    response = collect_response_sync(sess, request_id)
+
+    assert response["status"] == "SUCCESS"
+    assert response["status_code"] == 200
+
+
+def test_max_queue_age(sess, max_queue_age):
+    """A request that waited in the queue longer than pg_net.max_queue_age expires"""
+
+    (request_id,) = sess.execute(text("select net.http_get('http://localhost:8080/anything')")).one()
+
+    # the age counts from the transaction that enqueued the request, not from its commit
+    time.sleep(0.3)
+    sess.commit()
+
+    response = collect_response_sync(sess, request_id)
+
+    assert response["status"] == "ERROR"
+    assert response["message"] == "Request expired before being sent"
+
+    fresh_id = http_request(sess, text("select net.http_get('http://localhost:8080/anything')"))
+
+    assert collect_response_sync(sess, fresh_id)["status"] == "SUCCESS"
+
+
+def test_expired_backlog_drains_in_bulk(sess, small_batches):
+    """A backlog of expired requests isn't taken a batch at a time, with a pause after each one"""
+
+    before = expired_count(sess)
+
+    (ids,) = sess.execute(text(
+        """
+        select array_agg(net.http_get(
+            'http://localhost:8080/anything',
+            expires_at := now() - interval '1 second'
+        ))
+        from generate_series(1, 1000);
+    """
+    )).one()
+    sess.commit()
+
+    # 100 batches of 10 requests would take over 100 seconds
+    start = time.monotonic()
+    while expired_count(sess) < before + 1000 and time.monotonic() - start < 10:
+        time.sleep(0.1)
+
+    assert expired_count(sess) == before + 1000
+
+    (left,) = sess.execute(text("select count(*) from net.http_request_queue")).one()
+    assert left == 0
+
+    (failed,) = sess.execute(text(
+        """
+        select count(*) from net._http_response
+        where id = any(:ids) and error_msg = 'Request expired before being sent'
+    """
+    ), {"ids": ids}).one()
+    assert failed == 1000
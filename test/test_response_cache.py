@@ -0,0 +1,72 @@
+import pytest
+from sqlalchemy import text
+from common import http_request, wait_for_response_count
+
+
+@pytest.fixture
+def response_cache(pg_net_settings):
+    """Gives the worker a 1MB response cache"""
+
+    pg_net_settings(response_cache_size="1MB")
+
+
+def cache_hits(autocommit_sess):
+    (hits,) = autocommit_sess.execute(text(
+        "select cache_hits from net.worker_stats()"
+    )).fetchone()
+
+    return hits
+
+
+def get_twice(sess, autocommit_sess, url):
+    """Requests the url in two batches, returns the responses"""
+
+    for count in (1, 2):
+        http_request(sess, text(f"select net.http_get('{url}')"))
+        wait_for_response_count(autocommit_sess, count)
+
+    return autocommit_sess.execute(text(
+        "select status_code, content from net._http_response order by id"
+    )).fetchall()
+
+
+def test_fresh_response_is_served_from_the_cache(sess, autocommit_sess, response_cache):
+    """A response with a max-age is reused without sending the request again"""
+
+    hits_before = cache_hits(autocommit_sess)
+
+    responses = get_twice(sess, autocommit_sess, "http://localhost:8080/cached")
+
+    assert responses == [(200, "cached\n"), (200, "cached\n")]
+    assert cache_hits(autocommit_sess) - hits_before == 1
+
+
+def test_stale_response_is_revalidated(sess, autocommit_sess, response_cache):
+    """A no-cache response with an ETag is revalidated, the 304 gets the cached response"""
+
+    hits_before = cache_hits(autocommit_sess)
+
+    responses = get_twice(sess, autocommit_sess, "http://localhost:8080/etag")
+
+    assert responses == [(200, "etag\n"), (200, "etag\n")]
+    assert cache_hits(autocommit_sess) - hits_before == 1
+
+
+def test_response_without_cache_headers_is_not_cached(sess, autocommit_sess, response_cache):
+    """Without a max-age or validators the response can't be reused"""
+
+    hits_before = cache_hits(autocommit_sess)
+
+    get_twice(sess, autocommit_sess, "http://localhost:8080/anything?flag=1")
+
+    assert cache_hits(autocommit_sess) == hits_before
+
+
+def test_responses_are_not_cached_by_default(sess, autocommit_sess):
+    """Without pg_net.response_cache_size every request is sent"""
+
+    hits_before = cache_hits(autocommit_sess)
+
+    get_twice(sess, autocommit_sess, "http://localhost:8080/cached")
+
+    assert cache_hits(autocommit_sess) == hits_before
@@ -0,0 +1,184 @@
+import os
+import subprocess
+
+import pytest
+from sqlalchemy import create_engine, text
+from sqlalchemy.orm import Session
+from common import wait_for_postgres_ready, wait_for_response_count
+
+
+def restart_postgres(engine):
+    """Restarts postgres, needed for pg_net.shared_queue_size since it sizes shared memory"""
+
+    engine.dispose()
+    subprocess.run(["pg_ctl", "restart", "-D", os.getenv('PGDATA')])
+    wait_for_postgres_ready(engine, None)
+
+
+@pytest.fixture(scope="module")
+def shared_queue_sess():
+    """An autocommit session on a postgres with a shared queue small enough to fill up"""
+
+    engine = create_engine("postgresql:///postgres")
+    sess = Session(engine.execution_options(isolation_level="AUTOCOMMIT"))
+    sess.execute(text("alter system set pg_net.shared_queue_size to '16kB'"))
+    restart_postgres(engine)
+
+    sess = Session(engine.execution_options(isolation_level="AUTOCOMMIT"))
+    sess.execute(text("create extension if not exists pg_net"))
+    sess.execute(text("select net.wait_until_running()"))
+
+    yield sess
+
+    sess.execute(text("drop extension if exists pg_net cascade"))
+    sess.execute(text("alter system reset pg_net.shared_queue_size"))
+    restart_postgres(engine)
+    engine.dispose()
+
+
+def test_shared_queue_bypasses_table(shared_queue_sess):
+    """Requests go through shared memory, the queue table stays empty"""
+
+    shared_queue_sess.execute(text("delete from net._http_response"))
+
+    (request_id,) = shared_queue_sess.execute(text(
+        """
+        select net.http_get(
+            url:='http://localhost:8080/anything',
+            params:='{"hello": "world"}',
+            headers:='{"x-test": "shared"}'
+        );
+    """
+    )).fetchone()
+
+    (queue_count,) = shared_queue_sess.execute(text(
+        "select count(*) from net.http_request_queue"
+    )).fetchone()
+    assert queue_count == 0
+
+    wait_for_response_count(shared_queue_sess, 1)
+
+    (status_code, content) = shared_queue_sess.execute(text(
+        "select status_code, content from net._http_response where id = :id"
+    ), {"id": request_id}).fetchone()
+
+    assert status_code == 200
+    assert content == "?hello=world\n"
+
+
+def test_shared_queue_discards_rolled_back_requests(shared_queue_sess):
+    """Requests of aborted transactions and subtransactions are never dispatched"""
+
+    shared_queue_sess.execute(text("delete from net._http_response"))
+
+    shared_queue_sess.execute(text(
+        """
+        do $$
+        begin
+          perform net.http_get('http://localhost:8080/pathological?status=201');
+          begin
+            perform net.http_get('http://localhost:8080/pathological?status=500');
+            raise exception 'abort the subtransaction';
+          exception when others then null;
+          end;
+        end $$;
+    """
+    ))
+
+    shared_queue_sess.execute(text(
+        """
+        begin;
+        select net.http_get('http://localhost:8080/pathological?status=501');
+        rollback;
+    """
+    ))
+
+    wait_for_response_count(shared_queue_sess, 1)
+
+    (status_codes,) = shared_queue_sess.execute(text(
+        "select array_agg(status_code) from net._http_response"
+    )).fetchone()
+
+    assert status_codes == [201]
+
+
+def test_shared_queue_spills_to_table(shared_queue_sess):
+    """When the shared queue is full, requests are stored in the queue table"""
+
+    shared_queue_sess.execute(text("delete from net._http_response"))
+
+    engine = create_engine("postgresql:///postgres")
+    sess = Session(engine)
+
+    sess.execute(text(
+        """
+        select net.http_get('http://localhost:8080/pathological?status=200') from generate_series(1, 500);
+    """
+    ))
+
+    (queue_count,) = sess.execute(text(
+        "select count(*) from net.http_request_queue"
+    )).fetchone()
+
+    sess.commit()
+    engine.dispose()
+
+    assert queue_count > 0
+
+    wait_for_response_count(shared_queue_sess, 500)
+
+    (count, distinct_ids) = shared_queue_sess.execute(text(
+        "select count(*), count(distinct id) from net._http_response where status_code = 200"
+    )).fetchone()
+
+    assert count == 500
+    assert distinct_ids == 500
+
+
+def test_shared_queue_keeps_store_response(shared_queue_sess):
+    """The store_response of a request goes through the shared queue"""
+
+    shared_queue_sess.execute(text("delete from net._http_response"))
+
+    shared_queue_sess.execute(text(
+        """
+        select
+          net.http_get('http://localhost:8080/pathological?status=200', store_response := 'on_error'),
+          net.http_get('http://localhost:8080/pathological?status=502', store_response := 'on_error'),
+          net.http_get('http://localhost:8080/pathological?status=503', store_response := 'never');
+    """
+    ))
+
+    wait_for_response_count(shared_queue_sess, 1)
+
+    (status_code,) = shared_queue_sess.execute(text(
+        "select status_code from net._http_response"
+    )).fetchone()
+
+    assert status_code == 502
+
+
+def test_queue_limits_go_through_table(shared_queue_sess):
+    """Requests are stored in the queue table while a queue limit is set, the table enforces it"""
+
+    shared_queue_sess.execute(text("delete from net._http_response"))
+
+    engine = create_engine("postgresql:///postgres")
+    sess = Session(engine)
+
+    sess.execute(text("set local pg_net.max_queued_requests_per_role to 10"))
+
+    (request_id,) = sess.execute(text(
+        "select net.http_get('http://localhost:8080/pathological?status=200')"
+    )).fetchone()
+
+    (queue_ids,) = sess.execute(text(
+        "select array_agg(id) from net.http_request_queue"
+    )).fetchone()
+
+    sess.commit()
+    engine.dispose()
+
+    assert queue_ids == [request_id]
+
+    wait_for_response_count(shared_queue_sess, 1)
@@ -43,7 +43,8 @@ def get_worker_query_count(sess):
         select coalesce(sum(calls), 0)
         from pg_stat_statements
         where
-            query ilike '%DELETE FROM net._http_response r %' or
+            query ilike '%truncate net._http_response%' or
+            query ilike '%DELETE FROM net._http_response%' or
             query ilike '%DELETE FROM net.http_request_queue%';
     """
     )).fetchone()
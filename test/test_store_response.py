@@ -0,0 +1,96 @@
+import pytest
+from sqlalchemy import text
+from common import http_requests, wait_for_response_count, wait_until
+
+
+def get_worker_stats(sess):
+    return sess.execute(text(
+        """
+        select requests_succeeded, requests_http_error, requests_failed, responses_skipped
+        from net.worker_stats();
+    """
+    )).fetchone()
+
+
+def test_store_response_never(sess, autocommit_sess):
+    """Responses aren't stored but their outcome is counted"""
+
+    (succeeded, http_error, failed, skipped) = get_worker_stats(autocommit_sess)
+
+    http_requests(sess, text(
+        """
+        select net.http_get('http://localhost:8080/pathological?status=200', store_response := 'never')
+        from generate_series(1, 3);
+    """
+    ))
+
+    http_requests(sess, text(
+        """
+        select net.http_post('http://localhost:8080/pathological?status=500', store_response := 'never');
+    """
+    ))
+
+    stats = wait_until(
+        fetch=lambda: get_worker_stats(autocommit_sess),
+        predicate=lambda stats: stats[3] == skipped + 4,
+        description="the skipped responses to be counted"
+    )
+
+    assert stats == (succeeded + 3, http_error + 1, failed, skipped + 4)
+
+    wait_for_response_count(autocommit_sess, 0)
+
+
+def test_store_response_on_error(sess, autocommit_sess):
+    """Only the responses of failed requests are stored"""
+
+    http_requests(sess, text(
+        """
+        select net.http_get('http://localhost:8080/pathological?status=200', store_response := 'on_error')
+        union all
+        select net.http_get('http://localhost:8080/pathological?status=404', store_response := 'on_error')
+        union all
+        select net.http_delete('http://localhost:8080/pathological?status=503', store_response := 'on_error')
+        union all
+        select net.http_get('http://localhost:8081', store_response := 'on_error');
+    """
+    ))
+
+    wait_for_response_count(autocommit_sess, 3)
+
+    (status_codes, errors) = autocommit_sess.execute(text(
+        """
+        select
+          array_agg(status_code order by status_code) filter (where status_code is not null),
+          count(*) filter (where error_msg is not null)
+        from net._http_response;
+    """
+    )).fetchone()
+
+    assert status_codes == [404, 503]
+    assert errors == 1
+
+
+def test_store_response_always_by_default(sess, autocommit_sess):
+    """Responses are stored unless asked otherwise"""
+
+    http_requests(sess, text(
+        """
+        select net.http_get('http://localhost:8080/pathological?status=200');
+    """
+    ))
+
+    wait_for_response_count(autocommit_sess, 1)
+
+
+def test_store_response_invalid(sess):
+    """Only the known storage modes are accepted"""
+
+    with pytest.raises(Exception) as execinfo:
+        sess.execute(text(
+            """
+            select net.http_get('http://localhost:8080', store_response := 'sometimes');
+        """
+        ))
+
+    assert 'violates check constraint "response_storage_check"' in str(execinfo)
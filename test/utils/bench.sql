@@ -0,0 +1,32 @@
+-- micro-benchmarks of the worker hot path, they need pg_net built with `make BENCH=1`
+create or replace function net._bench_hot_path(
+  function text,
+  iterations int,
+  url text,
+  out ns_per_op float8,
+  out bytes_per_op float8
+)
+  language c
+as '$libdir/pg_net', 'bench_hot_path';
+
+create table bench_run (
+  function text,
+  iterations int,
+  ns_per_op numeric,
+  bytes_per_op numeric
+);
+
+-- runs every function in isolation, the url is requested once to get the response headers and the stored response
+create or replace procedure bench_hot_path(iterations int default 100000, url text default 'http://localhost:8080/post') as $$
+declare
+  function text;
+begin
+  foreach function in array array[
+    'get_request_queue_row', 'jsonb_headers_to_slist', 'init_curl_handle', 'jsonb_headers_from_curl_handle', 'insert_response'
+  ] loop
+    insert into bench_run
+    select function, iterations, round(b.ns_per_op::numeric, 1), round(b.bytes_per_op::numeric, 1)
+    from net._bench_hot_path(function, iterations, url) b;
+  end loop;
+end;
+$$ language plpgsql;
@@ -4,7 +4,11 @@ create table run (
   time_taken interval,
   request_successes bigint,
   request_failures bigint,
-  last_failure_error text
+  last_failure_error text,
+  event_backend text,
+  event_syscalls bigint,
+  syscalls_per_request numeric,
+  wakeups_per_request numeric
 );
 
 -- loadtest using many gets, used to be called `repro_timeouts`
@@ -17,9 +21,15 @@ declare
   request_successes bigint;
   request_failures bigint;
   last_failure_error text;
+  first_syscalls bigint;
+  first_wakeups bigint;
+  syscalls bigint;
+  wakeups bigint;
 begin
   delete from net._http_response;
 
+  select s.event_syscalls, s.event_wakeups into first_syscalls, first_wakeups from net.worker_stats() s;
+
   with do_requests as (
     select
       net.http_get(url) as id
@@ -42,8 +52,157 @@ begin
   into request_successes, request_failures, last_failure_error
   from net._http_response;
 
+  select s.event_syscalls - first_syscalls, s.event_wakeups - first_wakeups
+  into syscalls, wakeups
+  from net.worker_stats() s;
+
   insert into run values (
     number_of_requests, current_setting('pg_net.batch_size')::int, age(second_time, first_time),
-    request_successes, request_failures, last_failure_error);
+    request_successes, request_failures, last_failure_error,
+    current_setting('pg_net.event_backend'), syscalls,
+    round(syscalls::numeric / number_of_requests, 2), round(wakeups::numeric / number_of_requests, 2));
+end;
+$$ language plpgsql;
+
+create table enqueue_run (
+  function text,
+  calls int,
+  time_taken interval,
+  calls_per_sec numeric
+);
+
+-- measures how fast the request functions enqueue, the requests are rolled back so the worker never runs them
+create or replace procedure bench_enqueue(number_of_calls int default 100000, function text default 'http_get') as $$
+declare
+  first_time timestamptz;
+  second_time timestamptz;
+begin
+  first_time := clock_timestamp();
+
+  execute format('select count(net.%I(%L)) from generate_series(1, %s)', function, 'http://localhost:8080', number_of_calls);
+
+  second_time := clock_timestamp();
+
+  rollback;
+
+  insert into enqueue_run values (
+    function, number_of_calls, age(second_time, first_time),
+    round(number_of_calls / extract(epoch from age(second_time, first_time)))
+  );
+end;
+$$ language plpgsql;
+
+-- the requests of every load test scenario, for the request number `s`
+create or replace function loadtest_requests(s int)
+returns table(scenario text, method text, url text, timeout_milliseconds int) as $$
+  values
+    ('fast',          'GET',    'http://localhost:8080', 5000),
+    ('delayed',       'GET',    'http://localhost:8080/pathological?delay=1', 5000),
+    ('large_body',    'GET',    'http://localhost:8080/large', 5000),
+    -- one request in 10 is slow
+    ('slow_fast_mix', 'GET',    case when s % 10 = 0 then 'http://localhost:8080/pathological?delay=1' else 'http://localhost:8080' end, 5000),
+    -- *.localhost resolves to the loopback, so each host gets its own connections
+    ('many_hosts',    'GET',    format('http://host-%s.localhost:8080', s % 100), 5000),
+    -- one request in 5 fails with a 503
+    ('error_rate',    'GET',    case when s % 5 = 0 then 'http://localhost:8080/pathological?status=503' else 'http://localhost:8080/pathological?status=200' end, 5000),
+    -- one request in 10 times out
+    ('timeout_rate',  'GET',    case when s % 10 = 0 then 'http://localhost:8080/pathological?delay=2' else 'http://localhost:8080' end, 1000),
+    ('post',          'POST',   'http://localhost:8080/post', 5000),
+    ('delete',        'DELETE', 'http://localhost:8080/delete', 5000)
+$$ language sql immutable;
+
+-- when each request completed, recorded by the completion callback
+create table loadtest_completion (
+  id bigint,
+  completed_at timestamptz,
+  status_code int,
+  timed_out bool,
+  error_msg text
+);
+
+create or replace function loadtest_record_completions(completions net.http_completion[]) returns void as $$
+  insert into loadtest_completion
+  select id, clock_timestamp(), status_code, timed_out, error_msg from unnest(completions);
+$$ language sql;
+
+create table scenario_run (
+  pg_net_version text,
+  scenario text,
+  requests int,
+  batch_size int,
+  time_taken interval,
+  requests_per_sec numeric,
+  -- from the commit of the requests until the completion callback got them, in milliseconds
+  p50_latency_ms numeric,
+  p95_latency_ms numeric,
+  p99_latency_ms numeric,
+  error_rate numeric,
+  timeout_rate numeric
+);
+
+-- runs the requests of one scenario and waits until all of them complete
+create or replace procedure run_scenario(scenario text, number_of_requests int default 1000) as $$
+declare
+  callback regprocedure := 'loadtest_record_completions(net.http_completion[])';
+  enqueued_at timestamptz;
+  completed bigint;
+begin
+  if not exists (select from loadtest_requests(1) r where r.scenario = run_scenario.scenario) then
+    raise exception 'unknown scenario "%"', scenario;
+  end if;
+
+  delete from loadtest_completion;
+
+  perform
+    case r.method
+      when 'GET' then
+        net.http_get(r.url, timeout_milliseconds := r.timeout_milliseconds, store_response := 'never', callback := callback)
+      when 'POST' then
+        net.http_post(r.url, jsonb_build_object('request', s), timeout_milliseconds := r.timeout_milliseconds, store_response := 'never', callback := callback)
+      when 'DELETE' then
+        net.http_delete(r.url, jsonb_build_object('request', s::text), timeout_milliseconds := r.timeout_milliseconds, store_response := 'never', callback := callback)
+    end
+  from generate_series(1, number_of_requests) s, loadtest_requests(s) r
+  where r.scenario = run_scenario.scenario;
+
+  enqueued_at := clock_timestamp();
+
+  commit;
+
+  raise notice 'Waiting until % requests of the % scenario complete', number_of_requests, scenario;
+
+  loop
+    select count(*) into completed from loadtest_completion;
+    exit when completed >= number_of_requests;
+    perform pg_sleep(0.05);
+  end loop;
+
+  insert into scenario_run
+  select
+    (select extversion from pg_extension where extname = 'pg_net'),
+    scenario,
+    number_of_requests,
+    current_setting('pg_net.batch_size')::int,
+    max(completed_at) - enqueued_at,
+    round(number_of_requests / extract(epoch from max(completed_at) - enqueued_at), 1),
+    round((percentile_cont(0.50) within group (order by extract(epoch from completed_at - enqueued_at)) * 1000)::numeric, 1),
+    round((percentile_cont(0.95) within group (order by extract(epoch from completed_at - enqueued_at)) * 1000)::numeric, 1),
+    round((percentile_cont(0.99) within group (order by extract(epoch from completed_at - enqueued_at)) * 1000)::numeric, 1),
+    round(count(*) filter (where status_code >= 400 or error_msg is not null)::numeric / number_of_requests, 3),
+    round(count(*) filter (where timed_out)::numeric / number_of_requests, 3)
+  from loadtest_completion;
+
+  commit;
+end;
+$$ language plpgsql;
+
+-- runs the scenarios one after the other, all of them by default
+create or replace procedure loadtest_matrix(number_of_requests int default 1000, scenarios text[] default null) as $$
+declare
+  scenario text;
+begin
+  foreach scenario in array coalesce(scenarios, array(select r.scenario from loadtest_requests(1) r)) loop
+    call run_scenario(scenario, number_of_requests);
+  end loop;
 end;
 $$ language plpgsql;